@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "bench_rom.h"
+
+int bench_rom_write(const bench_rom *rom, char *path){
+    strcpy(path, "/tmp/nes_bench_XXXXXX");
+    int fd = mkstemp(path);
+    if(fd < 0){
+        perror("mkstemp");
+        return -1;
+    }
+
+    size_t prg_size = rom->prg_chunks * 16384;
+    size_t chr_size = rom->chr_chunks * 8192;
+    size_t size = 16 + prg_size + chr_size;
+    uint8_t *image = calloc(1, size);
+    uint8_t *prg = image + 16;
+    uint8_t *chr = prg + prg_size;
+    uint8_t *last = prg + prg_size - 16384;
+
+    memcpy(image, "NES\x1A", 4);
+    image[4] = rom->prg_chunks;
+    image[5] = rom->chr_chunks;
+    image[6] = (rom->mapper & 0x0F) << 4;
+    image[7] = rom->mapper & 0xF0;
+
+    for(size_t i = 0; i < prg_size; i++) prg[i] = (uint8_t)(i * 7);
+    for(size_t i = 0; i < chr_size; i++) chr[i] = (uint8_t)(i * 37);
+
+    uint16_t nmi = rom->nmi ? rom->nmi : 0xFF00;
+    uint16_t irq = rom->irq ? rom->irq : 0xFF00;
+    memcpy(last, rom->code, rom->code_len);
+    last[0x3F00] = 0x40;                            // $FF00: RTI
+    last[0x3FFA] = nmi & 0xFF; last[0x3FFB] = nmi >> 8;
+    last[0x3FFC] = 0x00; last[0x3FFD] = 0xC0;       // Reset
+    last[0x3FFE] = irq & 0xFF; last[0x3FFF] = irq >> 8;
+
+    int ok = write(fd, image, size) == (ssize_t)size;
+    close(fd);
+    free(image);
+    if(!ok) unlink(path);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,21 @@
+#ifndef _BENCH_ROM_H_
+#define _BENCH_ROM_H_
+#include <stdint.h>
+#include <stddef.h>
+
+// Synthetic iNES images used by the benchmarks.
+typedef struct bench_rom{
+    uint8_t mapper;
+    uint8_t prg_chunks;         // 16 KB units
+    uint8_t chr_chunks;         // 8 KB units
+    const uint8_t *code;        // Assembled at $C000, in the last PRG chunk
+    size_t code_len;
+    uint16_t nmi, irq;          // Handlers inside "code", 0 for the RTI at $FF00
+} bench_rom;
+
+// Writes an iNES image described by "rom" to a new temporary file and stores its name in "path"
+// (at least 32 bytes). Reset goes to $C000, NMI and IRQ to their handler or to an RTI at $FF00.
+// Returns 0 on success.
+int bench_rom_write(const bench_rom *rom, char *path);
+
+#endif
@@ -0,0 +1,409 @@
+// Micro-benchmarks for the individual hot functions of the emulator.
+//
+// Every kernel is calibrated to run for at least MIN_RUN_SECONDS, then measured RUNS times; the best
+// run is reported in TSC cycles/op (x86) and ns/op. The process is pinned to one core so the numbers
+// are comparable between runs.
+//
+// usage: microbench [-c core] [filter]
+//
+// Only kernels whose name contains "filter" are run.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "bus.h"
+#include "cartridge.h"
+#include "mappers.h"
+#include "resampler.h"
+#include "state_hash.h"
+#include "bench_rom.h"
+#ifndef NO_SDL
+#include "rendering.h"
+#endif
+
+#define MIN_RUN_SECONDS 0.1
+#define RUNS 5
+
+// One frame of APU output at the intermediate rate, resampled to the device rate
+#define RESAMPLE_IN_RATE 96000
+#define RESAMPLE_OUT_RATE 48000
+#define RESAMPLE_FRAME (RESAMPLE_IN_RATE / 60)
+
+// Every instruction class fills one 1 KB block starting at $C000 + class * $400 with a single
+// instruction repeated, followed by a JMP back to the start of the block.
+typedef struct instruction_class{
+    const char *name;
+    uint8_t bytes[3];
+    uint8_t len;
+} instruction_class;
+
+static const instruction_class classes[] = {
+    { "load",      { 0xA9, 0x01 },       2 },     // LDA #$01
+    { "store",     { 0x85, 0x10 },       2 },     // STA $10
+    { "alu",       { 0x69, 0x01 },       2 },     // ADC #$01
+    { "rmw",       { 0xE6, 0x10 },       2 },     // INC $10
+    { "transfer",  { 0xAA },             1 },     // TAX
+    { "absolute",  { 0xBD, 0x00, 0x03 }, 3 },     // LDA $0300,X
+    { "branch",    { 0xB0, 0x00 },       2 },     // BCS +0 (carry is set, always taken)
+    { "flag",      { 0x38 },             1 },     // SEC
+};
+#define N_CLASSES (int)(sizeof(classes) / sizeof(classes[0]))
+
+static volatile uint32_t sink;
+static nes_system *nes;
+#ifndef NO_SDL
+static SDL_Surface *surface;
+#endif
+
+static inline uint64_t read_tsc(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Kernels. Each one performs "n" operations.
+
+static void k_cpu_read_ram(uint64_t n){
+    uint32_t acc = 0;
+    for(uint64_t i = 0; i < n; i++) acc += cpu_read(nes, i & 0x1FFF);
+    sink = acc;
+}
+
+static void k_cpu_read_ppu(uint64_t n){
+    uint32_t acc = 0;
+    for(uint64_t i = 0; i < n; i++) acc += cpu_read(nes, 0x2002);
+    sink = acc;
+}
+
+static void k_cpu_read_cart(uint64_t n){
+    uint32_t acc = 0;
+    for(uint64_t i = 0; i < n; i++) acc += cpu_read(nes, 0x8000 | (i & 0x7FFF));
+    sink = acc;
+}
+
+static void k_cpu_write_ram(uint64_t n){
+    for(uint64_t i = 0; i < n; i++) cpu_write(nes, i & 0x1FFF, i);
+}
+
+static void k_cpu_write_ppu(uint64_t n){
+    for(uint64_t i = 0; i < n; i++) cpu_write(nes, 0x2006, i);
+}
+
+static void k_cpu_write_cart(uint64_t n){
+    for(uint64_t i = 0; i < n; i++) cpu_write(nes, 0x6000 | (i & 0x1FFF), i);
+}
+
+// One op is a whole 256 byte transfer.
+static void k_oam_dma(uint64_t n){
+    for(uint64_t i = 0; i < n; i++){
+        cpu_write(nes, 0x4014, 0x02);
+        nes->cpu.stall = 0;
+    }
+}
+
+// One op is one whole instruction.
+static void k_dispatch(uint64_t n){
+    for(uint64_t i = 0; i < n; i++){
+        do{
+            cpu_clock(nes);
+        }while(nes->cpu.cycles != 0);
+    }
+}
+
+static void k_ppu_read_pattern(uint64_t n){
+    uint32_t acc = 0;
+    for(uint64_t i = 0; i < n; i++) acc += ppu_read(nes, i & 0x1FFF);
+    sink = acc;
+}
+
+static void k_ppu_read_nametable(uint64_t n){
+    uint32_t acc = 0;
+    for(uint64_t i = 0; i < n; i++) acc += ppu_read(nes, 0x2000 | (i & 0x0FFF));
+    sink = acc;
+}
+
+static void k_ppu_read_palette(uint64_t n){
+    uint32_t acc = 0;
+    for(uint64_t i = 0; i < n; i++) acc += ppu_read(nes, 0x3F00 | (i & 0x1F));
+    sink = acc;
+}
+
+// One op is a whole 128x128 pattern table.
+static void k_pattern_table(uint64_t n){
+    for(uint64_t i = 0; i < n; i++) get_pattern_table(nes, i & 1, 0);
+}
+
+#ifndef NO_SDL
+// One op is a whole 128x128 pattern table.
+static void k_draw_element(uint64_t n){
+    for(uint64_t i = 0; i < n; i++) draw_element(surface, 0, 0, 128, 128, (uint32_t (*)[128])nes->ppu.px_pattern_table[i & 1]);
+}
+#endif
+
+static void k_mapper_prg(uint64_t n){
+    uint32_t acc = 0;
+    for(uint64_t i = 0; i < n; i++) acc += mapper_prg_read(&(nes->inserted_cart), 0x8000 | (i & 0x7FFF));
+    sink = acc;
+}
+
+static void k_mapper_chr(uint64_t n){
+    uint32_t acc = 0;
+    for(uint64_t i = 0; i < n; i++) acc += mapper_chr_read(&(nes->inserted_cart), i & 0x1FFF);
+    sink = acc;
+}
+
+// UxROM bank select, the register write plus the page table update.
+static void k_mapper_switch(uint64_t n){
+    for(uint64_t i = 0; i < n; i++) cpu_write(nes, 0x8000, i & 0x01);
+    cpu_write(nes, 0x8000, 0);
+}
+
+// One op is a hash of the whole state (2 KB RAM, 2 KB VRAM, OAM, palettes, registers).
+static void k_state_hash(uint64_t n){
+    uint64_t acc = 0;
+    for(uint64_t i = 0; i < n; i++){
+        nes->ram[i & 0x7FF]++;
+        acc ^= state_hash(nes);
+    }
+    sink = (uint32_t)acc;
+}
+
+// One op is a whole frame. The baseline: linear interpolation between the two nearest input samples,
+// no filtering at all.
+static int16_t resample_in[RESAMPLE_FRAME];
+static int16_t resample_out[RESAMPLE_FRAME];
+
+static void k_resample_linear(uint64_t n){
+    static uint64_t position = 0;           // 32.32, carried between frames like the resampler's
+    static int16_t previous = 0;
+    const uint64_t step = ((uint64_t)RESAMPLE_IN_RATE << 32) / RESAMPLE_OUT_RATE;
+    for(uint64_t i = 0; i < n; i++){
+        uint32_t count = 0;
+        for(; (position >> 32) < RESAMPLE_FRAME; position += step){
+            uint32_t index = (uint32_t)(position >> 32);
+            int32_t a = index ? resample_in[index - 1] : previous;
+            int32_t b = resample_in[index];
+            int32_t frac = (int32_t)((position & 0xFFFFFFFF) >> 16);
+            resample_out[count++] = (int16_t)(a + (((b - a) * frac) >> 16));
+        }
+        position -= (uint64_t)RESAMPLE_FRAME << 32;
+        previous = resample_in[RESAMPLE_FRAME - 1];
+        sink = count;
+    }
+}
+
+static resampler resamplers[RESAMPLER_QUALITIES][3];
+
+static void resample_frames(uint64_t n, enum RESAMPLER_QUALITY quality, enum RESAMPLER_ISA isa){
+    resampler *rs = &(resamplers[quality][isa]);
+    for(uint64_t i = 0; i < n; i++){
+        sink = resampler_process(rs, resample_in, RESAMPLE_FRAME, resample_out, RESAMPLE_FRAME);
+    }
+}
+
+static int avx2_supported(void){
+    return resamplers[0][RESAMPLER_AVX2].isa == RESAMPLER_AVX2;
+}
+
+#define RESAMPLE_KERNEL(q, i) static void k_resample_##q##_##i(uint64_t n){ resample_frames(n, q, i); }
+RESAMPLE_KERNEL(RESAMPLER_FAST, RESAMPLER_SCALAR)
+RESAMPLE_KERNEL(RESAMPLER_FAST, RESAMPLER_SSE2)
+RESAMPLE_KERNEL(RESAMPLER_FAST, RESAMPLER_AVX2)
+RESAMPLE_KERNEL(RESAMPLER_MEDIUM, RESAMPLER_SCALAR)
+RESAMPLE_KERNEL(RESAMPLER_MEDIUM, RESAMPLER_SSE2)
+RESAMPLE_KERNEL(RESAMPLER_MEDIUM, RESAMPLER_AVX2)
+RESAMPLE_KERNEL(RESAMPLER_BEST, RESAMPLER_SCALAR)
+RESAMPLE_KERNEL(RESAMPLER_BEST, RESAMPLER_SSE2)
+RESAMPLE_KERNEL(RESAMPLER_BEST, RESAMPLER_AVX2)
+
+typedef struct kernel{
+    const char *name;
+    void (*run)(uint64_t n);
+    int instruction_class;      // Index in "classes" for dispatch kernels, -1 otherwise
+    int (*supported)(void);     // NULL if it always runs
+} kernel;
+
+static const kernel kernels[] = {
+    { "cpu_read/ram",           k_cpu_read_ram,         -1 },
+    { "cpu_read/ppu",           k_cpu_read_ppu,         -1 },
+    { "cpu_read/cartridge",     k_cpu_read_cart,        -1 },
+    { "cpu_write/ram",          k_cpu_write_ram,        -1 },
+    { "cpu_write/ppu",          k_cpu_write_ppu,        -1 },
+    { "cpu_write/cartridge",    k_cpu_write_cart,       -1 },
+    { "oam_dma/ram",            k_oam_dma,              -1 },
+    { "dispatch/load",          k_dispatch,             0 },
+    { "dispatch/store",         k_dispatch,             1 },
+    { "dispatch/alu",           k_dispatch,             2 },
+    { "dispatch/rmw",           k_dispatch,             3 },
+    { "dispatch/transfer",      k_dispatch,             4 },
+    { "dispatch/absolute",      k_dispatch,             5 },
+    { "dispatch/branch",        k_dispatch,             6 },
+    { "dispatch/flag",          k_dispatch,             7 },
+    { "ppu_read/pattern",       k_ppu_read_pattern,     -1 },
+    { "ppu_read/nametable",     k_ppu_read_nametable,   -1 },
+    { "ppu_read/palette",       k_ppu_read_palette,     -1 },
+    { "get_pattern_table",      k_pattern_table,        -1 },
+#ifndef NO_SDL
+    { "draw_element/128x128",   k_draw_element,         -1 },
+#endif
+    { "mapper/prg",             k_mapper_prg,           -1 },
+    { "mapper/chr",             k_mapper_chr,           -1 },
+    { "mapper/switch",          k_mapper_switch,        -1 },
+    { "state_hash",             k_state_hash,           -1 },
+    { "resample/linear",        k_resample_linear,      -1 },
+    { "resample/fast/scalar",   k_resample_RESAMPLER_FAST_RESAMPLER_SCALAR,     -1 },
+    { "resample/fast/sse2",     k_resample_RESAMPLER_FAST_RESAMPLER_SSE2,       -1 },
+    { "resample/fast/avx2",     k_resample_RESAMPLER_FAST_RESAMPLER_AVX2,       -1, avx2_supported },
+    { "resample/medium/scalar", k_resample_RESAMPLER_MEDIUM_RESAMPLER_SCALAR,   -1 },
+    { "resample/medium/sse2",   k_resample_RESAMPLER_MEDIUM_RESAMPLER_SSE2,     -1 },
+    { "resample/medium/avx2",   k_resample_RESAMPLER_MEDIUM_RESAMPLER_AVX2,     -1, avx2_supported },
+    { "resample/best/scalar",   k_resample_RESAMPLER_BEST_RESAMPLER_SCALAR,     -1 },
+    { "resample/best/sse2",     k_resample_RESAMPLER_BEST_RESAMPLER_SSE2,       -1 },
+    { "resample/best/avx2",     k_resample_RESAMPLER_BEST_RESAMPLER_AVX2,       -1, avx2_supported },
+};
+
+// Points the CPU at the block of the instruction class being measured.
+static void prepare(const kernel *k){
+    if(k->instruction_class >= 0){
+        nes->cpu.pc = 0xC000 + k->instruction_class * 0x400;
+        nes->cpu.cycles = 0;
+        nes->cpu.status |= C;
+    }
+}
+
+static void measure(const kernel *k){
+    prepare(k);
+
+    // Calibrate the number of operations per run
+    uint64_t n = 1000;
+    for(;;){
+        double t0 = now_seconds();
+        k->run(n);
+        if(now_seconds() - t0 >= MIN_RUN_SECONDS) break;
+        n *= 2;
+    }
+
+    double best_ns = 1e30;
+    double best_cycles = 1e30;
+    for(int r = 0; r < RUNS; r++){
+        prepare(k);
+        double t0 = now_seconds();
+        uint64_t c0 = read_tsc();
+        k->run(n);
+        uint64_t c1 = read_tsc();
+        double t1 = now_seconds();
+
+        double ns = (t1 - t0) * 1e9 / n;
+        double cycles = (double)(c1 - c0) / n;
+        if(ns < best_ns) best_ns = ns;
+        if(cycles < best_cycles) best_cycles = cycles;
+    }
+
+    printf("%-24s %12llu %12.2f %10.2f\n", k->name, (unsigned long long)n, best_cycles, best_ns);
+}
+
+static int build_rom(char *path){
+    static uint8_t code[N_CLASSES * 0x400];
+    for(int c = 0; c < N_CLASSES; c++){
+        uint8_t *block = code + c * 0x400;
+        int i = 0;
+        while(i + classes[c].len <= 0x400 - 3){
+            memcpy(block + i, classes[c].bytes, classes[c].len);
+            i += classes[c].len;
+        }
+        uint16_t start = 0xC000 + c * 0x400;
+        block[i] = 0x4C;                            // JMP start
+        block[i + 1] = start & 0xFF;
+        block[i + 2] = start >> 8;
+    }
+
+    // UxROM, so bank switching can be measured. The code lives in the fixed bank.
+    bench_rom rom = { 2, 2, 1, code, sizeof(code) };
+    return bench_rom_write(&rom, path);
+}
+
+int main(int argc, char *argv[]){
+    int core = -1;
+    const char *filter = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "c:")) != -1){
+        switch(opt){
+        case 'c':
+            core = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c core] [filter]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(optind < argc) filter = argv[optind];
+
+    // Pin to the requested core, or to whichever one we are running on
+    if(core < 0) core = sched_getcpu();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    if(sched_setaffinity(0, sizeof(set), &set) != 0){
+        perror("sched_setaffinity");
+    }
+
+    char rom_path[64];
+    if(build_rom(rom_path) != 0) return 1;
+    nes = calloc(1, sizeof(nes_system));
+    int loaded = cartridge_load(nes, rom_path);
+    unlink(rom_path);
+    if(loaded != 0) return 1;
+    system_init(nes);
+
+    for(int i = 0; i < 32; i++) nes->ppu.palletes[i] = i;
+    get_pattern_table(nes, 0, 0);
+    get_pattern_table(nes, 1, 0);
+
+    // A pulse wave at 440 Hz with some noise on top, like the APU's output
+    uint32_t lfsr = 1;
+    for(int i = 0; i < RESAMPLE_FRAME; i++){
+        lfsr = lfsr * 1103515245 + 12345;
+        resample_in[i] = ((i * 440 / (RESAMPLE_IN_RATE / 2)) & 1 ? 6000 : -6000) + (int16_t)((lfsr >> 16) & 0x3FF);
+    }
+    for(int q = 0; q < RESAMPLER_QUALITIES; q++){
+        for(int i = 0; i < 3; i++){
+            if(resampler_init(&(resamplers[q][i]), RESAMPLE_IN_RATE, RESAMPLE_OUT_RATE, q) != 0) return 1;
+            resampler_set_isa(&(resamplers[q][i]), i);
+        }
+    }
+
+#ifndef NO_SDL
+    surface = SDL_CreateRGBSurfaceWithFormat(0, 256, 256, 32, SDL_PIXELFORMAT_ARGB8888);
+#endif
+
+    printf("pinned to core %d\n", core);
+    printf("%-24s %12s %12s %10s\n", "kernel", "ops/run", "cycles/op", "ns/op");
+    for(size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++){
+        if(filter && strstr(kernels[i].name, filter) == NULL) continue;
+        if(kernels[i].supported && !kernels[i].supported()){
+            printf("%-24s not supported by this cpu\n", kernels[i].name);
+            continue;
+        }
+        measure(&kernels[i]);
+    }
+
+    return 0;
+}
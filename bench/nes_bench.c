@@ -0,0 +1,290 @@
+// Headless throughput benchmark.
+//
+// Runs a fixed set of synthetic scenarios (plus any ROM given on the command line) for a number of
+// frames through system_run_frame() and reports emulated frames/sec, host ns per emulated CPU cycle,
+// instructions/sec and peak RSS. Each scenario runs in its own process so the RSS figures don't
+// leak into each other.
+//
+// usage: nes_bench [-f frames] [-l lanes] [-o results.jsonl] [rom.nes ...]
+//
+// With -l, every scenario also runs as a batch of that many instances (up to LOCKSTEP_LANES), each
+// pressing its own buttons, once one instance after the other and once through the lockstep runner.
+// Frames/sec then counts the frames of all instances, and "vector" is the share of the instructions
+// the lockstep runner ran on its vectors.
+//
+// With -o, one JSON object per scenario is appended to the file, so results can be tracked over time.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "bus.h"
+#include "cartridge.h"
+#include "lockstep.h"
+#include "bench_rom.h"
+
+#define WARMUP_FRAMES 10
+
+typedef struct scenario{
+    const char *name;
+    const char *description;
+    bench_rom rom;
+    const char *rom_path;       // Used instead of a synthetic ROM when not NULL
+} scenario;
+
+typedef struct bench_result{
+    double seconds;
+    uint64_t frames;
+    uint64_t cpu_cycles;
+    uint64_t instructions;
+    long peak_rss_kb;
+    double vector_share;        // Of the instructions, lockstep runs only
+} bench_result;
+
+enum RUNNER {RUN_SINGLE, RUN_BATCH, RUN_LOCKSTEP};
+static const char *runner_names[] = {"single", "batch", "lockstep"};
+
+// Arithmetic and RAM traffic only, rendering and NMI disabled.
+static const uint8_t cpu_bound[] = {
+    0xA2, 0x00,             // C000: LDX #$00
+    0xA0, 0x00,             // C002: LDY #$00
+    0xE8,                   // C004: loop: INX
+    0xB5, 0x10,             // C005: LDA $10,X
+    0x69, 0x03,             // C007: ADC #$03
+    0x9D, 0x00, 0x03,       // C009: STA $0300,X
+    0x6D, 0x00, 0x03,       // C00C: ADC $0300
+    0x88,                   // C00F: DEY
+    0xD0, 0xF2,             // C010: BNE loop
+    0x4C, 0x04, 0xC0,       // C012: JMP loop
+};
+
+// Rendering and NMI enabled, hammers the PPU registers and VRAM.
+static const uint8_t ppu_bound[] = {
+    0xA9, 0x80,             // C000: LDA #$80
+    0x8D, 0x00, 0x20,       // C002: STA $2000
+    0xA9, 0x1E,             // C005: LDA #$1E
+    0x8D, 0x01, 0x20,       // C007: STA $2001
+    0xAD, 0x02, 0x20,       // C00A: loop: LDA $2002
+    0xA9, 0x20,             // C00D: LDA #$20
+    0x8D, 0x06, 0x20,       // C00F: STA $2006
+    0xA9, 0x00,             // C012: LDA #$00
+    0x8D, 0x06, 0x20,       // C014: STA $2006
+    0xA2, 0x00,             // C017: LDX #$00
+    0x8E, 0x07, 0x20,       // C019: inner: STX $2007
+    0xAD, 0x07, 0x20,       // C01C: LDA $2007
+    0xE8,                   // C01F: INX
+    0xD0, 0xF7,             // C020: BNE inner
+    0x4C, 0x0A, 0xC0,       // C022: JMP loop
+};
+
+// Reads through the switchable UxROM bank plus a bank switch every iteration.
+static const uint8_t mapper_heavy[] = {
+    0xA2, 0x00,             // C000: LDX #$00
+    0xBD, 0x00, 0x80,       // C002: loop: LDA $8000,X
+    0x7D, 0x80, 0x80,       // C005: ADC $8080,X
+    0x9D, 0x00, 0x60,       // C008: STA $6000,X
+    0x8A,                   // C00B: TXA
+    0x29, 0x03,             // C00C: AND #$03
+    0x8D, 0xF0, 0xFF,       // C00E: STA $FFF0 (bank select)
+    0xE8,                   // C011: INX
+    0xD0, 0xEE,             // C012: BNE loop
+    0x4C, 0x02, 0xC0,       // C014: JMP loop
+};
+
+static const scenario builtin[] = {
+    { "cpu",    "CPU bound, RAM only",                  { 0, 1, 1, cpu_bound,    sizeof(cpu_bound)    }, NULL },
+    { "ppu",    "PPU register and VRAM traffic",        { 0, 1, 1, ppu_bound,    sizeof(ppu_bound)    }, NULL },
+    { "mapper", "UxROM bank switches and reads",        { 2, 4, 0, mapper_heavy, sizeof(mapper_heavy) }, NULL },
+};
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Buttons held by instance "lane" during "frame". The first instance never presses anything, the
+// others change every 8 frames.
+static uint8_t lane_buttons(int lane, uint64_t frame){
+    if(lane == 0) return 0;
+    uint32_t h = (uint32_t)lane * 0x9E3779B1u ^ (uint32_t)(frame / 8) * 0x85EBCA6Bu;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return h >> 24;
+}
+
+// Runs "lanes" instances of the rom. Returns 0 on success.
+static int run_scenario(const char *rom_path, uint64_t frames, int lanes, enum RUNNER runner, bench_result *res){
+    nes_system *nes[LOCKSTEP_LANES];
+    for(int i = 0; i < lanes; i++){
+        nes[i] = calloc(1, sizeof(nes_system));
+        if(cartridge_load(nes[i], (char *)rom_path) != 0) return -1;
+        system_init(nes[i]);
+    }
+    lockstep_group group;
+    if(runner == RUN_LOCKSTEP) lockstep_init(&group, nes, lanes);
+
+    uint64_t cycles0 = 0, instructions0 = 0, vector0 = 0;
+    double t0 = 0;
+    for(uint64_t f = 0; f < WARMUP_FRAMES + frames; f++){
+        if(f == WARMUP_FRAMES){
+            for(int i = 0; i < lanes; i++){
+                cycles0 += nes[i]->cpu.clock_count;
+                instructions0 += nes[i]->cpu.instruction_count;
+            }
+            if(runner == RUN_LOCKSTEP) vector0 = group.vector_instructions;
+            t0 = now_seconds();
+        }
+
+        for(int i = 0; i < lanes; i++) controller_set(nes[i], 0, lane_buttons(i, f));
+        if(runner == RUN_LOCKSTEP){
+            lockstep_run_frame(&group);
+        }else{
+            for(int i = 0; i < lanes; i++) system_run_frame(nes[i]);
+        }
+    }
+    res->seconds = now_seconds() - t0;
+    res->frames = frames * lanes;
+    res->cpu_cycles = res->instructions = 0;
+    for(int i = 0; i < lanes; i++){
+        res->cpu_cycles += nes[i]->cpu.clock_count;
+        res->instructions += nes[i]->cpu.instruction_count;
+    }
+    res->cpu_cycles -= cycles0;
+    res->instructions -= instructions0;
+    res->vector_share = runner == RUN_LOCKSTEP ? (double)(group.vector_instructions - vector0) / res->instructions : 0;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    res->peak_rss_kb = usage.ru_maxrss;
+    return 0;
+}
+
+// Runs the scenario in a child process and collects its result through a pipe. Returns 0 on success.
+static int run_isolated(const scenario *sc, uint64_t frames, int lanes, enum RUNNER runner, bench_result *res){
+    char tmp_path[64];
+    const char *rom_path = sc->rom_path;
+    if(rom_path == NULL){
+        if(bench_rom_write(&(sc->rom), tmp_path) != 0) return -1;
+        rom_path = tmp_path;
+    }
+
+    int fds[2];
+    if(pipe(fds) != 0){
+        perror("pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if(pid == 0){
+        close(fds[0]);
+        if(run_scenario(rom_path, frames, lanes, runner, res) != 0) _exit(1);
+        _exit(write(fds[1], res, sizeof(bench_result)) == sizeof(bench_result) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = read(fds[0], res, sizeof(bench_result));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    if(sc->rom_path == NULL) unlink(tmp_path);
+    return (got == sizeof(bench_result) && WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+static void report(FILE *json, const scenario *sc, int lanes, enum RUNNER runner, const bench_result *res){
+    double fps = res->frames / res->seconds;
+    double ns_per_cycle = res->seconds * 1e9 / res->cpu_cycles;
+    double ips = res->instructions / res->seconds;
+
+    char name[64];
+    if(runner == RUN_SINGLE){
+        snprintf(name, sizeof(name), "%s", sc->name);
+    }else{
+        snprintf(name, sizeof(name), "%s x%d%s", sc->name, lanes, runner == RUN_LOCKSTEP ? " lockstep" : "");
+    }
+    printf("%-24s %10.1f %12.2f %14.0f %10ld", name, fps, ns_per_cycle, ips, res->peak_rss_kb);
+    if(runner == RUN_LOCKSTEP) printf(" %9.1f%%", res->vector_share * 100);
+    printf("\n");
+
+    if(json){
+        fprintf(json, "{\"timestamp\": %ld, \"scenario\": \"%s\", \"description\": \"%s\", \"runner\": \"%s\", \"lanes\": %d, "
+            "\"frames\": %llu, \"seconds\": %.6f, \"fps\": %.3f, \"ns_per_cpu_cycle\": %.4f, \"instructions_per_sec\": %.0f, "
+            "\"cpu_cycles\": %llu, \"instructions\": %llu, \"peak_rss_kb\": %ld, \"vector_share\": %.4f}\n",
+            (long)time(NULL), sc->name, sc->description ? sc->description : "", runner_names[runner], lanes,
+            (unsigned long long)res->frames, res->seconds, fps, ns_per_cycle, ips,
+            (unsigned long long)res->cpu_cycles, (unsigned long long)res->instructions, res->peak_rss_kb, res->vector_share);
+    }
+}
+
+int main(int argc, char *argv[]){
+    uint64_t frames = 600;
+    int lanes = 1;
+    const char *json_path = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "f:l:o:")) != -1){
+        switch(opt){
+        case 'f':
+            frames = strtoull(optarg, NULL, 10);
+            break;
+        case 'l':
+            lanes = atoi(optarg);
+            if(lanes < 1 || lanes > LOCKSTEP_LANES){
+                fprintf(stderr, "lanes must be 1 to %d\n", LOCKSTEP_LANES);
+                return 1;
+            }
+            break;
+        case 'o':
+            json_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-f frames] [-l lanes] [-o results.jsonl] [rom.nes ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *json = NULL;
+    if(json_path){
+        json = fopen(json_path, "a");
+        if(json == NULL){
+            perror(json_path);
+            return 1;
+        }
+    }
+
+    printf("%-24s %10s %12s %14s %10s%s\n", "scenario", "fps", "ns/cycle", "instr/s", "rss (KB)", lanes > 1 ? "     vector" : "");
+
+    int failed = 0;
+    int n_builtin = sizeof(builtin) / sizeof(builtin[0]);
+    for(int i = 0; i < n_builtin + (argc - optind); i++){
+        scenario sc;
+        if(i < n_builtin){
+            sc = builtin[i];
+        }else{
+            memset(&sc, 0, sizeof(sc));
+            sc.rom_path = argv[optind + i - n_builtin];
+            sc.name = sc.rom_path;
+        }
+
+        for(int runner = RUN_SINGLE; runner <= (lanes > 1 ? RUN_LOCKSTEP : RUN_SINGLE); runner++){
+            int n = runner == RUN_SINGLE ? 1 : lanes;
+            bench_result res;
+            if(run_isolated(&sc, frames, n, runner, &res) != 0){
+                fprintf(stderr, "%s: failed\n", sc.name);
+                failed = 1;
+                break;
+            }
+            report(json, &sc, n, runner, &res);
+        }
+    }
+
+    if(json) fclose(json);
+    return failed;
+}
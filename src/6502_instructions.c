@@ -485,7 +485,6 @@ uint8_t BPL(nes_system *nes){
 //      implied       BRK           00    1     7
 uint8_t BRK(nes_system *nes){
     nes->cpu.pc++;
-	cpu_set_flag(nes, I, 1);
 	cpu_write(nes, nes->cpu.stkbase + nes->cpu.stkp, (nes->cpu.pc >> 8) & 0x00FF);
 	nes->cpu.stkp--;
 	cpu_write(nes, 0x0100 + nes->cpu.stkp, nes->cpu.pc & 0x00FF);
@@ -495,6 +494,7 @@ uint8_t BRK(nes_system *nes){
 	cpu_write(nes, nes->cpu.stkbase + nes->cpu.stkp, nes->cpu.status);
 	nes->cpu.stkp--;
 	cpu_set_flag(nes, B, 0);
+	cpu_set_flag(nes, I, 1);
 	nes->cpu.pc = (uint16_t)cpu_read(nes, 0xFFFE) | ((uint16_t)cpu_read(nes, 0xFFFF) << 8);
     return 0x00;
 }
@@ -0,0 +1,499 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include "apu_2A03.h"
+#include "bus.h"
+#include "mappers.h"
+
+#define APU_VOLUME 24000            // Amplitude of the mixer at full scale
+
+static const uint8_t length_table[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const uint8_t duty_table[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 },
+};
+
+static const uint8_t triangle_table[32] = {
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+};
+
+// In CPU cycles, NTSC then PAL
+static const uint16_t noise_table[2][16] = {
+    { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 },
+    { 4, 8, 14, 30, 60, 88, 118, 148, 188, 236, 354, 472, 708,  944, 1890, 3778 },
+};
+
+static const uint16_t dmc_table[2][16] = {
+    { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 },
+    { 398, 354, 316, 298, 276, 236, 210, 198, 176, 148, 132, 118,  98, 78, 66, 50 },
+};
+
+// Cycles of the frame counter steps from the start of the sequence. The 4 step sequence stops after
+// the fourth, which also raises the IRQ.
+static const uint16_t frame_table[2][5] = {
+    { 7457, 14913, 22371, 29829, 37281 },
+    { 8313, 16627, 24939, 33253, 41565 },
+};
+
+// Non linear mixer, indexed by pulse1 + pulse2 and by 3 * triangle + 2 * noise + dmc. Shared by all
+// instances and built by the first apu_init().
+static int16_t pulse_mix[31];
+static int16_t tnd_mix[203];
+static pthread_once_t mix_tables_once = PTHREAD_ONCE_INIT;
+
+static void init_mix_tables(void){
+    pulse_mix[0] = 0;
+    for(int i = 1; i < 31; i++) pulse_mix[i] = (int16_t)(APU_VOLUME * 95.52 / (8128.0 / i + 100));
+    tnd_mix[0] = 0;
+    for(int i = 1; i < 203; i++) tnd_mix[i] = (int16_t)(APU_VOLUME * 163.67 / (24329.0 / i + 100));
+}
+
+void apu_init(nes_system *nes){
+    apu_2A03 *apu = &(nes->apu);
+    pthread_once(&mix_tables_once, init_mix_tables);
+    memset(apu, 0, offsetof(apu_2A03, blip));
+    apu->pulse[0].next = apu->pulse[1].next = APU_IDLE;
+    apu->triangle.next = apu->noise.next = apu->dmc.next = APU_IDLE;
+    apu->noise.shift = 1;
+    apu->noise.period = noise_table[0][0];
+    apu->dmc.period = dmc_table[0][0];
+    apu->dmc.bits = 8;
+    apu->dmc.silence = 1;
+    apu->cycle = apu->audio_start = apu->frame_start = nes->cpu.clock_count;
+    apu->sample_rate = APU_SAMPLE_RATE;
+    blip_init(&(apu->blip), 1, 1);
+    apu_set_timing(nes);
+}
+
+// CPU cycles per second of the console
+static double cpu_rate(const nes_timing *timing){
+    return timing->frame_rate * (timing->last_scanline + 2) * 341 * timing->ppu_divider / timing->cpu_divider;
+}
+
+static void dmc_schedule(nes_system *nes);
+
+void apu_set_timing(nes_system *nes){
+    nes->apu.pal = nes->timing == &timing_pal;
+    blip_set_rates(&(nes->apu.blip), cpu_rate(nes->timing), nes->apu.sample_rate);
+    apu_schedule(nes);
+    dmc_schedule(nes);
+}
+
+void apu_set_sample_rate(nes_system *nes, double sample_rate){
+    nes->apu.sample_rate = sample_rate;
+    blip_set_rates(&(nes->apu.blip), cpu_rate(nes->timing), sample_rate);
+}
+
+// Channel units
+
+static inline uint8_t envelope_output(const apu_envelope *env){
+    return env->constant ? env->volume : env->decay;
+}
+
+static void envelope_clock(apu_envelope *env){
+    if(env->start){
+        env->start = 0;
+        env->decay = 15;
+        env->divider = env->volume;
+    }else if(env->divider == 0){
+        env->divider = env->volume;
+        if(env->decay) env->decay--;
+        else if(env->loop) env->decay = 15;
+    }else{
+        env->divider--;
+    }
+}
+
+// Period the sweep unit would switch to, the channel is muted while it is out of range.
+static inline uint16_t sweep_target(const apu_pulse *pulse, int channel){
+    uint16_t change = pulse->period >> pulse->sweep_shift;
+    if(!pulse->sweep_negate) return pulse->period + change;
+    return pulse->period - change - (channel == 0);     // Pulse 1 negates in ones' complement
+}
+
+static inline int pulse_muted(const apu_pulse *pulse, int channel){
+    return pulse->period < 8 || sweep_target(pulse, channel) > 0x7FF;
+}
+
+static void sweep_clock(apu_pulse *pulse, int channel){
+    if(pulse->sweep_divider == 0 && pulse->sweep_enabled && pulse->sweep_shift && !pulse_muted(pulse, channel)){
+        pulse->period = sweep_target(pulse, channel);
+    }
+    if(pulse->sweep_divider == 0 || pulse->sweep_reload){
+        pulse->sweep_divider = pulse->sweep_period;
+        pulse->sweep_reload = 0;
+    }else{
+        pulse->sweep_divider--;
+    }
+}
+
+static inline uint8_t pulse_output(const apu_pulse *pulse, int channel){
+    if(pulse->length == 0 || !duty_table[pulse->duty][pulse->sequence] || pulse_muted(pulse, channel)) return 0;
+    return envelope_output(&(pulse->envelope));
+}
+
+static inline uint8_t noise_output(const apu_noise *noise){
+    if(noise->length == 0 || (noise->shift & 0x01)) return 0;
+    return envelope_output(&(noise->envelope));
+}
+
+// The DMC memory reader doesn't run inside apu_run(): when the sample buffer empties with bytes left to
+// play, EVENT_DMC_DMA is scheduled at that cycle and the fetch happens when it fires (apu_dmc_dma()),
+// halting the CPU. Nothing is scheduled while the DMC is idle.
+
+static void dmc_step(apu_dmc *dmc){
+    if(!dmc->silence){
+        if(dmc->shift & 0x01){
+            if(dmc->level <= 125) dmc->level += 2;
+        }else{
+            if(dmc->level >= 2) dmc->level -= 2;
+        }
+    }
+    dmc->shift >>= 1;
+
+    if(--dmc->bits == 0){
+        dmc->bits = 8;
+        dmc->silence = !dmc->buffer_full;
+        if(dmc->buffer_full){
+            dmc->shift = dmc->buffer;
+            dmc->buffer_full = 0;       // EVENT_DMC_DMA is due now if there are bytes left
+        }
+    }
+    dmc->next += dmc->period;
+}
+
+// Parks the timers that can't change the output and restarts the ones that can.
+static inline void set_timer(uint64_t *next, int running, uint32_t period, uint64_t now){
+    if(!running) *next = APU_IDLE;
+    else if(*next == APU_IDLE) *next = now + period;
+}
+
+static void update_timers(apu_2A03 *apu){
+    for(int i = 0; i < 2; i++){
+        set_timer(&(apu->pulse[i].next), apu->pulse[i].length != 0, (apu->pulse[i].period + 1) * 2, apu->cycle);
+    }
+    // Periods below 2 are ultrasonic, the triangle holds its level instead
+    apu_triangle *tri = &(apu->triangle);
+    set_timer(&(tri->next), tri->length && tri->linear_counter && tri->period >= 2, tri->period + 1, apu->cycle);
+    set_timer(&(apu->noise.next), apu->noise.length != 0, apu->noise.period, apu->cycle);
+    apu_dmc *dmc = &(apu->dmc);
+    set_timer(&(dmc->next), !dmc->silence || dmc->buffer_full || dmc->remaining, dmc->period, apu->cycle);
+}
+
+// Frame counter
+
+static void quarter_frame(apu_2A03 *apu){
+    envelope_clock(&(apu->pulse[0].envelope));
+    envelope_clock(&(apu->pulse[1].envelope));
+    envelope_clock(&(apu->noise.envelope));
+
+    apu_triangle *tri = &(apu->triangle);
+    if(tri->linear_reload) tri->linear_counter = tri->linear_period;
+    else if(tri->linear_counter) tri->linear_counter--;
+    if(!tri->control) tri->linear_reload = 0;
+}
+
+static void half_frame(apu_2A03 *apu){
+    for(int i = 0; i < 2; i++){
+        if(!apu->pulse[i].envelope.loop && apu->pulse[i].length) apu->pulse[i].length--;
+        sweep_clock(&(apu->pulse[i]), i);
+    }
+    if(!apu->triangle.control && apu->triangle.length) apu->triangle.length--;
+    if(!apu->noise.envelope.loop && apu->noise.length) apu->noise.length--;
+}
+
+static inline uint64_t frame_next(const apu_2A03 *apu){
+    return apu->frame_start + frame_table[apu->pal][apu->frame_step];
+}
+
+static void frame_step(nes_system *nes){
+    apu_2A03 *apu = &(nes->apu);
+    uint8_t step = apu->frame_step;
+    uint8_t last = apu->five_step ? 4 : 3;
+
+    if(step != 3 || !apu->five_step) quarter_frame(apu);
+    if(step == 1 || step == last) half_frame(apu);
+    if(step == 3 && !apu->five_step && !apu->irq_inhibit){
+        apu->frame_irq = 1;
+        nes->irq_lines |= IRQ_APU_FRAME;
+    }
+
+    if(step == last){
+        apu->frame_start += frame_table[apu->pal][last] + 1;
+        apu->frame_step = 0;
+    }else{
+        apu->frame_step++;
+    }
+    update_timers(apu);
+}
+
+// Mixer, sends the changes of the output to the blip buffer
+
+static void update_output(apu_2A03 *apu){
+    uint8_t triangle = triangle_table[apu->triangle.sequence];
+    int32_t amplitude = pulse_mix[pulse_output(&(apu->pulse[0]), 0) + pulse_output(&(apu->pulse[1]), 1)]
+                      + tnd_mix[3 * triangle + 2 * noise_output(&(apu->noise)) + apu->dmc.level];
+    if(amplitude != apu->amplitude){
+        blip_add_delta(&(apu->blip), (uint32_t)(apu->cycle - apu->audio_start), amplitude - apu->amplitude);
+        apu->amplitude = amplitude;
+    }
+}
+
+// Runs every timer and frame counter step before cycle "until", in order.
+static void apu_run(nes_system *nes, uint64_t until){
+    apu_2A03 *apu = &(nes->apu);
+    for(;;){
+        uint64_t next = frame_next(apu);
+        if(apu->pulse[0].next < next) next = apu->pulse[0].next;
+        if(apu->pulse[1].next < next) next = apu->pulse[1].next;
+        if(apu->triangle.next < next) next = apu->triangle.next;
+        if(apu->noise.next < next) next = apu->noise.next;
+        if(apu->dmc.next < next) next = apu->dmc.next;
+        if(next >= until) break;
+        apu->cycle = next;
+
+        for(int i = 0; i < 2; i++){
+            apu_pulse *pulse = &(apu->pulse[i]);
+            if(pulse->next == next){
+                pulse->sequence = (pulse->sequence + 1) & 0x07;
+                pulse->next += (pulse->period + 1) * 2;
+            }
+        }
+        if(apu->triangle.next == next){
+            apu->triangle.sequence = (apu->triangle.sequence + 1) & 0x1F;
+            apu->triangle.next += apu->triangle.period + 1;
+        }
+        if(apu->noise.next == next){
+            apu_noise *noise = &(apu->noise);
+            uint16_t feedback = (noise->shift ^ (noise->shift >> (noise->mode ? 6 : 1))) & 0x01;
+            noise->shift = (noise->shift >> 1) | (feedback << 14);
+            noise->next += noise->period;
+        }
+        if(apu->dmc.next == next){
+            dmc_step(&(apu->dmc));
+            if(apu->dmc.silence && !apu->dmc.buffer_full && !apu->dmc.remaining) apu->dmc.next = APU_IDLE;
+        }
+        if(frame_next(apu) == next){
+            frame_step(nes);
+        }
+        update_output(apu);
+    }
+    if(until > apu->cycle) apu->cycle = until;
+}
+
+void apu_catch_up(nes_system *nes){
+    apu_run(nes, nes->cpu.clock_count);
+}
+
+void apu_schedule(nes_system *nes){
+    apu_2A03 *apu = &(nes->apu);
+    if(apu->five_step || apu->irq_inhibit){
+        scheduler_cancel(&(nes->events), EVENT_APU_FRAME_IRQ);
+        return;
+    }
+
+    // Fires once the CPU is past the cycle of the fourth step
+    uint64_t cycle = apu->frame_start + frame_table[apu->pal][3] + 1;
+    uint64_t time = nes->master_clock + (cycle - nes->cpu.clock_count) * nes->timing->cpu_divider;
+    scheduler_schedule(&(nes->events), EVENT_APU_FRAME_IRQ, time);
+}
+
+// (Re)schedules EVENT_DMC_DMA at the cycle the sample buffer empties, when there is something to fetch.
+static void dmc_schedule(nes_system *nes){
+    apu_dmc *dmc = &(nes->apu.dmc);
+    if(dmc->remaining == 0){
+        scheduler_cancel(&(nes->events), EVENT_DMC_DMA);
+        return;
+    }
+
+    // An empty buffer is refilled right away, a full one once the output unit takes its byte, at the
+    // step that finishes the current one
+    dmc->dma_cycle = dmc->buffer_full ? dmc->next + (uint64_t)(dmc->bits - 1) * dmc->period : nes->apu.cycle;
+    uint64_t time = nes->master_clock + (dmc->dma_cycle - nes->cpu.clock_count) * nes->timing->cpu_divider;
+    scheduler_schedule(&(nes->events), EVENT_DMC_DMA, time);
+}
+
+void apu_dmc_dma(nes_system *nes){
+    apu_2A03 *apu = &(nes->apu);
+    apu_dmc *dmc = &(apu->dmc);
+
+    // Runs the output unit up to the fetch only: if the event fired late, the byte must still be in
+    // the buffer by the next byte boundary
+    if(apu->cycle <= dmc->dma_cycle) apu_run(nes, dmc->dma_cycle + 1);
+    if(dmc->buffer_full || dmc->remaining == 0){
+        dmc_schedule(nes);
+        return;
+    }
+
+    dmc->buffer = mapper_prg_read(&(nes->inserted_cart), dmc->address);
+    dmc->buffer_full = 1;
+    dmc->address = dmc->address == 0xFFFF ? 0x8000 : dmc->address + 1;
+    if(--dmc->remaining == 0){
+        if(dmc->loop){
+            dmc->address = dmc->sample_address;
+            dmc->remaining = dmc->sample_length;
+        }else if(dmc->irq_enabled){
+            apu->dmc_irq = 1;
+            nes->irq_lines |= IRQ_DMC;
+        }
+    }
+
+    // The CPU is halted for 4 cycles, only 2 when the fetch lands in an OAM DMA, which was halting it
+    // already
+    int in_oam_dma = dmc->dma_cycle >= nes->oam_dma_start && dmc->dma_cycle < nes->oam_dma_end;
+    nes->cpu.stall += in_oam_dma ? 2 : 4;
+
+    update_timers(apu);
+    dmc_schedule(nes);
+}
+
+void apu_end_frame(nes_system *nes){
+    apu_2A03 *apu = &(nes->apu);
+    apu_catch_up(nes);
+    blip_end_frame(&(apu->blip), (uint32_t)(apu->cycle - apu->audio_start));
+    apu->audio_start = apu->cycle;
+}
+
+uint8_t apu_read_status(nes_system *nes){
+    apu_2A03 *apu = &(nes->apu);
+    apu_catch_up(nes);
+    uint8_t data = (apu->pulse[0].length ? 0x01 : 0)
+                 | (apu->pulse[1].length ? 0x02 : 0)
+                 | (apu->triangle.length ? 0x04 : 0)
+                 | (apu->noise.length ? 0x08 : 0)
+                 | (apu->dmc.remaining ? 0x10 : 0)
+                 | (apu->frame_irq ? 0x40 : 0)
+                 | (apu->dmc_irq ? 0x80 : 0);
+
+    // Reading acknowledges the frame IRQ
+    apu->frame_irq = 0;
+    nes->irq_lines &= ~IRQ_APU_FRAME;
+    return data;
+}
+
+static void pulse_write(apu_2A03 *apu, int channel, uint8_t reg, uint8_t data){
+    apu_pulse *pulse = &(apu->pulse[channel]);
+    switch(reg){
+    case 0:     // DDLC VVVV
+        pulse->duty = data >> 6;
+        pulse->envelope.loop = (data >> 5) & 0x01;
+        pulse->envelope.constant = (data >> 4) & 0x01;
+        pulse->envelope.volume = data & 0x0F;
+        break;
+    case 1:     // EPPP NSSS
+        pulse->sweep_enabled = data >> 7;
+        pulse->sweep_period = (data >> 4) & 0x07;
+        pulse->sweep_negate = (data >> 3) & 0x01;
+        pulse->sweep_shift = data & 0x07;
+        pulse->sweep_reload = 1;
+        break;
+    case 2:     // Period low
+        pulse->period = (pulse->period & 0x0700) | data;
+        break;
+    case 3:     // LLLL LHHH, restarts the duty cycle and the envelope
+        pulse->period = (pulse->period & 0x00FF) | ((uint16_t)(data & 0x07) << 8);
+        if(apu->enabled & (1 << channel)) pulse->length = length_table[data >> 3];
+        pulse->sequence = 0;
+        pulse->envelope.start = 1;
+        break;
+    }
+}
+
+void apu_write(nes_system *nes, uint16_t addr, uint8_t data){
+    apu_2A03 *apu = &(nes->apu);
+    apu_catch_up(nes);
+
+    switch(addr){
+    case 0x4000: case 0x4001: case 0x4002: case 0x4003:
+        pulse_write(apu, 0, addr & 0x03, data);
+        break;
+    case 0x4004: case 0x4005: case 0x4006: case 0x4007:
+        pulse_write(apu, 1, addr & 0x03, data);
+        break;
+    case 0x4008:    // CRRR RRRR
+        apu->triangle.control = data >> 7;
+        apu->triangle.linear_period = data & 0x7F;
+        break;
+    case 0x400A:
+        apu->triangle.period = (apu->triangle.period & 0x0700) | data;
+        break;
+    case 0x400B:    // LLLL LHHH
+        apu->triangle.period = (apu->triangle.period & 0x00FF) | ((uint16_t)(data & 0x07) << 8);
+        if(apu->enabled & 0x04) apu->triangle.length = length_table[data >> 3];
+        apu->triangle.linear_reload = 1;
+        break;
+    case 0x400C:    // --LC VVVV
+        apu->noise.envelope.loop = (data >> 5) & 0x01;
+        apu->noise.envelope.constant = (data >> 4) & 0x01;
+        apu->noise.envelope.volume = data & 0x0F;
+        break;
+    case 0x400E:    // M--- PPPP
+        apu->noise.mode = data >> 7;
+        apu->noise.period = noise_table[apu->pal][data & 0x0F];
+        break;
+    case 0x400F:    // LLLL L---
+        if(apu->enabled & 0x08) apu->noise.length = length_table[data >> 3];
+        apu->noise.envelope.start = 1;
+        break;
+    case 0x4010:    // IL-- RRRR
+        apu->dmc.irq_enabled = data >> 7;
+        apu->dmc.loop = (data >> 6) & 0x01;
+        apu->dmc.period = dmc_table[apu->pal][data & 0x0F];
+        if(!apu->dmc.irq_enabled){
+            apu->dmc_irq = 0;
+            nes->irq_lines &= ~IRQ_DMC;
+        }
+        break;
+    case 0x4011:    // -DDD DDDD
+        apu->dmc.level = data & 0x7F;
+        break;
+    case 0x4012:    // Sample at $C000 + 64 * A
+        apu->dmc.sample_address = 0xC000 | ((uint16_t)data << 6);
+        break;
+    case 0x4013:    // 16 * L + 1 bytes
+        apu->dmc.sample_length = ((uint16_t)data << 4) + 1;
+        break;
+    case 0x4015:    // ---D NT21
+        apu->enabled = data & 0x1F;
+        if(!(data & 0x01)) apu->pulse[0].length = 0;
+        if(!(data & 0x02)) apu->pulse[1].length = 0;
+        if(!(data & 0x04)) apu->triangle.length = 0;
+        if(!(data & 0x08)) apu->noise.length = 0;
+        if(!(data & 0x10)){
+            apu->dmc.remaining = 0;
+        }else if(apu->dmc.remaining == 0){
+            apu->dmc.address = apu->dmc.sample_address;
+            apu->dmc.remaining = apu->dmc.sample_length;
+        }
+        apu->dmc_irq = 0;
+        nes->irq_lines &= ~IRQ_DMC;
+        break;
+    case 0x4017:    // MI-- ----, restarts the sequence
+        apu->five_step = data >> 7;
+        apu->irq_inhibit = (data >> 6) & 0x01;
+        if(apu->irq_inhibit){
+            apu->frame_irq = 0;
+            nes->irq_lines &= ~IRQ_APU_FRAME;
+        }
+        apu->frame_start = apu->cycle;
+        apu->frame_step = 0;
+        if(apu->five_step){
+            quarter_frame(apu);
+            half_frame(apu);
+        }
+        apu_schedule(nes);
+        break;
+    }
+
+    update_timers(apu);
+    dmc_schedule(nes);
+    update_output(apu);
+}
@@ -0,0 +1,130 @@
+#ifndef _APU_H_
+#define _APU_H_
+#include <stdint.h>
+#include "blip_buffer.h"
+
+// The APU is not clocked with the CPU. It only runs, in one batch, when one of its registers is
+// accessed, when its frame IRQ is due and at the end of each video frame. Channels whose timers don't
+// affect the output (length counter at zero, ...) are parked and cost nothing, the others only do work
+// when their timer expires, and output changes go to a blip_buffer as band-limited steps.
+//
+// Every time is in CPU cycles ("cpu.clock_count").
+
+#define APU_SAMPLE_RATE 48000
+#define APU_IDLE UINT64_MAX         // "next" of a parked channel
+
+typedef struct apu_envelope{
+    uint8_t start;              // Restart on the next quarter frame
+    uint8_t loop;               // Also halts the length counter
+    uint8_t constant;           // Output "volume" instead of the decay level
+    uint8_t volume;             // Constant volume, or the divider period
+    uint8_t divider;
+    uint8_t decay;              // 15 down to 0
+} apu_envelope;
+
+typedef struct apu_pulse{
+    apu_envelope envelope;
+    uint8_t duty;
+    uint8_t sequence;           // Step of the 8 step duty cycle
+    uint16_t period;            // Timer reload, 11 bits
+    uint8_t length;
+    uint8_t sweep_enabled;
+    uint8_t sweep_period;
+    uint8_t sweep_negate;
+    uint8_t sweep_shift;
+    uint8_t sweep_reload;
+    uint8_t sweep_divider;
+    uint64_t next;              // Cycle of the next sequencer step, APU_IDLE while parked
+} apu_pulse;
+
+typedef struct apu_triangle{
+    uint8_t control;            // Halts the length counter and keeps reloading the linear counter
+    uint8_t linear_period;
+    uint8_t linear_counter;
+    uint8_t linear_reload;
+    uint8_t sequence;           // Step of the 32 step triangle
+    uint16_t period;
+    uint8_t length;
+    uint64_t next;
+} apu_triangle;
+
+typedef struct apu_noise{
+    apu_envelope envelope;
+    uint8_t mode;               // Short (93 step) sequence
+    uint16_t period;            // In CPU cycles, from the period table
+    uint16_t shift;             // 15 bit LFSR
+    uint8_t length;
+    uint64_t next;
+} apu_noise;
+
+typedef struct apu_dmc{
+    uint8_t irq_enabled;
+    uint8_t loop;
+    uint16_t period;            // In CPU cycles, from the rate table
+    uint8_t level;              // 7 bit output
+    uint16_t sample_address;    // $4012
+    uint16_t sample_length;     // $4013
+    uint16_t address;           // Next byte to fetch
+    uint16_t remaining;         // Bytes left to fetch
+    uint8_t buffer;
+    uint8_t buffer_full;
+    uint8_t shift;              // Output shift register
+    uint8_t bits;               // Bits left in "shift"
+    uint8_t silence;
+    uint64_t next;
+    uint64_t dma_cycle;         // Cycle of the pending sample fetch (EVENT_DMC_DMA)
+} apu_dmc;
+
+typedef struct apu_2A03{
+    apu_pulse pulse[2];
+    apu_triangle triangle;
+    apu_noise noise;
+    apu_dmc dmc;
+    uint8_t enabled;            // $4015 channel enables
+
+    // Frame counter
+    uint8_t five_step;
+    uint8_t irq_inhibit;
+    uint8_t frame_irq;
+    uint8_t dmc_irq;
+    uint8_t frame_step;         // Next step of the sequence
+    uint64_t frame_start;       // Cycle at which the current sequence started
+    uint8_t pal;
+
+    uint64_t cycle;             // The APU has run up to here
+    uint64_t audio_start;       // Cycle of the start of the current audio frame
+    int32_t amplitude;          // Mixer output last sent to "blip"
+    double sample_rate;         // Of "blip"
+    blip_buffer blip;
+} apu_2A03;
+
+#include "bus.h"
+
+void apu_init(nes_system *nes);
+
+// Follows a change of "nes->timing" (NTSC/PAL frame counter, tables and clock rate).
+void apu_set_timing(nes_system *nes);
+
+// Changes the rate of the samples coming out of "apu.blip", effective from the current audio frame.
+void apu_set_sample_rate(nes_system *nes, double sample_rate);
+
+// Runs the APU up to the current CPU cycle.
+void apu_catch_up(nes_system *nes);
+
+// (Re)schedules EVENT_APU_FRAME_IRQ.
+void apu_schedule(nes_system *nes);
+
+// EVENT_DMC_DMA: fetches the next sample byte into the DMC buffer, halting the CPU for the cycles
+// the fetch takes, and schedules the next one.
+void apu_dmc_dma(nes_system *nes);
+
+// Catches up and closes the audio frame, its samples can then be read from "apu.blip".
+void apu_end_frame(nes_system *nes);
+
+// $4015
+uint8_t apu_read_status(nes_system *nes);
+
+// $4000-$4013, $4015 and $4017
+void apu_write(nes_system *nes, uint16_t addr, uint8_t data);
+
+#endif
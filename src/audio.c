@@ -0,0 +1,99 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "audio.h"
+
+// Runs on SDL's audio thread, the only consumer of the ring.
+static void audio_callback(void *userdata, Uint8 *stream, int len){
+    audio_output *audio = userdata;
+    int16_t *out = (int16_t *)stream;
+    uint32_t count = len / sizeof(int16_t);
+
+    // Silence until the ring fills up once, so the start doesn't count as underruns
+    if(!audio->started){
+        if(audio_ring_fill(&(audio->ring)) < audio->target_fill){
+            memset(stream, 0, len);
+            return;
+        }
+        audio->started = 1;
+    }
+
+    uint32_t got = audio_ring_read(&(audio->ring), out, count);
+    if(got) audio->last = out[got - 1];
+    for(uint32_t i = got; i < count; i++) out[i] = audio->last;
+}
+
+int audio_init(audio_output *audio, int sample_rate, int latency_ms){
+    audio_ring_init(&(audio->ring));
+    audio->device = 0;
+    audio->last = 0;
+    audio->started = 0;
+    audio->ratio = audio->ratio_min = audio->ratio_max = 1;
+    audio->drift = 0;
+
+    // The callback asks for about a quarter of the latency at a time
+    SDL_AudioSpec want, have;
+    memset(&want, 0, sizeof(want));
+    want.freq = sample_rate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = 64;
+    while(want.samples * 4000 < sample_rate * latency_ms) want.samples <<= 1;
+    want.callback = audio_callback;
+    want.userdata = audio;
+
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if(audio->device == 0){
+        SDL_Log("Can't open audio: %s", SDL_GetError());
+        return -1;
+    }
+    audio->sample_rate = have.freq;
+    audio->target_fill = (uint32_t)((int64_t)have.freq * latency_ms / 1000);
+    if(audio->target_fill > AUDIO_RING_SIZE / 2) audio->target_fill = AUDIO_RING_SIZE / 2;
+    audio->fill_average = audio->target_fill;
+
+    SDL_PauseAudioDevice(audio->device, 0);
+    return 0;
+}
+
+void audio_destroy(audio_output *audio){
+    if(audio->device) SDL_CloseAudioDevice(audio->device);
+    audio->device = 0;
+}
+
+double audio_push(audio_output *audio, const int16_t *samples, uint32_t count){
+    if(audio->device == 0) return audio->sample_rate;
+
+    // The ring swings by a whole frame between pushes, its level half way through the frame is what
+    // the target is compared to
+    double fill = audio_ring_fill(&(audio->ring)) + count / 2.0;
+    audio_ring_write(&(audio->ring), samples, count);
+
+    // Proportional to how far the (smoothed) fill level is from the target, plus the integral of that
+    // distance, which settles on the actual drift between the two clocks
+    audio->fill_average += AUDIO_FILL_SMOOTHING * (fill - audio->fill_average);
+    double error = (audio->target_fill - audio->fill_average) / audio->target_fill;
+    if(error > 1) error = 1;
+    if(error < -1) error = -1;
+    audio->drift += AUDIO_DRIFT_GAIN * AUDIO_MAX_DEVIATION * error;
+    if(audio->drift > AUDIO_MAX_DEVIATION) audio->drift = AUDIO_MAX_DEVIATION;
+    if(audio->drift < -AUDIO_MAX_DEVIATION) audio->drift = -AUDIO_MAX_DEVIATION;
+
+    // Both terms together stay within the largest correction, so the pitch never moves by more
+    double correction = AUDIO_MAX_DEVIATION * error + audio->drift;
+    if(correction > AUDIO_MAX_DEVIATION) correction = AUDIO_MAX_DEVIATION;
+    if(correction < -AUDIO_MAX_DEVIATION) correction = -AUDIO_MAX_DEVIATION;
+    audio->ratio = 1 + correction;
+    if(audio->ratio < audio->ratio_min) audio->ratio_min = audio->ratio;
+    if(audio->ratio > audio->ratio_max) audio->ratio_max = audio->ratio;
+    return audio->sample_rate * audio->ratio;
+}
+
+void audio_print_stats(audio_output *audio){
+    if(audio->device == 0) return;
+    printf("%-24s %d Hz, target %u samples\n", "audio", audio->sample_rate, audio->target_fill);
+    printf("%-24s %llu samples\n", "audio underruns", (unsigned long long)atomic_load(&(audio->ring.underruns)));
+    printf("%-24s %llu samples\n", "audio overruns", (unsigned long long)atomic_load(&(audio->ring.overruns)));
+    printf("%-24s %+.3f%% to %+.3f%%\n", "audio rate correction", (audio->ratio_min - 1) * 100, (audio->ratio_max - 1) * 100);
+}
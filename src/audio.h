@@ -0,0 +1,47 @@
+#ifndef _AUDIO_H_
+#define _AUDIO_H_
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "audio_ring.h"
+
+// Sound output through an SDL audio callback fed by an audio_ring.
+//
+// The emulation is paced by the frame pacer, not by the sound card, so the two clocks drift apart.
+// Instead of letting the ring run dry or overflow, every push returns the sample rate the emulator
+// should generate at next: the device rate nudged by a fraction of a percent, up when the ring is
+// below its target fill and down when above. The pitch change is far below what can be heard, and
+// the ring can stay small (a few tens of milliseconds) without crackles.
+
+#define AUDIO_MAX_DEVIATION 0.005   // Largest rate correction, as a fraction of the device rate
+#define AUDIO_FILL_SMOOTHING 0.1    // Weight of the newest fill level in the average
+#define AUDIO_DRIFT_GAIN 0.01       // How fast the drift estimate follows the fill error
+
+typedef struct audio_output{
+    SDL_AudioDeviceID device;       // 0 when there is no sound device
+    audio_ring ring;
+    int sample_rate;                // Of the device
+    uint32_t target_fill;           // Samples the ring should hold, the latency
+    int16_t last;                   // Consumer: last sample played, held through underruns
+    uint8_t started;                // Consumer: the ring reached its target once
+
+    // Producer: rate control
+    double fill_average;
+    double drift;                   // Estimated rate difference between the device and the emulation
+    double ratio;                   // Of the rate returned by the last push to the device rate
+    double ratio_min;
+    double ratio_max;
+} audio_output;
+
+// Opens the default device for mono 16 bit samples at "sample_rate", keeping about "latency_ms" of
+// sound queued. Returns 0 on success; on failure "device" is left 0 and pushes do nothing.
+int audio_init(audio_output *audio, int sample_rate, int latency_ms);
+
+void audio_destroy(audio_output *audio);
+
+// Queues the samples of a frame. Returns the sample rate to generate the next frame at.
+double audio_push(audio_output *audio, const int16_t *samples, uint32_t count);
+
+// Prints the underruns, overruns and the range of the rate corrections.
+void audio_print_stats(audio_output *audio);
+
+#endif
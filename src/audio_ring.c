@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "audio_ring.h"
+
+void audio_ring_init(audio_ring *ring){
+    memset(ring->samples, 0, sizeof(ring->samples));
+    atomic_store(&(ring->head), 0);
+    atomic_store(&(ring->tail), 0);
+    atomic_store(&(ring->overruns), 0);
+    atomic_store(&(ring->underruns), 0);
+}
+
+uint32_t audio_ring_write(audio_ring *ring, const int16_t *samples, uint32_t count){
+    uint32_t head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&(ring->tail), memory_order_acquire);
+    uint32_t space = AUDIO_RING_SIZE - (head - tail);
+    if(count > space){
+        atomic_fetch_add_explicit(&(ring->overruns), count - space, memory_order_relaxed);
+        count = space;
+    }
+
+    // Up to the end of the array, then from its start
+    uint32_t start = head & (AUDIO_RING_SIZE - 1);
+    uint32_t first = count < AUDIO_RING_SIZE - start ? count : AUDIO_RING_SIZE - start;
+    memcpy(ring->samples + start, samples, first * sizeof(int16_t));
+    memcpy(ring->samples, samples + first, (count - first) * sizeof(int16_t));
+
+    // Release: the samples must be visible before the consumer sees the new head
+    atomic_store_explicit(&(ring->head), head + count, memory_order_release);
+    return count;
+}
+
+uint32_t audio_ring_read(audio_ring *ring, int16_t *samples, uint32_t count){
+    uint32_t tail = atomic_load_explicit(&(ring->tail), memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&(ring->head), memory_order_acquire);
+    uint32_t available = head - tail;
+    if(count > available){
+        atomic_fetch_add_explicit(&(ring->underruns), count - available, memory_order_relaxed);
+        count = available;
+    }
+
+    uint32_t start = tail & (AUDIO_RING_SIZE - 1);
+    uint32_t first = count < AUDIO_RING_SIZE - start ? count : AUDIO_RING_SIZE - start;
+    memcpy(samples, ring->samples + start, first * sizeof(int16_t));
+    memcpy(samples + first, ring->samples, (count - first) * sizeof(int16_t));
+
+    // Release: the slots may only be reused once they have been copied out
+    atomic_store_explicit(&(ring->tail), tail + count, memory_order_release);
+    return count;
+}
@@ -0,0 +1,35 @@
+#ifndef _AUDIO_RING_H_
+#define _AUDIO_RING_H_
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Lock-free ring of samples between the emulation thread (single producer) and the audio callback
+// (single consumer). "head" and "tail" only ever grow, their difference is the fill level, and each
+// side only writes its own index, so neither ever waits for the other. They live on separate cache
+// lines to keep the two threads from bouncing one line between cores.
+
+#define AUDIO_RING_SIZE 8192        // Samples, a power of two
+
+typedef struct audio_ring{
+    int16_t samples[AUDIO_RING_SIZE];
+    _Alignas(64) _Atomic uint32_t head;     // Next sample written, only stored by the producer
+    _Alignas(64) _Atomic uint32_t tail;     // Next sample read, only stored by the consumer
+    _Atomic uint64_t overruns;              // Samples dropped because the ring was full
+    _Atomic uint64_t underruns;             // Samples the consumer asked for and didn't get
+} audio_ring;
+
+void audio_ring_init(audio_ring *ring);
+
+// Producer: queues up to "count" samples, returns how many fit.
+uint32_t audio_ring_write(audio_ring *ring, const int16_t *samples, uint32_t count);
+
+// Consumer: takes up to "count" samples, returns how many there were.
+uint32_t audio_ring_read(audio_ring *ring, int16_t *samples, uint32_t count);
+
+// Samples queued, from either side.
+static inline uint32_t audio_ring_fill(audio_ring *ring){
+    uint32_t tail = atomic_load_explicit(&(ring->tail), memory_order_acquire);
+    return atomic_load_explicit(&(ring->head), memory_order_acquire) - tail;
+}
+
+#endif
@@ -0,0 +1,99 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "blip_buffer.h"
+
+#define KERNEL_BITS 14                      // Each phase of the kernel sums to 1 << KERNEL_BITS
+#define BASS_SHIFT 9                        // DC removal, about 15 Hz at 48 kHz
+#define CUTOFF 0.45                         // Of the output sample rate
+
+// Band-limited impulses, one per sub-sample phase. Built once, by whichever instance comes first.
+static int16_t kernel[BLIP_PHASES][BLIP_KERNEL];
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void init_kernel(void){
+    for(int p = 0; p < BLIP_PHASES; p++){
+        double center = BLIP_KERNEL / 2 - 1 + (double)p / BLIP_PHASES;
+        double h[BLIP_KERNEL];
+        double sum = 0;
+        for(int k = 0; k < BLIP_KERNEL; k++){
+            // Windowed sinc, Blackman window over the width of the kernel
+            double x = k - center;
+            double t = M_PI * 2 * CUTOFF * x;
+            double sinc = x == 0 ? 1 : sin(t) / t;
+            double w = 2 * M_PI * x / BLIP_KERNEL;
+            h[k] = sinc * (0.42 + 0.5 * cos(w) + 0.08 * cos(2 * w));
+            sum += h[k];
+        }
+
+        // Rounded so that every phase adds exactly the whole step
+        int total = 0, largest = 0;
+        for(int k = 0; k < BLIP_KERNEL; k++){
+            kernel[p][k] = (int16_t)lround(h[k] / sum * (1 << KERNEL_BITS));
+            total += kernel[p][k];
+            if(kernel[p][k] > kernel[p][largest]) largest = k;
+        }
+        kernel[p][largest] += (1 << KERNEL_BITS) - total;
+    }
+}
+
+void blip_init(blip_buffer *blip, double clock_rate, double sample_rate){
+    pthread_once(&kernel_once, init_kernel);
+    memset(blip, 0, sizeof(blip_buffer));
+    blip_set_rates(blip, clock_rate, sample_rate);
+}
+
+void blip_set_rates(blip_buffer *blip, double clock_rate, double sample_rate){
+    blip->factor = (uint64_t)(sample_rate / clock_rate * 4294967296.0);
+}
+
+void blip_add_delta(blip_buffer *blip, uint32_t time, int32_t delta){
+    uint64_t position = blip->offset + time * blip->factor;
+    uint32_t index = (uint32_t)(position >> 32);
+    if(index >= BLIP_CAPACITY) return;              // Frame longer than the buffer
+
+    const int16_t *k = kernel[(position >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+    int32_t *out = blip->buffer + index;
+    for(int i = 0; i < BLIP_KERNEL; i++){
+        out[i] += delta * k[i];
+    }
+}
+
+// Integrates "count" samples, storing them in "out" unless it is NULL, and shifts them out of the buffer.
+static void remove_samples(blip_buffer *blip, int16_t *out, uint32_t count){
+    int32_t sum = blip->integrator;
+    for(uint32_t i = 0; i < count; i++){
+        sum += blip->buffer[i];
+        int32_t s = sum >> KERNEL_BITS;
+        sum -= sum >> BASS_SHIFT;
+        if(out) out[i] = s > INT16_MAX ? INT16_MAX : (s < INT16_MIN ? INT16_MIN : s);
+    }
+    blip->integrator = sum;
+
+    // Moves the samples not read yet and the tails of the kernels that went past them
+    uint32_t remaining = blip_samples_available(blip) - count + BLIP_KERNEL;
+    memmove(blip->buffer, blip->buffer + count, remaining * sizeof(int32_t));
+    memset(blip->buffer + remaining, 0, count * sizeof(int32_t));
+    blip->offset -= (uint64_t)count << 32;
+}
+
+void blip_end_frame(blip_buffer *blip, uint32_t time){
+    blip->offset += time * blip->factor;
+    if(blip_samples_available(blip) > BLIP_CAPACITY){           // Deltas past the end were dropped anyway
+        blip->offset = (uint64_t)BLIP_CAPACITY << 32;
+    }
+
+    // Keeps half of the buffer for the next frame when nobody reads the samples
+    uint32_t available = blip_samples_available(blip);
+    if(available > BLIP_CAPACITY / 2){
+        remove_samples(blip, NULL, available - BLIP_CAPACITY / 2);
+    }
+}
+
+uint32_t blip_read_samples(blip_buffer *blip, int16_t *out, uint32_t count){
+    uint32_t available = blip_samples_available(blip);
+    if(count > available) count = available;
+    if(count) remove_samples(blip, out, count);
+    return count;
+}
@@ -0,0 +1,48 @@
+#ifndef _BLIP_BUFFER_H_
+#define _BLIP_BUFFER_H_
+#include <stdint.h>
+
+// Band-limited synthesis from amplitude changes.
+//
+// Sound chips like the APU produce square waves whose edges fall anywhere in a 1.79 MHz clock. Instead
+// of generating every clock and filtering it down, each change of the output is added to the buffer
+// as a band-limited step (a windowed sinc impulse, integrated when the samples are read) placed at the
+// exact output sample position of the change. The work is proportional to the number of edges, not to
+// the number of clocks.
+//
+// Times are in clocks since the start of the current frame. A frame is closed with blip_end_frame(),
+// which makes its samples available to blip_read_samples().
+
+#define BLIP_PHASE_BITS 5                   // Sub-sample positions of a step
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_KERNEL 16                      // Samples touched by each step
+#define BLIP_CAPACITY 8192                  // Samples held, plus room for the kernel
+
+typedef struct blip_buffer{
+    uint64_t factor;                        // Output samples per clock, 32.32 fixed point
+    uint64_t offset;                        // Position of the frame start in the buffer, 32.32 fixed point
+    int32_t integrator;                     // Running sum of the impulses read so far
+    int32_t buffer[BLIP_CAPACITY + BLIP_KERNEL];
+} blip_buffer;
+
+// Empties the buffer and sets the rates, "clock_rate" clocks per second in, "sample_rate" samples out.
+void blip_init(blip_buffer *blip, double clock_rate, double sample_rate);
+
+// Changes the rates keeping the samples already buffered.
+void blip_set_rates(blip_buffer *blip, double clock_rate, double sample_rate);
+
+// Adds a change of "delta" to the output at clock "time" of the current frame.
+void blip_add_delta(blip_buffer *blip, uint32_t time, int32_t delta);
+
+// Closes the current frame, "time" clocks long. Once the buffer is full, the oldest samples are dropped.
+void blip_end_frame(blip_buffer *blip, uint32_t time);
+
+// Samples ready to be read.
+static inline uint32_t blip_samples_available(const blip_buffer *blip){
+    return (uint32_t)(blip->offset >> 32);
+}
+
+// Reads up to "count" samples into "out", returns how many were read.
+uint32_t blip_read_samples(blip_buffer *blip, int16_t *out, uint32_t count);
+
+#endif
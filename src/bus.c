@@ -1,45 +1,183 @@
 #include "bus.h"
+#include "mappers.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+
+const nes_timing timing_ntsc = { 12, 4, 260, 60.0988 };
+const nes_timing timing_pal  = { 16, 5, 310, 50.007 };
 
 void system_init(nes_system *nes){
+    // Dendy is closest to PAL, multi-region games run as NTSC
+    enum TIMING timing = nes->inserted_cart.timing;
+    nes->timing = (timing == TIMING_PAL || timing == TIMING_DENDY) ? &timing_pal : &timing_ntsc;
+    nes->master_clock = 0;
+    nes->irq_lines = 0;
+    nes->oam_dma_start = nes->oam_dma_end = 0;
+    scheduler_init(&(nes->events));
     cpu_init(nes);
     ppu_init(&(nes->ppu));
+    ppu_update_mirroring(nes);
+    apu_init(nes);
+    controller_init(nes);
     nes->system_clock_counter = 0;
+#ifdef NES_PERF_COUNTERS
+    perf_reset(&(nes->perf));
+#endif
+    ppu_schedule(nes);
 } // lembrar de inicializar o system clock counter com 0
 
-void system_clock(nes_system *nes){
+void system_set_timing(nes_system *nes, const nes_timing *timing){
+    nes->timing = timing;
+    scheduler_cancel(&(nes->events), EVENT_VBLANK);
+    scheduler_cancel(&(nes->events), EVENT_FRAME_END);
+    ppu_schedule(nes);
+    apu_set_timing(nes);
+}
 
-    if(nes->ppu.scanline == -1){
-        nes->ppu.status.vertical_blank = 0;
-    }
+void system_clock(nes_system *nes){
 
     ppu_clock(nes);
-    if(nes->system_clock_counter % 3 == 0){
+    nes->ppu.clock_time += nes->timing->ppu_divider;
+
+    // The CPU cycle starting at "master_clock" is due once the PPU has gone past it
+    if(nes->master_clock < nes->ppu.clock_time){
         cpu_clock(nes);
-    }
+        nes->master_clock += nes->timing->cpu_divider;
 
-    if(nes->ppu.nmi_flag){
-        nes->ppu.nmi_flag = 0;
-        cpu_nmi(nes);
+        // Interrupts are only taken between instructions
+        if(nes->cpu.cycles == 0 && nes->master_clock >= scheduler_next_time(&(nes->events))){
+            system_dispatch_events(nes);
+        }
     }
-    
 
     nes->system_clock_counter++;
 }
 
+void system_run_frame(nes_system *nes){
+    while(!nes->ppu.frame_complete){
+        // Register writes can schedule events (NMI, mapper IRQ), so the next one is looked up every instruction
+        while(nes->master_clock < scheduler_next_time(&(nes->events))){
+            nes->master_clock += cpu_step(nes) * nes->timing->cpu_divider;
+        }
+        system_dispatch_events(nes);
+    }
+    nes->ppu.frame_complete = 0;
+}
+
+void system_dispatch_events(nes_system *nes){
+    int event;
+    while((event = scheduler_pop_due(&(nes->events), nes->master_clock)) >= 0){
+        ppu_catch_up(nes);
+
+        switch(event){
+        case EVENT_VBLANK:
+        case EVENT_NMI:
+            if(nes->ppu.nmi_flag){
+                nes->ppu.nmi_flag = 0;
+                cpu_nmi(nes);
+            }
+            break;
+        case EVENT_FRAME_END:
+            apu_end_frame(nes);
+            break;
+        case EVENT_MAPPER_IRQ:
+            mapper_sync(nes);
+            break;
+        case EVENT_APU_FRAME_IRQ:
+            apu_catch_up(nes);
+            apu_schedule(nes);
+            break;
+        case EVENT_DMC_DMA:
+            apu_dmc_dma(nes);
+            break;
+        }
+
+        ppu_schedule(nes);
+    }
+}
+
 void system_reset();
 
+// Returns a pointer to the 256 bytes of CPU page "page" when they are plain memory, NULL otherwise
+// (registers, or anything with side effects on read).
+static const uint8_t *cpu_page_pointer(nes_system *nes, uint8_t page){
+    if(page < 0x20){                                // Ram, mirrored every 8 pages
+        return nes->ram + ((page & 0x07) << 8);
+    }else if(page >= 0x60 && page < 0x80){          // Cartridge RAM, if it holds whole pages
+        size_t size = nes->inserted_cart.prg_ram_size;
+        if(size == 0 || (size & 0xFF)) return NULL;
+        return nes->inserted_cart.prg_ram + (((page & 0x1F) << 8) % size);
+    }else if(page >= 0x80){                         // Cartridge ROM, a page never straddles a bank
+        return nes->inserted_cart.prg_page[(page >> 5) & 0x03] + ((page & 0x1F) << 8);
+    }
+    return NULL;
+}
+
+// OAM DMA ($4014): copies CPU page "page" into OAM, starting at the current OAM address.
+// Done as a single bulk copy, the CPU is charged the 513 cycles of the transfer (514 when it
+// starts on an odd cycle) as a stall after the current instruction.
+static void oam_dma(nes_system *nes, uint8_t page){
+    uint8_t buffer[256];
+    const uint8_t *src = cpu_page_pointer(nes, page);
+    if(src == NULL){
+        for(int i = 0; i < 256; i++){
+            buffer[i] = cpu_read(nes, (page << 8) | i);
+        }
+        src = buffer;
+    }
+
+    // With 8x16 sprites OAM decides which pattern table the sprite fetches use
+    if(nes->ppu.control.sprite_size) mapper_sync(nes);
+    uint8_t offset = nes->ppu.oam_address;
+    memcpy(nes->ppu.oam.bytes + offset, src, 256 - offset);
+    memcpy(nes->ppu.oam.bytes, src + 256 - offset, offset);
+    nes->ppu.sprites_dirty = 1;
+    if(nes->ppu.control.sprite_size) mapper_sync(nes);
+
+    // The write to $4014 is the last cycle of the instruction, the DMA starts on the next one
+    uint64_t start = nes->cpu.clock_count + nes->cpu.cycles;
+    nes->cpu.stall += 513 + (start & 1);
+    nes->oam_dma_start = start;
+    nes->oam_dma_end = start + 513 + (start & 1);
+}
+
+// Byte of cartridge RAM seen at "addr" ($6000-$7FFF), mirrored when there is less than 8 KB.
+// NULL if the board has no RAM (open bus).
+static inline uint8_t *prg_ram_at(nes_system *nes, uint16_t addr){
+    size_t size = nes->inserted_cart.prg_ram_size;
+    if(size == 0) return NULL;
+    size_t offset = addr & 0x1FFF;
+    return nes->inserted_cart.prg_ram + (offset < size ? offset : offset % size);
+}
+
 // Returns data read from address "addr".
 uint8_t cpu_read(nes_system *nes, uint16_t addr){
     uint8_t data = 0x0000;
     if (addr >= 0x0000 && addr <= 0x1FFF){          // Ram 
+        PERF_COUNT_READ(nes, PERF_RAM);
         data = nes->ram[addr & 0X07FF];
     }else if (addr >= 0x2000 && addr <= 0x3FFF){    // PPU, for mirroring, mask with 0x0007
+        PERF_COUNT_READ(nes, PERF_PPU);
+        ppu_catch_up(nes);
         data = ppu_access_read(nes, addr & 0x0007);
-    }else if (addr >= 0x4020 && addr <= 0xFFFF){    // Cartridge
-        data = nes->inserted_cart.prg[nes->inserted_cart.mapper_f(addr, nes->inserted_cart.header.prg_rom_chunks, nes->inserted_cart.header.chr_rom_chunks)];
+    }else if (addr >= 0x4000 && addr <= 0x401F){    // APU and I/O
+        PERF_COUNT_READ(nes, PERF_IO);
+        if(addr == 0x4015){
+            data = apu_read_status(nes);
+        }else if(addr == 0x4016 || addr == 0x4017){
+            data = controller_read(nes, addr & 0x01);
+        }
+    }else if (addr >= 0x4020 && addr <= 0x5FFF){    // Cartridge expansion area, nothing there yet
+        PERF_COUNT_READ(nes, PERF_CARTRIDGE);
+    }else if (addr >= 0x6000 && addr <= 0x7FFF){    // Cartridge RAM
+        PERF_COUNT_READ(nes, PERF_CARTRIDGE);
+        uint8_t *ram = prg_ram_at(nes, addr);
+        if(ram) data = *ram;
+    }else if (addr >= 0x8000 && addr <= 0xFFFF){    // Cartridge ROM
+        PERF_COUNT_READ(nes, PERF_CARTRIDGE);
+        data = mapper_prg_read(&(nes->inserted_cart), addr);
     }
     
     return data;
@@ -48,11 +186,33 @@ uint8_t cpu_read(nes_system *nes, uint16_t addr){
 // Write value of "data" on address "addr".
 void cpu_write(nes_system *nes, uint_fast16_t addr, uint8_t data){
     if (addr >= 0x0000 && addr <=0x1FFF){           // Ram 
+        PERF_COUNT_WRITE(nes, PERF_RAM);
         nes->ram[addr & 0x07FF] = data;
     }else if (addr >= 0x2000 && addr <= 0x3FFF){    // PPU, for mirroring mask with 0x0007
+        PERF_COUNT_WRITE(nes, PERF_PPU);
+        ppu_catch_up(nes);
         ppu_access_write(nes, addr & 0x0007, data);
-    }else if (addr >= 0x4020 && addr <= 0xFFFF){    // Cartridge
-        nes->inserted_cart.prg[nes->inserted_cart.mapper_f(addr, nes->inserted_cart.header.prg_rom_chunks, nes->inserted_cart.header.chr_rom_chunks)] = data;
+    }else if (addr >= 0x4000 && addr <= 0x401F){    // APU and I/O
+        PERF_COUNT_WRITE(nes, PERF_IO);
+        if(addr == 0x4014){
+            oam_dma(nes, data);
+        }else if(addr == 0x4016){
+            controller_write(nes, data);
+        }else if(addr <= 0x4013 || addr == 0x4015 || addr == 0x4017){
+            apu_write(nes, addr, data);
+        }
+    }else if (addr >= 0x4020 && addr <= 0x5FFF){    // Cartridge expansion area, nothing there yet
+        PERF_COUNT_WRITE(nes, PERF_CARTRIDGE);
+    }else if (addr >= 0x6000 && addr <= 0x7FFF){    // Cartridge RAM
+        PERF_COUNT_WRITE(nes, PERF_CARTRIDGE);
+        uint8_t *ram = prg_ram_at(nes, addr);
+        if(ram) *ram = data;
+    }else if (addr >= 0x8000 && addr <= 0xFFFF){    // Cartridge ROM, writes go to the mapper registers
+        PERF_COUNT_WRITE(nes, PERF_CARTRIDGE);
+        if(nes->inserted_cart.mapper->write){
+            ppu_catch_up(nes);                      // Banks and mirroring switch at the current dot
+            nes->inserted_cart.mapper->write(nes, addr, data);
+        }
     }
     
 }
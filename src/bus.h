@@ -9,22 +9,69 @@ typedef struct nes_system nes_system;
 #include "cpu.h"
 #include "cartridge.h"
 #include "ppu_2C02.h"
+#include "apu_2A03.h"
+#include "controller.h"
+#include "perf_counters.h"
+#include "scheduler.h"
+
+// Clock relations of a TV system. Everything is timed in master clock ticks.
+typedef struct nes_timing{
+    uint8_t cpu_divider;        // Master clocks per CPU cycle
+    uint8_t ppu_divider;        // Master clocks per PPU dot
+    int16_t last_scanline;      // Scanlines go from -1 (pre-render) up to this one
+    double frame_rate;          // Frames per second of the real console
+} nes_timing;
+
+extern const nes_timing timing_ntsc;   // 3 dots per CPU cycle, 262 scanlines
+extern const nes_timing timing_pal;    // 3.2 dots per CPU cycle, 312 scanlines
+
+// Sources driving the CPU IRQ line. The line stays asserted until the source acknowledges it.
+enum IRQ_SOURCE{
+    IRQ_MAPPER = 0x01,
+    IRQ_APU_FRAME = 0x02,
+    IRQ_DMC = 0x04,
+};
 
 struct nes_system{
     uint8_t ram[2048];
     cartridge inserted_cart;
     cpu_6502 cpu;
     ppu_2C02 ppu;
+    apu_2A03 apu;
+    controller_ports controllers;
 
     uint32_t system_clock_counter;
+
+    const nes_timing *timing;
+    uint64_t master_clock;      // Time at which the next CPU cycle starts
+    scheduler events;
+    uint8_t irq_lines;          // IRQ_SOURCE bits currently asserting IRQ, polled between instructions
+    uint64_t oam_dma_start;     // CPU cycle at which the last OAM DMA started
+    uint64_t oam_dma_end;       // and the one at which it ended
+
+#ifdef NES_PERF_COUNTERS
+    perf_counters perf;
+#endif
 };
 
 
 
 void system_init(nes_system *nes);
 
+// Switches between NTSC and PAL clock relations. Pending events are rescheduled.
+void system_set_timing(nes_system *nes, const nes_timing *timing);
+
+// Advances the system by one PPU dot, clocking the CPU whenever one of its cycles is due.
 void system_clock(nes_system *nes);
 
+// Runs the system until the PPU finishes the current frame.
+// The CPU runs whole instructions uninterrupted until the next scheduled event, the PPU only
+// catches up when its registers are accessed or an event fires.
+void system_run_frame(nes_system *nes);
+
+// Handles every event due at the current master clock.
+void system_dispatch_events(nes_system *nes);
+
 void system_reset();
 
 uint8_t cpu_read(nes_system *nes, uint16_t addr);
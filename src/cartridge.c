@@ -1,45 +1,218 @@
 #include <cartridge.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mappers.h"
 #include "bus.h"
 
+#define CHR_RAM_SIZE 8192
+
 cartridge inserted_cart;
 
-void cartridge_init(cartridge *cart, char* path){
-    
-    FILE *fp = fopen(path, "rb");
+// NES 2.0 ROM size: a 12 bit count of "unit" bytes, or, when the high nibble is $F, 2^E * (MM * 2 + 1)
+// with the low byte read as EEEEEEMM.
+static size_t rom_size_nes2(uint8_t lsb, uint8_t msb_nibble, size_t unit){
+    if(msb_nibble == 0x0F){
+        uint8_t exponent = lsb >> 2;
+        if(exponent > 40) return SIZE_MAX;          // Rejected below as truncated
+        return ((size_t)1 << exponent) * ((lsb & 0x03) * 2 + 1);
+    }
+    return (((size_t)msb_nibble << 8) | lsb) * unit;
+}
 
-    // Read the header, determine the mapper, assign the mapper function and assign the mirroring type
-    fread(&(cart->header), sizeof(header_t), 1, fp);
-    
-    cart->mapper_id = (cart->header.mapper2 & 0xF0) | (cart->header.mapper1 >> 4);
-    assign_mapper(cart);
+// NES 2.0 RAM size: 64 << shift bytes, 0 for no RAM.
+static size_t ram_size_nes2(uint8_t shift){
+    return shift ? (size_t)64 << shift : 0;
+}
+
+const char *cartridge_parse_header(const header_t *header, size_t file_size, rom_layout *layout){
+    if(file_size < sizeof(header_t) || memcmp(header->name, "NES\x1A", 4) != 0){
+        return "not an iNES rom";
+    }
+    memset(layout, 0, sizeof(rom_layout));
 
-    cart->mirror = (cart->header.mapper1 & 0x01) ? VERTICAL: HORIZONTAL;
+    // There are 3 types of ines files: archaic iNES, iNES 1.0 and NES 2.0.
+    // Byte 7 tells NES 2.0 apart. Archaic dumps have garbage (often a ripper name) from byte 7 on,
+    // recognizable by non zero bytes 12-15, and only the low nibble of the mapper is valid.
+    layout->nes2 = (header->mapper2 & 0x0C) == 0x08;
+    uint8_t archaic = !layout->nes2 && (header->timing || header->unused[0] || header->unused[1] || header->unused[2]);
 
-    // Ignore the trainer data
-    uint8_t trainer_temp[512];
-    fread(trainer_temp, (cart->header.mapper1 >> 2) & 0x01, 512, fp);
+    layout->mapper_id = header->mapper1 >> 4;
+    if(!archaic) layout->mapper_id |= header->mapper2 & 0xF0;
+    layout->mirror = (header->mapper1 & 0x01) ? VERTICAL: HORIZONTAL;
+    if(header->mapper1 & 0x08){
+        layout->mirror = FOUR_SCREEN;
+    }
+    layout->battery = (header->mapper1 & 0x02) != 0;
 
+    if(layout->nes2){
+        layout->mapper_id |= (uint16_t)(header->prg_ram_size & 0x0F) << 8;
+        layout->submapper = header->prg_ram_size >> 4;
+        layout->prg_size = rom_size_nes2(header->prg_rom_chunks, header->tv_system1 & 0x0F, 16384);
+        layout->chr_size = rom_size_nes2(header->chr_rom_chunks, header->tv_system1 >> 4, 8192);
+        layout->prg_ram_size = ram_size_nes2(header->tv_system2 & 0x0F);
+        layout->prg_nvram_size = ram_size_nes2(header->tv_system2 >> 4);
+        layout->chr_ram_size = ram_size_nes2(header->chr_ram_size & 0x0F);
+        layout->chr_nvram_size = ram_size_nes2(header->chr_ram_size >> 4);
+        layout->timing = header->timing & 0x03;
+    }else{
+        // iNES only gives PRG RAM in 8 KB units, with 0 meaning 8 KB for compatibility
+        layout->prg_size = (size_t)header->prg_rom_chunks * 16384;
+        layout->chr_size = (size_t)header->chr_rom_chunks * 8192;
+        size_t prg_ram = (archaic || header->prg_ram_size == 0) ? 8192 : (size_t)header->prg_ram_size * 8192;
+        if(layout->battery) layout->prg_nvram_size = prg_ram;
+        else layout->prg_ram_size = prg_ram;
+        layout->chr_ram_size = layout->chr_size ? 0 : 8192;
+        layout->timing = TIMING_NTSC;       // Byte 9 is too often wrong to be trusted
+    }
 
-    // Here is where you would discover the the file format.
-    // There are 3 types of ines files.
-    // I'm gonna assume they are always type 1 instead.
+    // The trainer sits between the header and PRG
+    layout->prg_offset = sizeof(header_t) + ((header->mapper1 & 0x04) ? 512 : 0);
+    layout->chr_offset = layout->prg_offset + layout->prg_size;
 
+    if(layout->prg_size < 8192 || (layout->prg_size & 0x1FFF) || (layout->chr_size & 0x03FF)){
+        return "PRG ROM must be a multiple of 8 KB and CHR ROM of 1 KB";
+    }
+    if(layout->prg_size > file_size || layout->chr_size > file_size || layout->chr_offset + layout->chr_size > file_size){
+        return "truncated rom";
+    }
+    return NULL;
+}
 
-    cart->prg = (uint8_t *)malloc(cart->header.prg_rom_chunks * 16384);
-    fread(cart->prg, 16384, cart->header.prg_rom_chunks, fp);
+int cartridge_init(cartridge *cart, char* path, const cartridge_fix *fix){
+    memset(cart, 0, sizeof(cartridge));
 
-    cart->chr = (uint8_t *)malloc(cart->header.chr_rom_chunks * 8192);
-    fread(cart->chr, 8192, cart->header.chr_rom_chunks, fp);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    if((size_t)st.st_size < sizeof(header_t)){
+        fprintf(stderr, "%s: too short to be an iNES rom\n", path);
+        close(fd);
+        return -1;
+    }
 
+    // Read only and private: the pages come straight from the page cache and are never copied
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        perror(path);
+        return -1;
+    }
+    cart->rom_map = map;
+    cart->rom_size = st.st_size;
+
+    // Read the header, determine the mapper, assign the mapper function and assign the mirroring type
+    memcpy(&(cart->header), cart->rom_map, sizeof(header_t));
+    rom_layout layout;
+    const char *error = cartridge_parse_header(&(cart->header), cart->rom_size, &layout);
+    if(error != NULL){
+        fprintf(stderr, "%s: %s\n", path, error);
+        cartridge_free(cart);
+        return -1;
+    }
+
+    cart->mapper_id = layout.mapper_id;
+    cart->submapper = layout.submapper;
+    cart->mirror = layout.mirror;
+    cart->timing = layout.timing;
+    if(fix && fix->fix_mapper){
+        cart->mapper_id = fix->mapper_id;
+        cart->submapper = 0;
+    }
+    if(fix && fix->fix_mirror) cart->mirror = fix->mirror;
+
+    cart->prg = (uint8_t *)cart->rom_map + layout.prg_offset;
+    cart->prg_size = layout.prg_size;
+    cart->chr_size = layout.chr_size;
+    cart->prg_ram_size = layout.prg_ram_size + layout.prg_nvram_size;
+    cart->chr_ram_size = layout.chr_ram_size + layout.chr_nvram_size;
+    if(cart->chr_size == 0 && cart->chr_ram_size < CHR_RAM_SIZE){
+        cart->chr_ram_size = CHR_RAM_SIZE;      // Less than a whole pattern table can't work, the header is missing its CHR RAM
+    }
+
+    // Writable memory is the only thing each instance gets for itself, all of it in one block:
+    // PRG RAM, CHR RAM, then the four-screen VRAM
+    size_t vram_size = cart->mirror == FOUR_SCREEN ? 2048 : 0;
+    cart->arena_size = cart->prg_ram_size + cart->chr_ram_size + vram_size;
+    if(cart->arena_size != 0){
+        cart->arena = calloc(1, cart->arena_size);
+        if(cart->arena == NULL){
+            fprintf(stderr, "%s: out of memory\n", path);
+            cartridge_free(cart);
+            return -1;
+        }
+    }
+    cart->prg_ram = cart->prg_ram_size ? cart->arena : NULL;
+    cart->chr_ram = cart->chr_ram_size ? cart->arena + cart->prg_ram_size : NULL;
+    cart->vram = vram_size ? cart->arena + cart->prg_ram_size + cart->chr_ram_size : NULL;
+
+    if(cart->chr_size != 0){
+        cart->chr = (uint8_t *)cart->rom_map + layout.chr_offset;
+    }else{
+        cart->chr = cart->chr_ram;
+        cart->chr_writable = 1;
+    }
+
+    // The mapper sets up the initial banks, so it comes once everything is in place
+    if(assign_mapper(cart) != 0){
+        fprintf(stderr, "%s: mapper %d is not supported\n", path, cart->mapper_id);
+        cartridge_free(cart);
+        return -1;
+    }
+
+    return 0;
+}
+
+int cartridge_set_mirror(cartridge *cart, enum MIRROR mirror){
+    if(mirror == FOUR_SCREEN && cart->vram == NULL){
+        // Grows the arena and points everything back into it. The CHR RAM banks the mapper has
+        // switched in are kept as offsets, the old block may be gone after the realloc.
+        size_t chr_offset[8];
+        if(cart->chr_writable){
+            for(int i = 0; i < 8; i++) chr_offset[i] = cart->chr_page[i] - cart->chr_ram;
+        }
+        uint8_t *arena = realloc(cart->arena, cart->arena_size + 2048);
+        if(arena == NULL) return -1;
+        memset(arena + cart->arena_size, 0, 2048);
+        cart->prg_ram = cart->prg_ram_size ? arena : NULL;
+        cart->chr_ram = cart->chr_ram_size ? arena + cart->prg_ram_size : NULL;
+        if(cart->chr_writable){
+            cart->chr = cart->chr_ram;
+            for(int i = 0; i < 8; i++) cart->chr_page[i] = cart->chr_ram + chr_offset[i];
+        }
+        cart->vram = arena + cart->arena_size;
+        cart->arena = arena;
+        cart->arena_size += 2048;
+    }
+    cart->mirror = mirror;
+    return 0;
+}
 
-    fclose(fp);
+void cartridge_free(cartridge *cart){
+    if(cart->rom_map != NULL){
+        munmap((void *)cart->rom_map, cart->rom_size);
+    }
+    free(cart->arena);
+    cart->rom_map = NULL;
+    cart->arena = NULL;
+    cart->prg = cart->chr = cart->prg_ram = cart->chr_ram = cart->vram = NULL;
 }
 
-void cartridge_load(nes_system *nes, char *path){
+int cartridge_load(nes_system *nes, char *path){
     
-    cartridge_init(&(nes->inserted_cart), path);
+    return cartridge_init(&(nes->inserted_cart), path, NULL);
     
 }
\ No newline at end of file
@@ -1,42 +1,141 @@
 #ifndef _CARTRIDGE_H_
 #define _CARTRIDGE_H_
 #include <stdint.h>
+#include <stddef.h>
 
 
 typedef struct header{
     char name[4];               // 0-3: Constant $4E $45 $53 $1A ("NES" followed by MS-DOS end-of-file)
-    uint8_t prg_rom_chunks;     // 4: Size of PRG ROM in 16 KB units
+    uint8_t prg_rom_chunks;     // 4: Size of PRG ROM in 16 KB units (low byte on NES 2.0)
     uint8_t chr_rom_chunks;     // 5: Size of CHR ROM in 8 KB units (Value 0 means the board uses CHR RAM)
     uint8_t mapper1;            // 6: Flags 6 - Mapper, mirroring, battery, trainer
     uint8_t mapper2;            // 7: Flags 7 - Mapper, VS/Playchoice, NES 2.0
-    uint8_t prg_ram_size;       // 8: Flags 8 - PRG-RAM size (rarely used extension)
-    uint8_t tv_system1;         // 9: Flags 9 - TV system (rarely used extension)
-    uint8_t tv_system2;         // 10: Flags 10 - TV system, PRG-RAM presence (unofficial, rarely used extension)
-    char unused[5];             // 11-15: Unused padding (should be filled with zero, but some rippers put their name across bytes 7-15)
+    uint8_t prg_ram_size;       // 8: iNES: PRG-RAM size in 8 KB units. NES 2.0: mapper bits 8-11, submapper
+    uint8_t tv_system1;         // 9: iNES: TV system. NES 2.0: PRG/CHR ROM size high nibbles
+    uint8_t tv_system2;         // 10: iNES: unofficial TV system. NES 2.0: PRG-RAM/NVRAM shift counts
+    uint8_t chr_ram_size;       // 11: NES 2.0: CHR-RAM/NVRAM shift counts
+    uint8_t timing;             // 12: NES 2.0: CPU/PPU timing
+    char unused[3];             // 13-15: NES 2.0 system type and misc roms. Some rippers put their name across bytes 7-15
 } header_t;
 
+// CPU/PPU timing, values as in byte 12 of a NES 2.0 header
+enum TIMING{
+    TIMING_NTSC,
+    TIMING_PAL,
+    TIMING_MULTI,               // Works on both, run as NTSC
+    TIMING_DENDY,
+};
+
+// Registers of the mappers that need more than a bank number, see src/mappers/
+typedef struct mmc1_state{
+    uint8_t shift;              // Serial port, filled from bit 0 of 5 consecutive writes
+    uint8_t shift_count;
+    uint8_t control;            // Mirroring, PRG and CHR bank modes
+    uint8_t chr_bank[2];
+    uint8_t prg_bank;
+    uint64_t last_write;        // CPU cycle of the last write, writes on consecutive cycles are ignored
+} mmc1_state;
+
+typedef struct mmc3_state{
+    uint8_t bank_select;        // Register written by the next $8001 write, plus PRG/CHR modes
+    uint8_t bank[8];            // R0-R5 CHR, R6-R7 PRG
+    uint8_t prg_ram_protect;
+    uint8_t irq_latch;
+    uint8_t irq_counter;
+    uint8_t irq_reload;
+    uint8_t irq_enabled;
+    uint64_t irq_counted;       // PPU dot up to which the A12 edges have been applied to the counter
+} mmc3_state;
+
+struct mapper_interface;
+
 typedef struct cartridge{
     header_t header;
-    uint8_t *prg;
-    uint8_t *chr;
+    uint8_t *prg;               // Points into the read only mapping of the rom file
+    uint8_t *chr;               // Same for CHR ROM, or "chr_ram" on boards without CHR ROM
+    uint8_t *prg_ram;           // PRG RAM and NVRAM, contiguous, seen at $6000-$7FFF. NULL if the board has none
+    uint8_t *chr_ram;           // CHR RAM and NVRAM, contiguous. NULL if the board has none
+    uint8_t *vram;              // Extra 2 KB of nametable RAM on four-screen boards, NULL otherwise
+    size_t prg_size;
+    size_t chr_size;            // CHR ROM
+    size_t prg_ram_size;        // Volatile plus battery backed
+    size_t chr_ram_size;
+    uint8_t chr_writable;       // "chr" is CHR RAM
+
+    // Every writable byte of the cartridge comes from one allocation, only the rom is shared
+    uint8_t *arena;
+    size_t arena_size;
+
+    const uint8_t *rom_map;     // mmap of the whole rom file, shared by every instance running it
+    size_t rom_size;
 
-    uint16_t (*mapper_f)(uint16_t, uint8_t, uint8_t);    // Mapper function
-    uint8_t mapper_id; 
+    const struct mapper_interface *mapper;
+    uint8_t *prg_page[4];       // 8 KB PRG banks seen at $8000, $A000, $C000 and $E000
+    uint8_t *chr_page[8];       // 1 KB CHR banks seen at $0000-$1FFF
+    union{                      // State of the mapper, owned by its implementation
+        uint8_t bank;           // Single bank register (UxROM, CNROM, AxROM)
+        mmc1_state mmc1;
+        mmc3_state mmc3;
+    } regs;
+    uint16_t mapper_id;
+    uint8_t submapper;
+    enum TIMING timing;
 
     enum MIRROR{
         HORIZONTAL,
         VERTICAL,
         ONESCREEN_LO,
         ONESCREEN_HI,
+        FOUR_SCREEN,
     }mirror;
 }cartridge;
 
+// Where the parts of an iNES file are and how the board is wired, as told by its header
+typedef struct rom_layout{
+    uint8_t nes2;               // The header is in NES 2.0 format
+    uint16_t mapper_id;
+    uint8_t submapper;
+    enum MIRROR mirror;
+    uint8_t battery;            // Some of the RAM is battery backed
+    enum TIMING timing;
+    size_t prg_offset;          // From the start of the file, after the header and trainer
+    size_t prg_size;
+    size_t chr_offset;
+    size_t chr_size;            // 0 for boards with only CHR RAM
+    size_t prg_ram_size;        // Volatile
+    size_t prg_nvram_size;      // Battery backed
+    size_t chr_ram_size;
+    size_t chr_nvram_size;
+} rom_layout;
+
+// Corrections to a header known to be wrong (from the rom index), applied before the mapper is chosen
+typedef struct cartridge_fix{
+    uint8_t fix_mapper;         // Use "mapper_id" instead of the header mapper
+    uint8_t fix_mirror;         // Use "mirror" instead of the header mirroring
+    uint16_t mapper_id;
+    enum MIRROR mirror;
+} cartridge_fix;
+
 #include "bus.h"
 
-// Initializes "cart" with data based on the ines rom indicated by "path"
-void cartridge_init(cartridge *cart, char* path);
+// Decodes the header at the start of a "file_size" bytes rom file into "layout".
+// Returns NULL on success, or a description of what is wrong with the file.
+const char *cartridge_parse_header(const header_t *header, size_t file_size, rom_layout *layout);
+
+// Initializes "cart" with data based on the ines rom indicated by "path", with the header corrected by
+// "fix" (NULL for none). The file is mapped read only and PRG/CHR ROM point straight into it, so
+// processes running the same rom share its pages. Returns 0 on success, -1 (after printing why) if the
+// file can't be used.
+int cartridge_init(cartridge *cart, char* path, const cartridge_fix *fix);
+
+// Changes the nametable mirroring of the board, adding the four-screen VRAM if needed.
+// Returns 0 on success, -1 if the VRAM can't be allocated.
+int cartridge_set_mirror(cartridge *cart, enum MIRROR mirror);
+
+// Unmaps the rom and frees the cartridge RAM.
+void cartridge_free(cartridge *cart);
 
 // Wrapper to call "cartridge_init()" passing the global "inserted_cart" variable and the given "path"
-void cartridge_load(nes_system *nes, char *path);
+int cartridge_load(nes_system *nes, char *path);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <string.h>
+#include "controller.h"
+#include "bus.h"
+
+void controller_init(nes_system *nes){
+    memset(&(nes->controllers), 0, sizeof(controller_ports));
+}
+
+void controller_set(nes_system *nes, uint8_t port, uint8_t buttons){
+    nes->controllers.port[port & 0x01].buttons = buttons;
+}
+
+void controller_attach_queue(nes_system *nes, input_queue *queue){
+    nes->controllers.queue = queue;
+}
+
+uint64_t controller_take_input_time(nes_system *nes){
+    uint64_t time = nes->controllers.input_ns;
+    nes->controllers.input_ns = 0;
+    return time;
+}
+
+// Applies every change queued so far, oldest first.
+static void drain_queue(controller_ports *ports){
+    input_event event;
+    while(input_queue_pop(ports->queue, &event) == 0){
+        ports->port[event.port & 0x01].buttons = event.buttons;
+        if(ports->input_ns == 0 || event.time_ns < ports->input_ns) ports->input_ns = event.time_ns;
+    }
+}
+
+static inline void latch(controller_ports *ports){
+    if(ports->queue) drain_queue(ports);
+    ports->port[0].shift = ports->port[0].buttons;
+    ports->port[1].shift = ports->port[1].buttons;
+}
+
+void controller_write(nes_system *nes, uint8_t data){
+    controller_ports *ports = &(nes->controllers);
+
+    // The shift registers keep reloading while the strobe is high and hold once it drops
+    if(ports->strobe || (data & 0x01)) latch(ports);
+    ports->strobe = data & 0x01;
+}
+
+uint8_t controller_read(nes_system *nes, uint8_t port){
+    controller_ports *ports = &(nes->controllers);
+    controller *pad = &(ports->port[port]);
+    if(ports->strobe) latch(ports);
+
+    // The upper bits are open bus, usually the $40 of the address
+    uint8_t data = 0x40 | (pad->shift & 0x01);
+    if(!ports->strobe) pad->shift = (pad->shift >> 1) | 0x80;
+    return data;
+}
@@ -0,0 +1,59 @@
+#ifndef _CONTROLLER_H_
+#define _CONTROLLER_H_
+#include <stdint.h>
+#include "input_queue.h"
+
+// Standard controllers on $4016 and $4017.
+//
+// Writing 1 then 0 to $4016 (the strobe) copies the buttons into each controller's shift register,
+// and each read returns the next bit: A, B, Select, Start, Up, Down, Left, Right, then 1s.
+//
+// The buttons come either from controller_set() (batch runs, one state per instance, no threads), or
+// from an input_queue filled by another thread. The queue is only drained at the strobe write, so
+// the game sees everything that happened up to the exact cycle it asks, however far ahead of the
+// real console the emulation runs.
+
+enum CONTROLLER_BUTTON{
+    BUTTON_A = 0x01,
+    BUTTON_B = 0x02,
+    BUTTON_SELECT = 0x04,
+    BUTTON_START = 0x08,
+    BUTTON_UP = 0x10,
+    BUTTON_DOWN = 0x20,
+    BUTTON_LEFT = 0x40,
+    BUTTON_RIGHT = 0x80,
+};
+
+typedef struct controller{
+    uint8_t buttons;            // Held right now
+    uint8_t shift;              // Latched by the strobe, shifted out by the reads
+} controller;
+
+typedef struct controller_ports{
+    controller port[2];
+    uint8_t strobe;
+    input_queue *queue;         // NULL when the state only changes through controller_set()
+    uint64_t input_ns;          // Oldest "time_ns" of the events latched since the last controller_take_input_time()
+} controller_ports;
+
+#include "bus.h"
+
+// Empties both controllers and detaches the queue.
+void controller_init(nes_system *nes);
+
+// Batch use: sets the buttons held on "port", seen by the game at its next strobe.
+void controller_set(nes_system *nes, uint8_t port, uint8_t buttons);
+
+// Makes the strobe drain "queue" (NULL to stop).
+void controller_attach_queue(nes_system *nes, input_queue *queue);
+
+// Returns and clears the oldest host time of the input the game latched, 0 if there was none.
+uint64_t controller_take_input_time(nes_system *nes);
+
+// $4016 write
+void controller_write(nes_system *nes, uint8_t data);
+
+// $4016 and $4017 reads
+uint8_t controller_read(nes_system *nes, uint8_t port);
+
+#endif
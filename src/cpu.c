@@ -6,22 +6,66 @@
 
 void cpu_init(nes_system *nes){
     nes->cpu.stkbase = 0x100;
+	nes->cpu.clock_count = 0;
+	nes->cpu.instruction_count = 0;
+	nes->cpu.stall = 0;
 	cpu_reset(nes);
 	nes->cpu.cycles = 0;
 }
 
 
+// Fetches, decodes and executes the instruction pointed by pc, setting "cycles" to its duration.
+static void cpu_execute(nes_system *nes){
+#ifdef CPU_TRACE
+	printf("pc : %x\n", nes->cpu.pc);
+#endif
+    nes->cpu.instruction_count++;
+    nes->cpu.opcode = cpu_read(nes, nes->cpu.pc);
+    nes->cpu.pc++;
+    nes->cpu.cycles = lookup[nes->cpu.opcode].cycles;
+    uint8_t additional_cycle1 = lookup[nes->cpu.opcode].addrmode(nes);
+    uint8_t additional_cycle2 = lookup[nes->cpu.opcode].operate(nes);
+#ifdef NES_PERF_COUNTERS
+    // Branches add their extra cycles directly to "cycles" while operating
+    uint8_t branch_extra = (lookup[nes->cpu.opcode].addrmode == &REL) ? nes->cpu.cycles - lookup[nes->cpu.opcode].cycles : 0;
+#endif
+    nes->cpu.cycles += (additional_cycle1 & additional_cycle2);
+#ifdef NES_PERF_COUNTERS
+    perf_count_instruction(&(nes->perf), nes->cpu.opcode, nes->cpu.cycles, additional_cycle1 & additional_cycle2, branch_extra);
+#endif
+}
+
+// Takes the IRQ if a source is asserting it and interrupts are enabled, runs the next instruction otherwise.
+static inline void cpu_next(nes_system *nes){
+    if(nes->irq_lines && cpu_get_flag(nes, I) == 0){
+        cpu_irq(nes);
+    }else{
+        cpu_execute(nes);
+    }
+}
+
 void cpu_clock(nes_system *nes){
     if(nes->cpu.cycles == 0){
-		printf("pc : %x\n", nes->cpu.pc);
-        nes->cpu.opcode = cpu_read(nes, nes->cpu.pc);
-        nes->cpu.pc++;
-        nes->cpu.cycles = lookup[nes->cpu.opcode].cycles;
-        uint8_t additional_cycle1 = lookup[nes->cpu.opcode].addrmode(nes);
-        uint8_t additional_cycle2 = lookup[nes->cpu.opcode].operate(nes);
-        nes->cpu.cycles += (additional_cycle1 & additional_cycle2);
+        if(nes->cpu.stall){         // Halted by DMA
+            nes->cpu.stall--;
+            nes->cpu.clock_count++;
+            return;
+        }
+        cpu_next(nes);
     }
     nes->cpu.cycles--;
+    nes->cpu.clock_count++;
+}
+
+uint16_t cpu_step(nes_system *nes){
+    if(nes->cpu.cycles == 0 && nes->cpu.stall == 0){
+        cpu_next(nes);
+    }
+    uint16_t cycles = nes->cpu.cycles + nes->cpu.stall;
+    nes->cpu.cycles = 0;
+    nes->cpu.stall = 0;
+    nes->cpu.clock_count += cycles;
+    return cycles;
 }
 
 // Fetches the data to be used by the instruction.
@@ -32,6 +76,33 @@ uint8_t cpu_fetch(nes_system *nes){
     return nes->cpu.fetched;
 }
 
+// Disassembly helpers
+
+const char *cpu_opcode_name(uint8_t opcode){
+    return lookup[opcode].name;
+}
+
+const char *cpu_addrmode_name(uint8_t opcode){
+    uint8_t (*mode)(nes_system *) = lookup[opcode].addrmode;
+    if(mode == &IMP) return "IMP";
+    if(mode == &IMM) return "IMM";
+    if(mode == &ZP0) return "ZP0";
+    if(mode == &ZPX) return "ZPX";
+    if(mode == &ZPY) return "ZPY";
+    if(mode == &REL) return "REL";
+    if(mode == &ABS) return "ABS";
+    if(mode == &ABX) return "ABX";
+    if(mode == &ABY) return "ABY";
+    if(mode == &IND) return "IND";
+    if(mode == &IZX) return "IZX";
+    if(mode == &IZY) return "IZY";
+    return "???";
+}
+
+uint8_t cpu_opcode_cycles(uint8_t opcode){
+    return lookup[opcode].cycles;
+}
+
 // Flag functions
 
 uint8_t cpu_get_flag(nes_system *nes, enum FLAGS6502 f){
@@ -57,7 +128,7 @@ void cpu_reset(nes_system *nes){
 	nes->cpu.x = 0;
 	nes->cpu.y = 0;
 	nes->cpu.stkp = 0xFD;
-	nes->cpu.status = 0x00 | U;
+	nes->cpu.status = 0x00 | U | I;		// IRQs stay masked until the program is ready for them
 
 	// Clear internal helper variables
 	nes->cpu.addr_rel = 0x0000;
@@ -79,12 +150,13 @@ void cpu_irq(nes_system *nes){
 		cpu_write(nes, 0x0100 + nes->cpu.stkp, nes->cpu.pc & 0x00FF);
 		nes->cpu.stkp--;
 
-		// Then Push the status register to the stack
+		// Then Push the status register to the stack, with I still clear so
+		// that RTI enables interrupts again
 		cpu_set_flag(nes, B, 0);
 		cpu_set_flag(nes, U, 1);
-		cpu_set_flag(nes, I, 1);
 		cpu_write(nes, 0x0100 + nes->cpu.stkp, nes->cpu.status);
 		nes->cpu.stkp--;
+		cpu_set_flag(nes, I, 1);
 
 		// Read new program counter location from fixed address
 		nes->cpu.addr_abs = 0xFFFE;
@@ -103,11 +175,12 @@ void cpu_nmi(nes_system *nes){
 	cpu_write(nes, nes->cpu.stkbase + nes->cpu.stkp, nes->cpu.pc & 0x00FF);
 	nes->cpu.stkp--;
 
+	// The pushed status keeps the I flag the program had, RTI restores it
 	cpu_set_flag(nes, B, 0);
 	cpu_set_flag(nes, U, 1);
-	cpu_set_flag(nes, I, 1);
 	cpu_write(nes,  nes->cpu.stkbase + nes->cpu.stkp, nes->cpu.status);
 	nes->cpu.stkp--;
+	cpu_set_flag(nes, I, 1);
 
 	nes->cpu.addr_abs = 0xFFFA;
 	uint16_t lo = cpu_read(nes, nes->cpu.addr_abs + 0);
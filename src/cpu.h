@@ -20,6 +20,10 @@ typedef struct cpu_6502{
     uint16_t addr_rel;      // For use during relative address resolutions
     uint8_t  opcode  ;      // Current opcode
     uint8_t  cycles  ;      // Cycles left for the duration of current instruction
+    uint16_t stall   ;      // Cycles the CPU stays halted after the current instruction (DMA)
+
+    uint64_t clock_count;       // Total cycles clocked since power on
+    uint64_t instruction_count; // Total instructions fetched since power on
 }cpu_6502;
 
 #include "bus.h"
@@ -53,6 +57,9 @@ void cpu_irq(nes_system *);
 void cpu_nmi(nes_system *);		
 // Perform one clock cycle's worth of update
 void cpu_clock(nes_system *);	
+// Runs the rest of the current instruction (or a whole new one) at once and returns how many cycles it took,
+// DMA stalls included
+uint16_t cpu_step(nes_system *);
 
 // Returns 1 if flag "f" is set in the cpu contained in "nes", 0 otherwise.
 // Note: flags are stored in the status register
@@ -64,4 +71,13 @@ void cpu_set_flag(nes_system *nes, enum FLAGS6502 f, uint16_t v);
 
 uint8_t cpu_fetch(nes_system *nes);
 
+// Mnemonic of "opcode" ("???" for illegal opcodes).
+const char *cpu_opcode_name(uint8_t opcode);
+
+// Name of the addressing mode used by "opcode" (IMP, IMM, ZP0, ...).
+const char *cpu_addrmode_name(uint8_t opcode);
+
+// Cycles "opcode" takes at least, before page crossings and taken branches.
+uint8_t cpu_opcode_cycles(uint8_t opcode);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "explore.h"
+#include "state_hash.h"
+#include "bus.h"
+
+// In the child: plays the branch and reports, never returns.
+static void run_branch(explore_batch *batch, nes_system *nes, const explore_branch *branch, int index){
+    explore_result *result = &(batch->results[index]);
+
+    // Nothing else feeds this copy of the instance, and its frames go to the batch or nowhere
+    controller_attach_queue(nes, NULL);
+    nes->ppu.screen = batch->screens ? batch->screens[index] : NULL;
+
+    for(uint32_t f = 0; f < branch->frames; f++){
+        controller_set(nes, 0, branch->buttons[f]);
+        system_run_frame(nes);
+    }
+    result->frames = branch->frames;
+    result->hash = state_hash(nes);
+    memcpy(result->ram, nes->ram, sizeof(result->ram));
+    result->status = 0;
+    _exit(0);
+}
+
+static void reap(pid_t pid){
+    int status;
+    while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+}
+
+int explore_run(explore_batch *batch, nes_system *nes, const explore_branch *branches, int count, int with_screens, int parallel){
+    // Nothing to map or run, an empty batch
+    if(count <= 0){
+        batch->results = NULL;
+        batch->screens = NULL;
+        batch->count = 0;
+        batch->size = 0;
+        return 0;
+    }
+
+    size_t results_size = (count * sizeof(explore_result) + 4095) & ~(size_t)4095;
+    batch->size = results_size + (with_screens ? count * sizeof(pixel[240][256]) : 0);
+    void *map = mmap(NULL, batch->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED){
+        perror("mmap");
+        return -1;
+    }
+    batch->results = map;
+    batch->screens = with_screens ? (pixel (*)[240][256])((uint8_t *)map + results_size) : NULL;
+    batch->count = count;
+
+    // A branch whose child dies keeps this
+    for(int i = 0; i < count; i++) batch->results[i].status = -1;
+
+    if(parallel <= 0) parallel = sysconf(_SC_NPROCESSORS_ONLN);
+    if(parallel <= 0) parallel = 1;
+
+    pid_t *pids = malloc(count * sizeof(pid_t));
+    if(pids == NULL){
+        explore_free(batch);
+        return -1;
+    }
+
+    // Buffered output would be written again by every child
+    fflush(NULL);
+
+    // Branches take about the same time, so the oldest child is the one waited for
+    int started = 0, reaped = 0, error = 0;
+    for(; started < count; started++){
+        if(started - reaped == parallel) reap(pids[reaped++]);
+        pid_t pid = fork();
+        if(pid == 0) run_branch(batch, nes, &branches[started], started);
+        if(pid < 0){
+            perror("fork");
+            error = 1;
+            break;
+        }
+        pids[started] = pid;
+    }
+    while(reaped < started) reap(pids[reaped++]);
+    free(pids);
+    if(error){
+        explore_free(batch);
+        return -1;
+    }
+    return 0;
+}
+
+void explore_free(explore_batch *batch){
+    if(batch->results) munmap(batch->results, batch->size);
+    batch->results = NULL;
+    batch->screens = NULL;
+}
@@ -0,0 +1,43 @@
+#ifndef _EXPLORE_H_
+#define _EXPLORE_H_
+#include <stdint.h>
+#include "bus.h"
+
+// Branching exploration: continues a running instance along K input sequences at once, one forked
+// child process per branch.
+//
+// fork() gives each child the parent's state copy-on-write: the rom is a shared read only mapping
+// anyway, and of the instance only the pages a branch actually writes (RAM, VRAM, the frame it draws,
+// ...) get copied. Children write their results straight into a shared anonymous mapping, which the
+// parent reads in place once they are done. The parent's instance is left untouched.
+
+typedef struct explore_branch{
+    const uint8_t *buttons;             // Controller 1, one byte per frame
+    uint32_t frames;
+} explore_branch;
+
+typedef struct explore_result{
+    int32_t status;                     // 0 once the branch completed, -1 if its child died
+    uint32_t frames;                    // Frames run
+    uint64_t hash;                      // state_hash() at the end
+    uint8_t ram[2048];
+} explore_result;
+
+typedef struct explore_batch{
+    explore_result *results;            // One per branch, in a shared mapping
+    pixel (*screens)[240][256];         // Last frame of each branch, NULL unless asked for
+    int count;
+    size_t size;                        // Of the mapping
+} explore_batch;
+
+// Runs "count" branches from the current state of "nes", at most "parallel" at a time (0: one per
+// CPU), and waits for all of them. "with_screens" also keeps the last frame of each branch. A
+// "count" of 0 or less gives an empty batch.
+// Returns 0, or -1 if the shared mapping can't be made or a child can't be started. On failure the
+// children already started are waited for and nothing is left mapped.
+int explore_run(explore_batch *batch, nes_system *nes, const explore_branch *branches, int count, int with_screens, int parallel);
+
+// Unmaps the results of a successful explore_run().
+void explore_free(explore_batch *batch);
+
+#endif
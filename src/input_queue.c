@@ -0,0 +1,36 @@
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "input_queue.h"
+
+void input_queue_init(input_queue *queue){
+    memset(queue->events, 0, sizeof(queue->events));
+    atomic_store(&(queue->head), 0);
+    atomic_store(&(queue->tail), 0);
+    atomic_store(&(queue->dropped), 0);
+}
+
+int input_queue_push(input_queue *queue, const input_event *event){
+    uint32_t head = atomic_load_explicit(&(queue->head), memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&(queue->tail), memory_order_acquire);
+    if(head - tail == INPUT_QUEUE_SIZE){
+        atomic_fetch_add_explicit(&(queue->dropped), 1, memory_order_relaxed);
+        return -1;
+    }
+    queue->events[head & (INPUT_QUEUE_SIZE - 1)] = *event;
+
+    // Release: the event must be visible before the consumer sees the new head
+    atomic_store_explicit(&(queue->head), head + 1, memory_order_release);
+    return 0;
+}
+
+int input_queue_pop(input_queue *queue, input_event *event){
+    uint32_t tail = atomic_load_explicit(&(queue->tail), memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&(queue->head), memory_order_acquire);
+    if(head == tail) return -1;
+    *event = queue->events[tail & (INPUT_QUEUE_SIZE - 1)];
+
+    // Release: the slot may only be reused once it has been copied out
+    atomic_store_explicit(&(queue->tail), tail + 1, memory_order_release);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef _INPUT_QUEUE_H_
+#define _INPUT_QUEUE_H_
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Lock-free queue of controller changes from the thread that reads the host input (single producer)
+// to the emulation thread (single consumer), same scheme as the audio_ring. Every event carries the
+// whole state of a controller, so the consumer never has to rebuild it from presses and releases,
+// and the time it was read, to measure how long it takes to reach the screen.
+
+#define INPUT_QUEUE_SIZE 256        // Events, a power of two
+
+typedef struct input_event{
+    uint64_t time_ns;               // CLOCK_MONOTONIC when the host saw the change
+    uint8_t port;                   // 0 or 1
+    uint8_t buttons;                // CONTROLLER_BUTTON bits
+} input_event;
+
+typedef struct input_queue{
+    input_event events[INPUT_QUEUE_SIZE];
+    _Alignas(64) _Atomic uint32_t head;     // Next event written, only stored by the producer
+    _Alignas(64) _Atomic uint32_t tail;     // Next event read, only stored by the consumer
+    _Atomic uint64_t dropped;               // Events pushed while the queue was full
+} input_queue;
+
+void input_queue_init(input_queue *queue);
+
+// Producer: returns 0, or -1 if the queue is full and the event was dropped.
+int input_queue_push(input_queue *queue, const input_event *event);
+
+// Consumer: takes the oldest event, returns 0, or -1 if the queue is empty.
+int input_queue_pop(input_queue *queue, input_event *event);
+
+#endif
@@ -0,0 +1,470 @@
+#include <stdint.h>
+#include <string.h>
+#include "lockstep.h"
+#include "bus.h"
+#include "mappers.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+// Instructions run on the vectors. Everything else takes the scalar path.
+enum LANE_OP{
+    OP_NONE,
+    OP_LDA, OP_LDX, OP_LDY, OP_STA, OP_STX, OP_STY,
+    OP_ADC, OP_SBC, OP_AND, OP_ORA, OP_EOR, OP_CMP, OP_CPX, OP_CPY, OP_BIT,
+    OP_INC, OP_DEC, OP_ASL, OP_LSR, OP_ROL, OP_ROR,
+    OP_INX, OP_INY, OP_DEX, OP_DEY, OP_TAX, OP_TAY, OP_TXA, OP_TYA, OP_TSX, OP_TXS,
+    OP_CLC, OP_SEC, OP_CLI, OP_SEI, OP_CLV, OP_CLD, OP_SED, OP_NOP,
+    OP_BPL, OP_BMI, OP_BVC, OP_BVS, OP_BCC, OP_BCS, OP_BNE, OP_BEQ,
+    OP_JMP, OP_JSR, OP_RTS, OP_PHA, OP_PHP, OP_PLA,
+};
+
+enum LANE_MODE{ MODE_IMP, MODE_IMM, MODE_ZP0, MODE_ZPX, MODE_ZPY, MODE_ABS, MODE_ABX, MODE_ABY, MODE_REL };
+
+static const struct{
+    uint8_t op;
+    uint8_t mode;
+} decode[256] = {
+    [0xA9] = {OP_LDA, MODE_IMM}, [0xA5] = {OP_LDA, MODE_ZP0}, [0xB5] = {OP_LDA, MODE_ZPX},
+    [0xAD] = {OP_LDA, MODE_ABS}, [0xBD] = {OP_LDA, MODE_ABX}, [0xB9] = {OP_LDA, MODE_ABY},
+    [0xA2] = {OP_LDX, MODE_IMM}, [0xA6] = {OP_LDX, MODE_ZP0}, [0xB6] = {OP_LDX, MODE_ZPY},
+    [0xAE] = {OP_LDX, MODE_ABS}, [0xBE] = {OP_LDX, MODE_ABY},
+    [0xA0] = {OP_LDY, MODE_IMM}, [0xA4] = {OP_LDY, MODE_ZP0}, [0xB4] = {OP_LDY, MODE_ZPX},
+    [0xAC] = {OP_LDY, MODE_ABS}, [0xBC] = {OP_LDY, MODE_ABX},
+    [0x85] = {OP_STA, MODE_ZP0}, [0x95] = {OP_STA, MODE_ZPX}, [0x8D] = {OP_STA, MODE_ABS},
+    [0x9D] = {OP_STA, MODE_ABX}, [0x99] = {OP_STA, MODE_ABY},
+    [0x86] = {OP_STX, MODE_ZP0}, [0x96] = {OP_STX, MODE_ZPY}, [0x8E] = {OP_STX, MODE_ABS},
+    [0x84] = {OP_STY, MODE_ZP0}, [0x94] = {OP_STY, MODE_ZPX}, [0x8C] = {OP_STY, MODE_ABS},
+
+    [0x69] = {OP_ADC, MODE_IMM}, [0x65] = {OP_ADC, MODE_ZP0}, [0x75] = {OP_ADC, MODE_ZPX},
+    [0x6D] = {OP_ADC, MODE_ABS}, [0x7D] = {OP_ADC, MODE_ABX}, [0x79] = {OP_ADC, MODE_ABY},
+    [0xE9] = {OP_SBC, MODE_IMM}, [0xE5] = {OP_SBC, MODE_ZP0}, [0xF5] = {OP_SBC, MODE_ZPX},
+    [0xED] = {OP_SBC, MODE_ABS}, [0xFD] = {OP_SBC, MODE_ABX}, [0xF9] = {OP_SBC, MODE_ABY},
+    [0x29] = {OP_AND, MODE_IMM}, [0x25] = {OP_AND, MODE_ZP0}, [0x35] = {OP_AND, MODE_ZPX},
+    [0x2D] = {OP_AND, MODE_ABS}, [0x3D] = {OP_AND, MODE_ABX}, [0x39] = {OP_AND, MODE_ABY},
+    [0x09] = {OP_ORA, MODE_IMM}, [0x05] = {OP_ORA, MODE_ZP0}, [0x15] = {OP_ORA, MODE_ZPX},
+    [0x0D] = {OP_ORA, MODE_ABS}, [0x1D] = {OP_ORA, MODE_ABX}, [0x19] = {OP_ORA, MODE_ABY},
+    [0x49] = {OP_EOR, MODE_IMM}, [0x45] = {OP_EOR, MODE_ZP0}, [0x55] = {OP_EOR, MODE_ZPX},
+    [0x4D] = {OP_EOR, MODE_ABS}, [0x5D] = {OP_EOR, MODE_ABX}, [0x59] = {OP_EOR, MODE_ABY},
+    [0xC9] = {OP_CMP, MODE_IMM}, [0xC5] = {OP_CMP, MODE_ZP0}, [0xD5] = {OP_CMP, MODE_ZPX},
+    [0xCD] = {OP_CMP, MODE_ABS}, [0xDD] = {OP_CMP, MODE_ABX}, [0xD9] = {OP_CMP, MODE_ABY},
+    [0xE0] = {OP_CPX, MODE_IMM}, [0xE4] = {OP_CPX, MODE_ZP0}, [0xEC] = {OP_CPX, MODE_ABS},
+    [0xC0] = {OP_CPY, MODE_IMM}, [0xC4] = {OP_CPY, MODE_ZP0}, [0xCC] = {OP_CPY, MODE_ABS},
+    [0x24] = {OP_BIT, MODE_ZP0}, [0x2C] = {OP_BIT, MODE_ABS},
+
+    [0xE6] = {OP_INC, MODE_ZP0}, [0xF6] = {OP_INC, MODE_ZPX}, [0xEE] = {OP_INC, MODE_ABS}, [0xFE] = {OP_INC, MODE_ABX},
+    [0xC6] = {OP_DEC, MODE_ZP0}, [0xD6] = {OP_DEC, MODE_ZPX}, [0xCE] = {OP_DEC, MODE_ABS}, [0xDE] = {OP_DEC, MODE_ABX},
+    [0x0A] = {OP_ASL, MODE_IMP}, [0x06] = {OP_ASL, MODE_ZP0}, [0x16] = {OP_ASL, MODE_ZPX},
+    [0x0E] = {OP_ASL, MODE_ABS}, [0x1E] = {OP_ASL, MODE_ABX},
+    [0x4A] = {OP_LSR, MODE_IMP}, [0x46] = {OP_LSR, MODE_ZP0}, [0x56] = {OP_LSR, MODE_ZPX},
+    [0x4E] = {OP_LSR, MODE_ABS}, [0x5E] = {OP_LSR, MODE_ABX},
+    [0x2A] = {OP_ROL, MODE_IMP}, [0x26] = {OP_ROL, MODE_ZP0}, [0x36] = {OP_ROL, MODE_ZPX},
+    [0x2E] = {OP_ROL, MODE_ABS}, [0x3E] = {OP_ROL, MODE_ABX},
+    [0x6A] = {OP_ROR, MODE_IMP}, [0x66] = {OP_ROR, MODE_ZP0}, [0x76] = {OP_ROR, MODE_ZPX},
+    [0x6E] = {OP_ROR, MODE_ABS}, [0x7E] = {OP_ROR, MODE_ABX},
+
+    [0xE8] = {OP_INX, MODE_IMP}, [0xC8] = {OP_INY, MODE_IMP}, [0xCA] = {OP_DEX, MODE_IMP}, [0x88] = {OP_DEY, MODE_IMP},
+    [0xAA] = {OP_TAX, MODE_IMP}, [0xA8] = {OP_TAY, MODE_IMP}, [0x8A] = {OP_TXA, MODE_IMP}, [0x98] = {OP_TYA, MODE_IMP},
+    [0xBA] = {OP_TSX, MODE_IMP}, [0x9A] = {OP_TXS, MODE_IMP},
+    [0x18] = {OP_CLC, MODE_IMP}, [0x38] = {OP_SEC, MODE_IMP}, [0x58] = {OP_CLI, MODE_IMP}, [0x78] = {OP_SEI, MODE_IMP},
+    [0xB8] = {OP_CLV, MODE_IMP}, [0xD8] = {OP_CLD, MODE_IMP}, [0xF8] = {OP_SED, MODE_IMP}, [0xEA] = {OP_NOP, MODE_IMP},
+
+    [0x10] = {OP_BPL, MODE_REL}, [0x30] = {OP_BMI, MODE_REL}, [0x50] = {OP_BVC, MODE_REL}, [0x70] = {OP_BVS, MODE_REL},
+    [0x90] = {OP_BCC, MODE_REL}, [0xB0] = {OP_BCS, MODE_REL}, [0xD0] = {OP_BNE, MODE_REL}, [0xF0] = {OP_BEQ, MODE_REL},
+    [0x4C] = {OP_JMP, MODE_ABS}, [0x20] = {OP_JSR, MODE_ABS}, [0x60] = {OP_RTS, MODE_IMP},
+    [0x48] = {OP_PHA, MODE_IMP}, [0x08] = {OP_PHP, MODE_IMP}, [0x68] = {OP_PLA, MODE_IMP},
+};
+
+static const uint8_t instruction_length[] = { 1, 2, 2, 2, 2, 3, 3, 3, 2 };
+
+static const lockstep_u16 lane_bit = {
+    0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+    0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000,
+};
+
+// Lane masks: 0xFF (or 0xFFFF, ...) in the selected lanes, 0 in the others
+
+static inline lockstep_u8 mask_from_bits(uint32_t bits){
+    lockstep_u16 m = (lockstep_u16)((lane_bit & (uint16_t)bits) != 0);
+    return __builtin_convertvector(m, lockstep_u8);
+}
+
+static inline uint32_t bits_from_mask(lockstep_u8 m){
+#ifdef __x86_64__
+    __m128i v;
+    memcpy(&v, &m, sizeof(v));
+    return (uint32_t)_mm_movemask_epi8(v);
+#else
+    uint32_t bits = 0;
+    for(int i = 0; i < LOCKSTEP_LANES; i++) bits |= (uint32_t)(m[i] >> 7) << i;
+    return bits;
+#endif
+}
+
+static inline lockstep_u8 blend(lockstep_u8 m, lockstep_u8 new, lockstep_u8 old){
+    return (new & m) | (old & ~m);
+}
+
+// Sets N and Z from "r".
+static inline lockstep_u8 set_nz(lockstep_u8 p, lockstep_u8 r){
+    return (p & (uint8_t)~(N | Z)) | (r & N) | ((lockstep_u8)(r == 0) & Z);
+}
+
+// ADC, and SBC with the operand already negated. The overflow flag is the one ADC() computes: set
+// when both operands or the result have bit 7 set.
+static inline void add(lockstep_u8 *a, lockstep_u8 *p, lockstep_u8 m){
+    lockstep_u16 r = __builtin_convertvector(*a, lockstep_u16) + __builtin_convertvector(m, lockstep_u16)
+        + __builtin_convertvector(*p & C, lockstep_u16);
+    lockstep_u8 result = __builtin_convertvector(r, lockstep_u8);
+    lockstep_u8 overflow = (((*a & m) | result) & 0x80) >> 1;
+    *p = set_nz(*p & (uint8_t)~(C | V), result) | __builtin_convertvector(r >> 8, lockstep_u8) | overflow;
+    *a = result;
+}
+
+static inline lockstep_u8 compare(lockstep_u8 p, lockstep_u8 reg, lockstep_u8 m){
+    return set_nz(p & (uint8_t)~C, reg - m) | ((lockstep_u8)(reg >= m) & C);
+}
+
+static inline uint8_t lane_read(nes_system *nes, uint16_t addr){
+    return addr < 0x2000 ? nes->ram[addr & 0x07FF] : mapper_prg_read(&(nes->inserted_cart), addr);
+}
+
+// Works out how many cycles lane "i" can run before its next event is due.
+static void lane_schedule(lockstep_group *g, int i){
+    nes_system *nes = g->nes[i];
+    uint64_t next = scheduler_next_time(&(nes->events));
+    uint64_t divider = nes->timing->cpu_divider;
+
+    // The event is due once an instruction ends at or after it
+    uint64_t limit = next <= nes->master_clock ? 0 : (next - nes->master_clock + divider - 1) / divider;
+    g->limit[i] = limit > UINT32_MAX ? UINT32_MAX : (uint32_t)limit;
+}
+
+// Copies the registers of lane "i" into the vectors.
+static void lane_load(lockstep_group *g, int i){
+    nes_system *nes = g->nes[i];
+    g->a[i] = nes->cpu.a;
+    g->x[i] = nes->cpu.x;
+    g->y[i] = nes->cpu.y;
+    g->stkp[i] = nes->cpu.stkp;
+    g->status[i] = nes->cpu.status;
+    g->pc[i] = nes->cpu.pc;
+    g->cycles[i] = 0;
+    g->instructions[i] = 0;
+    for(int slot = 0; slot < 4; slot++){
+        g->bank[slot][i] = (uint32_t)(nes->inserted_cart.prg_page[slot] - nes->inserted_cart.prg);
+    }
+
+    uint32_t bit = 1u << i;
+    g->busy = (nes->cpu.cycles || nes->cpu.stall) ? g->busy | bit : g->busy & ~bit;
+    g->irq = nes->irq_lines ? g->irq | bit : g->irq & ~bit;
+}
+
+// Writes the registers and the time run on the vectors back to the instance.
+static void lane_store(lockstep_group *g, int i){
+    nes_system *nes = g->nes[i];
+    nes->cpu.a = g->a[i];
+    nes->cpu.x = g->x[i];
+    nes->cpu.y = g->y[i];
+    nes->cpu.stkp = g->stkp[i];
+    nes->cpu.status = g->status[i];
+    nes->cpu.pc = g->pc[i];
+    nes->cpu.clock_count += g->cycles[i];
+    nes->cpu.instruction_count += g->instructions[i];
+    nes->master_clock += (uint64_t)g->cycles[i] * nes->timing->cpu_divider;
+    g->cycles[i] = 0;
+    g->instructions[i] = 0;
+}
+
+// Runs the next instruction of lane "i" (or its pending interrupt or stall) through cpu_step().
+static void lane_step(lockstep_group *g, int i){
+    nes_system *nes = g->nes[i];
+    lane_store(g, i);
+    nes->master_clock += cpu_step(nes) * nes->timing->cpu_divider;
+    g->scalar_steps++;
+    lane_load(g, i);
+    lane_schedule(g, i);
+}
+
+// Runs lane "i" alone, as system_run_frame() would, until its PC reaches "other" (where another lane
+// waits) or its next event is due.
+static void lane_run(lockstep_group *g, int i, uint16_t other){
+    nes_system *nes = g->nes[i];
+    lane_store(g, i);
+    do{
+        nes->master_clock += cpu_step(nes) * nes->timing->cpu_divider;
+        g->scalar_steps++;
+    }while(nes->cpu.pc < other && nes->master_clock < scheduler_next_time(&(nes->events)));
+    lane_load(g, i);
+    lane_schedule(g, i);
+}
+
+// Handles the events due on lane "i", which leaves the group if its frame is done.
+static void lane_dispatch(lockstep_group *g, int i){
+    nes_system *nes = g->nes[i];
+    lane_store(g, i);
+    system_dispatch_events(nes);
+    if(nes->ppu.frame_complete){
+        nes->ppu.frame_complete = 0;
+        g->live &= ~(1u << i);
+        return;
+    }
+    lane_load(g, i);
+    lane_schedule(g, i);
+}
+
+// Runs the instruction at "pc" on "lanes" with the vectors. Returns 0, without changing anything, if
+// it has to take the scalar path instead.
+static int lockstep_execute(lockstep_group *g, uint32_t lanes, uint16_t pc){
+    // Code in rom only, not straddling two banks, and the same bank for every lane
+    if(pc < 0x8000 || (pc & 0x1FFF) > 0x1FFD) return 0;
+    int slot = (pc >> 13) & 0x03;
+    int lead = __builtin_ctz(lanes);
+    lockstep_u32 same = (lockstep_u32)(g->bank[slot] == g->bank[slot][lead]);
+    if((bits_from_mask(__builtin_convertvector(same, lockstep_u8)) & lanes) != lanes) return 0;
+
+    const uint8_t *code = g->nes[lead]->inserted_cart.prg_page[slot] + (pc & 0x1FFF);
+    uint8_t opcode = code[0];
+    enum LANE_OP op = decode[opcode].op;
+    enum LANE_MODE mode = decode[opcode].mode;
+    if(op == OP_NONE) return 0;
+
+    uint16_t operand = code[1] | (code[2] << 8);
+    lockstep_u8 a = g->a, x = g->x, y = g->y, s = g->stkp, p = g->status;
+    lockstep_u16 next_pc = (lockstep_u16){} + (uint16_t)(pc + instruction_length[mode]);
+    lockstep_u16 addr = {};
+    lockstep_u8 cross = {};         // 1 where indexing crossed a page
+    lockstep_u8 extra = {};         // Cycles on top of the base count
+    switch(mode){
+    case MODE_ZP0:
+        addr += code[1];
+        break;
+    case MODE_ZPX:
+        addr = __builtin_convertvector(x + code[1], lockstep_u16);
+        break;
+    case MODE_ZPY:
+        addr = __builtin_convertvector(y + code[1], lockstep_u16);
+        break;
+    case MODE_ABS:
+        addr += operand;
+        break;
+    case MODE_ABX:
+    case MODE_ABY:
+        addr = __builtin_convertvector(mode == MODE_ABX ? x : y, lockstep_u16) + operand;
+        cross = __builtin_convertvector((addr & 0xFF00) != (operand & 0xFF00), lockstep_u8) & 1;
+        break;
+    default:
+        break;
+    }
+
+    // Operand: memory is only RAM or rom here, and only RAM is written
+    int memory = mode >= MODE_ZP0 && mode <= MODE_ABY && op != OP_JMP && op != OP_JSR;
+    int writes = memory && (op == OP_STA || op == OP_STX || op == OP_STY || (op >= OP_INC && op <= OP_ROR));
+    int reads = memory && op != OP_STA && op != OP_STX && op != OP_STY;
+    lockstep_u8 m = a;
+    if(mode == MODE_IMM) m = (lockstep_u8){} + code[1];
+    for(uint32_t rest = lanes; memory && rest; rest &= rest - 1){
+        int i = __builtin_ctz(rest);
+        if(addr[i] >= 0x2000 && (writes || addr[i] < 0x8000)) return 0;
+        if(reads) m[i] = lane_read(g->nes[i], addr[i]);
+    }
+
+    lockstep_u8 r = {};             // Result of the read-modify-write instructions
+    switch(op){
+    case OP_LDA: a = m; p = set_nz(p, m); extra = cross; break;
+    case OP_LDX: x = m; p = set_nz(p, m); extra = cross; break;
+    case OP_LDY: y = m; p = set_nz(p, m); extra = cross; break;
+    case OP_STA: r = a; break;
+    case OP_STX: r = x; break;
+    case OP_STY: r = y; break;
+
+    case OP_ADC: add(&a, &p, m); extra = cross; break;
+    case OP_SBC: add(&a, &p, (m ^ 0xFF) + 1); extra = cross; break;
+    case OP_AND: a &= m; p = set_nz(p, a); extra = cross; break;
+    case OP_ORA: a |= m; p = set_nz(p, a); extra = cross; break;
+    case OP_EOR: a ^= m; p = set_nz(p, a); extra = cross; break;
+    case OP_CMP: p = compare(p, a, m); extra = cross; break;
+    case OP_CPX: p = compare(p, x, m); break;
+    case OP_CPY: p = compare(p, y, m); break;
+    case OP_BIT:
+        p = (p & (uint8_t)~(N | V | Z)) | (m & (N | V)) | ((lockstep_u8)((a & m) == 0) & Z);
+        break;
+
+    // Flags exactly as the scalar versions set them: ASL takes Z from the unshifted value, LSR always
+    // clears C
+    case OP_INC: r = m + 1; p = set_nz(p, r); break;
+    case OP_DEC: r = m - 1; p = set_nz(p, r); break;
+    case OP_ASL:
+        r = m << 1;
+        p = (p & (uint8_t)~(N | Z | C)) | (r & N) | ((lockstep_u8)(m == 0) & Z) | (m >> 7);
+        break;
+    case OP_LSR:
+        r = m >> 1;
+        p = set_nz(p & (uint8_t)~C, r);
+        break;
+    case OP_ROL:
+        r = (m << 1) | (p & C);
+        p = set_nz(p & (uint8_t)~C, r) | (m >> 7);
+        break;
+    case OP_ROR:
+        r = (m >> 1) | ((p & C) << 7);
+        p = set_nz(p & (uint8_t)~C, r) | (m & 1);
+        break;
+
+    case OP_INX: x += 1; p = set_nz(p, x); break;
+    case OP_INY: y += 1; p = set_nz(p, y); break;
+    case OP_DEX: x -= 1; p = set_nz(p, x); break;
+    case OP_DEY: y -= 1; p = set_nz(p, y); break;
+    case OP_TAX: x = a; p = set_nz(p, a); break;
+    case OP_TAY: y = a; p = set_nz(p, a); break;
+    case OP_TXA: a = x; p = set_nz(p, x); break;
+    case OP_TYA: a = y; p = set_nz(p, y); break;
+    case OP_TSX: x = s; p = set_nz(p, s); break;
+    case OP_TXS: s = x; p = set_nz(p, x); break;
+    case OP_CLC: p &= (uint8_t)~C; break;
+    case OP_SEC: p |= C; break;
+    case OP_CLI: p &= (uint8_t)~I; break;
+    case OP_SEI: p |= I; break;
+    case OP_CLV: p &= (uint8_t)~V; break;
+    case OP_CLD: p &= (uint8_t)~D; break;
+    case OP_SED: p |= D; break;
+    case OP_NOP: break;
+
+    case OP_BPL: case OP_BMI: case OP_BVC: case OP_BVS:
+    case OP_BCC: case OP_BCS: case OP_BNE: case OP_BEQ:{
+        static const uint8_t flag[] = { N, N, V, V, C, C, Z, Z };
+        int index = op - OP_BPL;
+        lockstep_u8 taken = (lockstep_u8)((p & flag[index]) != 0);
+        if(!(index & 1)) taken = ~taken;
+
+        // Taken branches cost a cycle, two when they land on another page
+        uint16_t from = pc + 2;
+        uint16_t to = from + (int8_t)code[1];
+        lockstep_u16 jump = __builtin_convertvector((int8_t __attribute__((vector_size(LOCKSTEP_LANES))))taken, lockstep_u16);
+        next_pc = (next_pc & ~jump) | (to & jump);
+        extra = taken & (uint8_t)(((from ^ to) & 0xFF00) ? 2 : 1);
+        break;
+    }
+
+    // JSR pushes the address after its operand and RTS returns there, as cpu_step() does
+    case OP_JMP:
+        next_pc = (lockstep_u16){} + operand;
+        break;
+    case OP_JSR:
+        for(uint32_t rest = lanes; rest; rest &= rest - 1){
+            int i = __builtin_ctz(rest);
+            uint8_t *ram = g->nes[i]->ram;
+            ram[0x100 + s[i]] = (uint16_t)(pc + 3) >> 8;
+            ram[0x100 + (uint8_t)(s[i] - 1)] = (uint16_t)(pc + 3) & 0xFF;
+        }
+        s -= 2;
+        next_pc = (lockstep_u16){} + operand;
+        break;
+    case OP_RTS:
+        for(uint32_t rest = lanes; rest; rest &= rest - 1){
+            int i = __builtin_ctz(rest);
+            const uint8_t *ram = g->nes[i]->ram;
+            next_pc[i] = ram[0x100 + (uint8_t)(s[i] + 1)] | (ram[0x100 + (uint8_t)(s[i] + 2)] << 8);
+        }
+        s += 2;
+        break;
+    case OP_PHA:
+    case OP_PHP:
+        for(uint32_t rest = lanes; rest; rest &= rest - 1){
+            int i = __builtin_ctz(rest);
+            g->nes[i]->ram[0x100 + s[i]] = op == OP_PHA ? a[i] : p[i];
+        }
+        s -= 1;
+        break;
+    case OP_PLA:
+        s += 1;
+        for(uint32_t rest = lanes; rest; rest &= rest - 1){
+            int i = __builtin_ctz(rest);
+            a[i] = g->nes[i]->ram[0x100 + s[i]];
+        }
+        p = set_nz(p, a);
+        break;
+    default:
+        return 0;
+    }
+
+    if(writes){
+        for(uint32_t rest = lanes; rest; rest &= rest - 1){
+            int i = __builtin_ctz(rest);
+            g->nes[i]->ram[addr[i] & 0x07FF] = r[i];
+        }
+    }else if(mode == MODE_IMP && op >= OP_ASL && op <= OP_ROR){
+        a = r;
+    }
+
+    lockstep_u8 sel = mask_from_bits(lanes);
+    lockstep_u16 sel16 = __builtin_convertvector((int8_t __attribute__((vector_size(LOCKSTEP_LANES))))sel, lockstep_u16);
+    g->a = blend(sel, a, g->a);
+    g->x = blend(sel, x, g->x);
+    g->y = blend(sel, y, g->y);
+    g->stkp = blend(sel, s, g->stkp);
+    g->status = blend(sel, p, g->status);
+    g->pc = (next_pc & sel16) | (g->pc & ~sel16);
+
+    lockstep_u8 cycles = (extra + cpu_opcode_cycles(opcode)) & sel;
+    g->cycles += __builtin_convertvector(cycles, lockstep_u32);
+    g->instructions += __builtin_convertvector(sel & 1, lockstep_u32);
+    g->vector_instructions += __builtin_popcount(lanes);
+    g->vector_steps++;
+    return 1;
+}
+
+int lockstep_init(lockstep_group *group, nes_system **nes, int count){
+    if(count < 1 || count > LOCKSTEP_LANES) return -1;
+    memset(group, 0, sizeof(*group));
+    for(int i = 0; i < count; i++) group->nes[i] = nes[i];
+    group->count = count;
+    return 0;
+}
+
+void lockstep_run_frame(lockstep_group *g){
+    g->live = (1u << g->count) - 1;
+    g->busy = g->irq = 0;
+    for(int i = 0; i < g->count; i++){
+        lane_load(g, i);
+        lane_schedule(g, i);
+    }
+
+    while(g->live){
+        // Events, then interrupts and stalls, exactly where system_run_frame() would handle them
+        lockstep_u8 due = __builtin_convertvector((lockstep_u32)(g->cycles >= g->limit), lockstep_u8);
+        uint32_t lanes = g->live & bits_from_mask(due);
+        if(lanes){
+            for(; lanes; lanes &= lanes - 1) lane_dispatch(g, __builtin_ctz(lanes));
+            continue;
+        }
+        lanes = g->live & g->busy;
+        for(uint32_t rest = g->live & g->irq; rest; rest &= rest - 1){
+            int i = __builtin_ctz(rest);
+            if(!(g->status[i] & I)) lanes |= 1u << i;
+        }
+        if(lanes){
+            for(; lanes; lanes &= lanes - 1) lane_step(g, __builtin_ctz(lanes));
+            continue;
+        }
+
+        // The lanes at the lowest PC go next, the others wait for them
+        uint16_t pc = UINT16_MAX, other = UINT16_MAX;
+        for(uint32_t rest = g->live; rest; rest &= rest - 1){
+            uint16_t lane_pc = g->pc[__builtin_ctz(rest)];
+            if(lane_pc < pc){
+                other = pc;
+                pc = lane_pc;
+            }else if(lane_pc != pc && lane_pc < other){
+                other = lane_pc;
+            }
+        }
+        lockstep_u8 at_pc = __builtin_convertvector((lockstep_u16)(g->pc == pc), lockstep_u8);
+        lanes = g->live & bits_from_mask(at_pc);
+        if((lanes & (lanes - 1)) == 0){
+            lane_run(g, __builtin_ctz(lanes), other);
+        }else if(!lockstep_execute(g, lanes, pc)){
+            for(; lanes; lanes &= lanes - 1) lane_step(g, __builtin_ctz(lanes));
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef _LOCKSTEP_H_
+#define _LOCKSTEP_H_
+#include <stdint.h>
+#include "bus.h"
+
+// Experimental lockstep runner: up to LOCKSTEP_LANES instances of the same rom run their frames
+// together, with the CPU registers of all of them kept structure-of-arrays in vectors. Whenever
+// several instances are about to run the instruction at the same address (of the same bank), it is
+// decoded once and run for all of them with vector operations; only their RAM and rom accesses are
+// done one instance at a time.
+//
+// Everything else goes through the normal scalar path (cpu_step()), one instance at a time: I/O and
+// mapper accesses, indirect addressing, interrupts, DMA stalls and code running from RAM. The lowest
+// PC runs first, so instances that took different sides of a branch or ran a loop a different number
+// of times wait for each other where the paths join again; an instance left alone at the lowest PC is
+// peeled off and runs scalar until it reaches the PC of another one. Events are dispatched for each
+// instance exactly when system_run_frame() would, so the result is the same state as running the
+// instances one after the other.
+//
+// The performance counters only see the instructions that took the scalar path.
+
+#define LOCKSTEP_LANES 16                   // A byte per lane fills a 128 bit vector
+
+typedef uint8_t lockstep_u8 __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef uint16_t lockstep_u16 __attribute__((vector_size(2 * LOCKSTEP_LANES)));
+typedef uint32_t lockstep_u32 __attribute__((vector_size(4 * LOCKSTEP_LANES)));
+
+typedef struct lockstep_group{
+    nes_system *nes[LOCKSTEP_LANES];
+    int count;
+
+    // Registers of every lane while a frame runs, the copies in "nes[i]->cpu" are stale until the
+    // lane is written back
+    lockstep_u8 a, x, y, stkp, status;
+    lockstep_u16 pc;
+    lockstep_u32 cycles;                // CPU cycles run since the lane was loaded
+    lockstep_u32 limit;                 // The next event of the lane is due after this many
+    lockstep_u32 instructions;          // Since the lane was loaded
+    lockstep_u32 bank[4];               // Rom offset of the PRG banks at $8000, $A000, $C000 and $E000
+
+    uint32_t live;                      // Lanes still running the current frame, one bit each
+    uint32_t busy;                      // Lanes with cycles left from an interrupt or a DMA stall
+    uint32_t irq;                       // Lanes with an IRQ line asserted
+
+    // Since lockstep_init()
+    uint64_t vector_instructions;       // Run on the vectors, summed over the lanes
+    uint64_t vector_steps;              // Instructions decoded for the vectors, each for 2 lanes or more
+    uint64_t scalar_steps;              // cpu_step() calls
+} lockstep_group;
+
+// Groups "count" (at most LOCKSTEP_LANES) initialized instances running the same rom. They must not be
+// run through anything else while a frame of the group runs. Returns 0, or -1 if "count" is too large.
+int lockstep_init(lockstep_group *group, nes_system **nes, int count);
+
+// Runs every instance of the group until its PPU finishes the current frame.
+void lockstep_run_frame(lockstep_group *group);
+
+#endif
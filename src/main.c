@@ -1,63 +1,216 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "bus.h"
 #include "cpu.h"
 #include "ppu_2C02.h"
 #include "cartridge.h"
+#include "triple_buffer.h"
+#include "pacer.h"
+#include "rom_index.h"
+#include "audio.h"
+#include "resampler.h"
+#include "controller.h"
+#include "input_queue.h"
 #include <rendering.h>
 
 #include <SDL2/SDL.h>
 
+#define WINDOW_SCALE 2
+#define AUDIO_LATENCY_MS 20
+#define LATENCY_TEST_FRAMES 30      // NES_LATENCY_TEST=1 toggles A this often, to measure input to display latency
+#define AUDIO_OVERSAMPLING 2        // The APU generates at this multiple of the device rate, the resampler takes it down
+
+// Emulation runs on its own thread and hands finished frames to the main thread, which owns the
+// window (SDL wants video calls on the thread that created it) and presents with vsync.
+
+typedef struct latency_stats{
+    uint64_t frames;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} latency_stats;
+
+static nes_system nes;
+static triple_buffer frames;
+static atomic_int running = 1;
+static latency_stats emulation_latency;     // Time to emulate one frame, only touched by the emulation thread
+static frame_pacer pacer;                   // Emulation thread only
+static audio_output audio;                  // Produced by the emulation thread, consumed by SDL's audio thread
+static resampler audio_resampler;           // Emulation thread only
+static input_queue input;                   // Produced by the main thread, drained by the game's strobe
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void latency_add(latency_stats *stats, uint64_t ns){
+    stats->frames++;
+    stats->total_ns += ns;
+    if(ns > stats->max_ns) stats->max_ns = ns;
+}
+
+static void latency_print(const char *name, const latency_stats *stats){
+    if(stats->frames == 0) return;
+    printf("%-24s avg %8.3f ms  max %8.3f ms  (%llu frames)\n", name,
+        stats->total_ns / 1e6 / stats->frames, stats->max_ns / 1e6, (unsigned long long)stats->frames);
+}
+
+// Keyboard layout of controller 1
+static uint8_t key_button(SDL_Keycode key){
+    switch(key){
+    case SDLK_x:        return BUTTON_A;
+    case SDLK_z:        return BUTTON_B;
+    case SDLK_RSHIFT:   return BUTTON_SELECT;
+    case SDLK_RETURN:   return BUTTON_START;
+    case SDLK_UP:       return BUTTON_UP;
+    case SDLK_DOWN:     return BUTTON_DOWN;
+    case SDLK_LEFT:     return BUTTON_LEFT;
+    case SDLK_RIGHT:    return BUTTON_RIGHT;
+    default:            return 0;
+    }
+}
+
+static void push_buttons(uint8_t buttons){
+    input_event event = { now_ns(), 0, buttons };
+    input_queue_push(&input, &event);
+}
+
+static void *emulation_thread(void *arg){
+    uint64_t frame_number = 0;
+    static int16_t samples[BLIP_CAPACITY];
+    static int16_t resampled[BLIP_CAPACITY];
+    frame *back = triple_buffer_back(&frames);
+    nes.ppu.screen = back->screen;
+    pacer_init(&pacer, nes.timing->frame_rate);
+
+    while(atomic_load_explicit(&running, memory_order_relaxed)){
+        PERF_POLL();
+
+        uint64_t start = now_ns();
+        system_run_frame(&nes);
+        back->completed_ns = now_ns();
+        back->frame_number = frame_number++;
+        back->input_ns = controller_take_input_time(&nes);
+        latency_add(&emulation_latency, back->completed_ns - start);
+
+        // The next frame is resampled at the rate that keeps the audio ring near its target
+        uint32_t count = blip_read_samples(&(nes.apu.blip), samples, BLIP_CAPACITY);
+        if(audio.device){
+            count = resampler_process(&audio_resampler, samples, count, resampled, BLIP_CAPACITY);
+            resampler_set_rates(&audio_resampler, nes.apu.sample_rate, audio_push(&audio, resampled, count));
+        }
+
+        back = triple_buffer_publish(&frames);
+        nes.ppu.screen = back->screen;
+
+        // Runs at the speed of the real console, sleeping the rest of the frame
+        pacer_wait(&pacer);
+    }
+    return NULL;
+}
 
 int main(int argc, char *argv[]){
-    nes_system nes;
-    cartridge_load(&nes, argv[1]);
+    if(argc < 2){
+        fprintf(stderr, "usage: %s rom.nes\n", argv[0]);
+        return 1;
+    }
+
+    // Header fixes for known roms, found through the library index without reading the rom. They
+    // go in before the mapper is picked, so a bad dump with a wrong mapper number still loads.
+    const char *index_path = getenv("NES_ROM_INDEX");
+    rom_index index;
+    cartridge_fix fix = {0};
+    if(index_path && rom_index_open(&index, index_path) == 0){
+        const rom_index_entry *entry = rom_index_find(&index, argv[1]);
+        int bad_header = entry && (entry->flags & ROM_INDEX_BAD_HEADER);
+        if(entry) rom_index_fix(entry, &fix);
+        rom_index_close(&index);
+        if(bad_header){
+            fprintf(stderr, "%s: the rom index has this header as unreadable\n", argv[1]);
+            return 1;
+        }
+    }
+    if(cartridge_init(&(nes.inserted_cart), argv[1], &fix) != 0) return 1;
     system_init(&nes);
-    // for(int i = 0; i < nes.inserted_cart.header.chr_rom_chunks* 8192; i++){
-    //     printf("%x \n", *(nes.inserted_cart.chr+i));
-    // }
-    if(SDL_Init(!SDL_INIT_VIDEO)) SDL_Log("Can't init %s", SDL_GetError());
+    input_queue_init(&input);
+    controller_attach_queue(&nes, &input);
+#ifdef NES_PERF_COUNTERS
+    perf_install_dump(&(nes.perf), getenv("NES_PERF_OUT"));
+#endif
+    if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) SDL_Log("Can't init %s", SDL_GetError());
 
-    SDL_Window * window = SDL_CreateWindow("Uhul", 100, 100, 600, 500, 0);
+    // Runs without sound if there is no audio device. NES_AUDIO_QUALITY picks the resampler, 0 to 2.
+    if(audio_init(&audio, APU_SAMPLE_RATE, AUDIO_LATENCY_MS) == 0){
+        const char *quality = getenv("NES_AUDIO_QUALITY");
+        int q = quality ? atoi(quality) : RESAMPLER_MEDIUM;
+        if(q < 0 || q >= RESAMPLER_QUALITIES) q = RESAMPLER_MEDIUM;
+        apu_set_sample_rate(&nes, audio.sample_rate * AUDIO_OVERSAMPLING);
+        if(resampler_init(&audio_resampler, nes.apu.sample_rate, audio.sample_rate, q) != 0) audio_destroy(&audio);
+    }
+
+    display disp;
+    if(display_init(&disp, "Uhul", WINDOW_SCALE) != 0) return 1;
     SDL_Event event;
 
-    
-    SDL_Surface *screen;
+    triple_buffer_init(&frames);
+    pthread_t emulation;
+    if(pthread_create(&emulation, NULL, emulation_thread, NULL) != 0){
+        perror("pthread_create");
+        return 1;
+    }
 
-    screen = SDL_GetWindowSurface(window);
+    latency_stats present_latency = {0};    // From the end of emulation to the frame being on screen
+    latency_stats input_latency = {0};      // From the host seeing the input to the frame the game read it in being on screen
+    const char *latency_test = getenv("NES_LATENCY_TEST");
+    int test_input = latency_test && atoi(latency_test);
+    uint64_t presented = 0;
+    uint8_t buttons = 0;
+    while(atomic_load_explicit(&running, memory_order_relaxed)){
+        while(SDL_PollEvent(&event)){
+            if(event.type == SDL_QUIT) atomic_store(&running, 0);
+            if((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && !event.key.repeat){
+                uint8_t button = key_button(event.key.keysym.sym);
+                if(button == 0) continue;
+                buttons = event.type == SDL_KEYDOWN ? buttons | button : buttons & ~button;
+                push_buttons(buttons);
+            }
+        }
 
-    uint32_t test[100][200];
+        frame *latest = triple_buffer_acquire(&frames);
+        if(latest == NULL){
+            // Nothing new yet, present() would block on vsync anyway so just yield briefly
+            SDL_Delay(1);
+            continue;
+        }
+        display_present(&disp, (const uint32_t (*)[DISPLAY_WIDTH])latest->screen);
+        uint64_t shown = now_ns();
+        latency_add(&present_latency, shown - latest->completed_ns);
+        if(latest->input_ns) latency_add(&input_latency, shown - latest->input_ns);
 
-    for (uint32_t i = 0; i < 100 ;i++){
-        for (uint32_t j = 0; j < 200; j++){
-            test[i][j] = i < 50 ? 0xFFFF0000 : 0xFFFFFFFF;
-            
+        // Synthetic presses, timed like keyboard events
+        if(test_input && ++presented % LATENCY_TEST_FRAMES == 0){
+            buttons ^= BUTTON_A;
+            push_buttons(buttons);
         }
     }
 
-    nes.ppu.palletes[0] = 0x21;
-    nes.ppu.palletes[1] = 0x19;
-    nes.ppu.palletes[2] = 0x16;
-    nes.ppu.palletes[3] = 0x30;
-    get_pattern_table(&nes, 0, 0);
-    get_pattern_table(&nes, 1, 0);
-    // printf("%x\n", nes.ppu.px_pattern_table[0][1][16]);
-    while(1){
-        
-        SDL_PollEvent(&event);
-        if(event.type == SDL_QUIT) break;
-
-        system_clock(&nes);
-
-
-        get_pattern_table(&nes, 0, 0);
-        get_pattern_table(&nes, 1, 0);
-        
-        draw_element(screen, 400, 400, 200, 100, test);
-        draw_element(screen, 0, 0, 128, 128, nes.ppu.px_pattern_table[0]);
-        draw_element(screen, 128, 0, 128, 128, nes.ppu.px_pattern_table[1]);
-        SDL_UpdateWindowSurface( window );
-        // printf("%x\n", *(uint32_t *)screen->pixels);
-    }
+    pthread_join(emulation, NULL);
+    latency_print("emulation per frame", &emulation_latency);
+    latency_print("emulation to display", &present_latency);
+    latency_print("input to display", &input_latency);
+    pacer_print_stats(&pacer);
+    printf("%-24s %llu\n", "frames dropped", (unsigned long long)atomic_load(&(frames.dropped)));
+    audio_print_stats(&audio);
+
+    audio_destroy(&audio);
+    resampler_free(&audio_resampler);
+    display_destroy(&disp);
+    SDL_Quit();
+    cartridge_free(&(nes.inserted_cart));
     return 0;
-}
\ No newline at end of file
+}
@@ -1,22 +1,80 @@
 #include <mappers.h>
 #include "cartridge.h"
+#include "bus.h"
 #include <stdlib.h>
 
+// Bank switching helpers for the mapper implementations. Bank numbers wrap around the size of
+// the rom, the way boards ignore the address lines they don't have.
+
+static void map_prg_8k(cartridge *cart, int slot, unsigned bank){
+    size_t banks = cart->prg_size >> 13;
+    cart->prg_page[slot] = cart->prg + ((bank % banks) << 13);
+}
+
+static void map_prg_16k(cartridge *cart, int slot, unsigned bank){
+    map_prg_8k(cart, slot * 2, bank * 2);
+    map_prg_8k(cart, slot * 2 + 1, bank * 2 + 1);
+}
+
+static void map_prg_32k(cartridge *cart, unsigned bank){
+    map_prg_16k(cart, 0, bank * 2);
+    map_prg_16k(cart, 1, bank * 2 + 1);
+}
+
+static void map_chr_1k(cartridge *cart, int slot, unsigned bank){
+    size_t banks = (cart->chr_writable ? cart->chr_ram_size : cart->chr_size) >> 10;
+    cart->chr_page[slot] = cart->chr + ((bank % banks) << 10);
+}
+
+static void map_chr_4k(cartridge *cart, int slot, unsigned bank){
+    for(int i = 0; i < 4; i++) map_chr_1k(cart, slot * 4 + i, bank * 4 + i);
+}
+
+static void map_chr_8k(cartridge *cart, unsigned bank){
+    for(int i = 0; i < 8; i++) map_chr_1k(cart, i, bank * 8 + i);
+}
+
+// Mirroring controlled by the mapper. Four-screen boards have it hardwired.
+static void set_mirror(nes_system *nes, enum MIRROR mirror){
+    if(nes->inserted_cart.mirror == FOUR_SCREEN || nes->inserted_cart.mirror == mirror) return;
+    nes->inserted_cart.mirror = mirror;
+    ppu_update_mirroring(nes);
+}
+
 #include "mappers/mapper_000.c"
+#include "mappers/mapper_001.c"
+#include "mappers/mapper_002.c"
+#include "mappers/mapper_003.c"
+#include "mappers/mapper_004.c"
+#include "mappers/mapper_007.c"
 
-void assign_mapper(cartridge * cart){
+int assign_mapper(cartridge * cart){
     switch (cart->mapper_id)
     {
     case 0x00:
-        cart->mapper_f = &mapper_000;
+        cart->mapper = &mapper_000;
+        break;
+    case 0x01:
+        cart->mapper = &mapper_001;
+        break;
+    case 0x02:
+        cart->mapper = &mapper_002;
+        break;
+    case 0x03:
+        cart->mapper = &mapper_003;
+        break;
+    case 0x04:
+        cart->mapper = &mapper_004;
+        break;
+    case 0x07:
+        cart->mapper = &mapper_007;
         break;
     
     default:
-        cart->mapper_f = NULL;
-        break;
+        cart->mapper = NULL;
+        return -1;
     }
-}
 
-uint16_t map_address(cartridge *cart, uint16_t addr){
-    return cart->mapper_f(addr, cart->header.prg_rom_chunks, cart->header.chr_rom_chunks);
-}
\ No newline at end of file
+    cart->mapper->reset(cart);
+    return 0;
+}
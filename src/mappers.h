@@ -2,9 +2,42 @@
 #define _MAPPERS_H_
 #include "cartridge.h"
 
+// A mapper decides which parts of PRG and CHR the CPU and PPU see. Its state lives in the cartridge
+// ("regs"), and the visible banks are kept in "prg_page"/"chr_page", so reads never go through the
+// mapper: they are a table lookup that only changes when a register write switches banks.
+typedef struct mapper_interface{
+    const char *name;
 
-void assign_mapper(cartridge * cart);
+    // Puts the registers and banks in their power-on state.
+    void (*reset)(cartridge *cart);
 
-uint16_t map_address(cartridge *cart, uint16_t addr);
+    // CPU write to $8000-$FFFF. NULL for boards without registers. The PPU is caught up before the call,
+    // so bank and mirroring switches take effect at the right dot.
+    void (*write)(nes_system *nes, uint16_t addr, uint8_t data);
+
+    // Mappers that watch the PPU address bus (scanline counters) account for the rendering done so far and
+    // schedule EVENT_MAPPER_IRQ from the PPU A12 prediction. Called before and after anything that changes
+    // the A12 pattern, and when EVENT_MAPPER_IRQ fires. NULL for the others.
+    void (*sync)(nes_system *nes);
+} mapper_interface;
+
+// Sets up "cart->mapper" from "cart->mapper_id" and resets it. PRG and CHR must already be in place.
+// Returns 0 on success, -1 if the mapper isn't supported.
+int assign_mapper(cartridge * cart);
+
+// Lets the mapper catch up with the PPU, see "sync".
+static inline void mapper_sync(nes_system *nes){
+    if(nes->inserted_cart.mapper->sync) nes->inserted_cart.mapper->sync(nes);
+}
+
+// Byte of PRG ROM seen by the CPU at "addr" ($8000-$FFFF).
+static inline uint8_t mapper_prg_read(const cartridge *cart, uint16_t addr){
+    return cart->prg_page[(addr >> 13) & 0x03][addr & 0x1FFF];
+}
+
+// Byte of CHR seen by the PPU at "addr" ($0000-$1FFF).
+static inline uint8_t mapper_chr_read(const cartridge *cart, uint16_t addr){
+    return cart->chr_page[(addr >> 10) & 0x07][addr & 0x03FF];
+}
 
 #endif
\ No newline at end of file
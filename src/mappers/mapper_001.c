@@ -0,0 +1,95 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// MMC1 (SxROM). Registers are loaded serially: 5 writes of bit 0 to $8000-$FFFF, the address of
+// the 5th write selects the register. Writing a value with bit 7 set resets the shift register.
+// CPU $8000-$9FFF: Control  ---CPPMM  C: CHR mode (8 KB/4 KB), PP: PRG mode, MM: mirroring
+// CPU $A000-$BFFF: CHR bank 0
+// CPU $C000-$DFFF: CHR bank 1 (4 KB mode only)
+// CPU $E000-$FFFF: PRG bank (16 KB)
+static void mapper_001_update(cartridge *cart){
+    mmc1_state *mmc1 = &(cart->regs.mmc1);
+
+    switch((mmc1->control >> 2) & 0x03){
+    case 0:
+    case 1:                                     // 32 KB, low bit of the bank ignored
+        map_prg_32k(cart, (mmc1->prg_bank & 0x0F) >> 1);
+        break;
+    case 2:                                     // First bank fixed at $8000, switch $C000
+        map_prg_16k(cart, 0, 0);
+        map_prg_16k(cart, 1, mmc1->prg_bank & 0x0F);
+        break;
+    case 3:                                     // Switch $8000, last bank fixed at $C000
+        map_prg_16k(cart, 0, mmc1->prg_bank & 0x0F);
+        map_prg_16k(cart, 1, (cart->prg_size >> 14) - 1);
+        break;
+    }
+
+    if(mmc1->control & 0x10){                   // Two 4 KB banks
+        map_chr_4k(cart, 0, mmc1->chr_bank[0]);
+        map_chr_4k(cart, 1, mmc1->chr_bank[1]);
+    }else{                                      // One 8 KB bank, low bit ignored
+        map_chr_8k(cart, mmc1->chr_bank[0] >> 1);
+    }
+}
+
+static enum MIRROR mapper_001_mirror(const mmc1_state *mmc1){
+    static const enum MIRROR modes[4] = { ONESCREEN_LO, ONESCREEN_HI, VERTICAL, HORIZONTAL };
+    return modes[mmc1->control & 0x03];
+}
+
+static void mapper_001_reset(cartridge *cart){
+    mmc1_state *mmc1 = &(cart->regs.mmc1);
+    mmc1->shift = 0;
+    mmc1->shift_count = 0;
+    // PRG mode 3 like the hardware, mirroring as the header says until the game sets it
+    mmc1->control = 0x0C | (cart->mirror == HORIZONTAL ? 0x03 : 0x02);
+    mmc1->chr_bank[0] = 0;
+    mmc1->chr_bank[1] = 0;
+    mmc1->prg_bank = 0;
+    mmc1->last_write = UINT64_MAX;
+    mapper_001_update(cart);
+}
+
+static void mapper_001_write(nes_system *nes, uint16_t addr, uint8_t data){
+    cartridge *cart = &(nes->inserted_cart);
+    mmc1_state *mmc1 = &(cart->regs.mmc1);
+
+    // Read-modify-write instructions write twice in a row, the board only sees the first one
+    uint64_t now = nes->cpu.clock_count;
+    uint8_t consecutive = mmc1->last_write != UINT64_MAX && now - mmc1->last_write <= 1;
+    mmc1->last_write = now;
+    if(consecutive) return;
+
+    if(data & 0x80){
+        mmc1->shift = 0;
+        mmc1->shift_count = 0;
+        mmc1->control |= 0x0C;
+        mapper_001_update(cart);
+        return;
+    }
+
+    mmc1->shift |= (data & 0x01) << mmc1->shift_count;
+    if(++mmc1->shift_count < 5) return;
+
+    switch((addr >> 13) & 0x03){
+    case 0:
+        mmc1->control = mmc1->shift;
+        set_mirror(nes, mapper_001_mirror(mmc1));
+        break;
+    case 1:
+        mmc1->chr_bank[0] = mmc1->shift;
+        break;
+    case 2:
+        mmc1->chr_bank[1] = mmc1->shift;
+        break;
+    case 3:
+        mmc1->prg_bank = mmc1->shift;
+        break;
+    }
+    mmc1->shift = 0;
+    mmc1->shift_count = 0;
+    mapper_001_update(cart);
+}
+
+static const mapper_interface mapper_001 = { "MMC1", mapper_001_reset, mapper_001_write, NULL };
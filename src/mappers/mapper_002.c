@@ -0,0 +1,20 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// UxROM.
+// CPU $8000-$BFFF: 16 KB switchable bank, selected by any write to $8000-$FFFF
+// CPU $C000-$FFFF: Last 16 KB bank, fixed
+// PPU $0000-$1FFF: 8 KB, usually CHR RAM
+static void mapper_002_reset(cartridge *cart){
+    cart->regs.bank = 0;
+    map_prg_16k(cart, 0, 0);
+    map_prg_16k(cart, 1, (cart->prg_size >> 14) - 1);
+    map_chr_8k(cart, 0);
+}
+
+static void mapper_002_write(nes_system *nes, uint16_t addr, uint8_t data){
+    nes->inserted_cart.regs.bank = data;
+    map_prg_16k(&(nes->inserted_cart), 0, data);
+}
+
+static const mapper_interface mapper_002 = { "UxROM", mapper_002_reset, mapper_002_write, NULL };
@@ -0,0 +1,18 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// CNROM.
+// CPU $8000-$FFFF: 16 or 32 KB, fixed like NROM
+// PPU $0000-$1FFF: 8 KB switchable CHR bank, selected by any write to $8000-$FFFF
+static void mapper_003_reset(cartridge *cart){
+    cart->regs.bank = 0;
+    map_prg_32k(cart, 0);
+    map_chr_8k(cart, 0);
+}
+
+static void mapper_003_write(nes_system *nes, uint16_t addr, uint8_t data){
+    nes->inserted_cart.regs.bank = data;
+    map_chr_8k(&(nes->inserted_cart), data);
+}
+
+static const mapper_interface mapper_003 = { "CNROM", mapper_003_reset, mapper_003_write, NULL };
@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// MMC3 (TxROM). Registers are selected by the address range and whether it is even or odd.
+// CPU $8000 even: Bank select  CP---RRR  C: CHR A12 inversion, P: PRG mode, RRR: register for $8001
+// CPU $8001 odd:  Bank data    R0-R1 2 KB CHR, R2-R5 1 KB CHR, R6-R7 8 KB PRG
+// CPU $A000 even: Mirroring
+// CPU $A001 odd:  PRG RAM protect
+// CPU $C000 even: IRQ latch
+// CPU $C001 odd:  IRQ reload
+// CPU $E000 even: IRQ disable (and acknowledge)
+// CPU $E001 odd:  IRQ enable
+//
+// The IRQ counter is clocked by the rising edges of PPU A12, once per scanline in the usual setups. Nothing
+// watches the PPU bus: the edges since the last sync are counted from the A12 prediction of the PPU, and the
+// edge that brings the counter to zero is scheduled as EVENT_MAPPER_IRQ.
+static void mapper_004_update(cartridge *cart){
+    mmc3_state *mmc3 = &(cart->regs.mmc3);
+    unsigned last = (cart->prg_size >> 13) - 1;
+
+    // PRG: R6 and the second to last bank swap places in mode 1, R7 and the last bank never move
+    if(mmc3->bank_select & 0x40){
+        map_prg_8k(cart, 0, last - 1);
+        map_prg_8k(cart, 2, mmc3->bank[6]);
+    }else{
+        map_prg_8k(cart, 0, mmc3->bank[6]);
+        map_prg_8k(cart, 2, last - 1);
+    }
+    map_prg_8k(cart, 1, mmc3->bank[7]);
+    map_prg_8k(cart, 3, last);
+
+    // CHR: two 2 KB banks on one half, four 1 KB on the other, halves swapped by A12 inversion
+    int invert = (mmc3->bank_select & 0x80) ? 4 : 0;
+    map_chr_1k(cart, invert + 0, mmc3->bank[0] & 0xFE);
+    map_chr_1k(cart, invert + 1, mmc3->bank[0] | 0x01);
+    map_chr_1k(cart, invert + 2, mmc3->bank[1] & 0xFE);
+    map_chr_1k(cart, invert + 3, mmc3->bank[1] | 0x01);
+    map_chr_1k(cart, (invert ^ 4) + 0, mmc3->bank[2]);
+    map_chr_1k(cart, (invert ^ 4) + 1, mmc3->bank[3]);
+    map_chr_1k(cart, (invert ^ 4) + 2, mmc3->bank[4]);
+    map_chr_1k(cart, (invert ^ 4) + 3, mmc3->bank[5]);
+}
+
+static void mapper_004_reset(cartridge *cart){
+    mmc3_state *mmc3 = &(cart->regs.mmc3);
+    static const uint8_t banks[8] = { 0, 2, 4, 5, 6, 7, 0, 1 };
+    mmc3->bank_select = 0;
+    for(int i = 0; i < 8; i++) mmc3->bank[i] = banks[i];
+    mmc3->prg_ram_protect = 0;
+    mmc3->irq_latch = 0;
+    mmc3->irq_counter = 0;
+    mmc3->irq_reload = 0;
+    mmc3->irq_enabled = 0;
+    mmc3->irq_counted = 0;
+    mapper_004_update(cart);
+}
+
+// Applies the A12 edges seen since the last sync to the counter, then schedules the IRQ.
+// On each edge the counter is reloaded from the latch if it is zero (or a reload was requested) and
+// decremented otherwise, and the IRQ is raised when it ends up at zero.
+static void mapper_004_sync(nes_system *nes){
+    mmc3_state *mmc3 = &(nes->inserted_cart.regs.mmc3);
+    ppu_catch_up(nes);
+    uint64_t now = ppu_dot_count(nes);
+    uint64_t rises = ppu_a12_rises(nes, mmc3->irq_counted, now);
+    mmc3->irq_counted = now;
+
+    if(rises){
+        // After the first edge the counter cycles through latch..0
+        uint8_t counter = (mmc3->irq_counter == 0 || mmc3->irq_reload) ? mmc3->irq_latch : mmc3->irq_counter - 1;
+        rises--;
+        int reached_zero = counter == 0 || rises >= counter;
+        if(rises > counter){
+            counter = mmc3->irq_latch - (rises - counter - 1) % ((uint64_t)mmc3->irq_latch + 1);
+        }else{
+            counter -= rises;
+        }
+        mmc3->irq_counter = counter;
+        mmc3->irq_reload = 0;
+        if(reached_zero && mmc3->irq_enabled) nes->irq_lines |= IRQ_MAPPER;
+    }
+
+    if(mmc3->irq_enabled){
+        uint32_t edges = (mmc3->irq_counter == 0 || mmc3->irq_reload) ? mmc3->irq_latch + 1 : mmc3->irq_counter;
+        uint64_t dot = ppu_a12_find(nes, now, edges);
+        if(dot != UINT64_MAX){
+            scheduler_schedule(&(nes->events), EVENT_MAPPER_IRQ, ppu_dot_time(nes, dot));
+            return;
+        }
+    }
+    scheduler_cancel(&(nes->events), EVENT_MAPPER_IRQ);
+}
+
+static void mapper_004_write(nes_system *nes, uint16_t addr, uint8_t data){
+    cartridge *cart = &(nes->inserted_cart);
+    mmc3_state *mmc3 = &(cart->regs.mmc3);
+
+    // The IRQ registers only affect the edges to come
+    int irq_register = addr >= 0xC000;
+    if(irq_register) mapper_004_sync(nes);
+
+    switch(addr & 0xE001){
+    case 0x8000:
+        mmc3->bank_select = data;
+        mapper_004_update(cart);
+        break;
+    case 0x8001:
+        mmc3->bank[mmc3->bank_select & 0x07] = data;
+        mapper_004_update(cart);
+        break;
+    case 0xA000:
+        set_mirror(nes, (data & 0x01) ? HORIZONTAL : VERTICAL);
+        break;
+    case 0xA001:
+        mmc3->prg_ram_protect = data;
+        break;
+    case 0xC000:
+        mmc3->irq_latch = data;
+        break;
+    case 0xC001:
+        mmc3->irq_counter = 0;
+        mmc3->irq_reload = 1;
+        break;
+    case 0xE000:
+        mmc3->irq_enabled = 0;
+        nes->irq_lines &= ~IRQ_MAPPER;
+        break;
+    case 0xE001:
+        mmc3->irq_enabled = 1;
+        break;
+    }
+
+    if(irq_register) mapper_004_sync(nes);
+}
+
+static const mapper_interface mapper_004 = { "MMC3", mapper_004_reset, mapper_004_write, mapper_004_sync };
@@ -0,0 +1,21 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// AxROM.
+// CPU $8000-$FFFF: 32 KB switchable bank
+// PPU $0000-$1FFF: 8 KB of CHR RAM
+// Writes to $8000-$FFFF: ---M-PPP  M: one-screen nametable, PPP: PRG bank
+static void mapper_007_reset(cartridge *cart){
+    cart->regs.bank = 0;
+    cart->mirror = ONESCREEN_LO;
+    map_prg_32k(cart, 0);
+    map_chr_8k(cart, 0);
+}
+
+static void mapper_007_write(nes_system *nes, uint16_t addr, uint8_t data){
+    nes->inserted_cart.regs.bank = data;
+    map_prg_32k(&(nes->inserted_cart), data & 0x07);
+    set_mirror(nes, (data & 0x10) ? ONESCREEN_HI : ONESCREEN_LO);
+}
+
+static const mapper_interface mapper_007 = { "AxROM", mapper_007_reset, mapper_007_write, NULL };
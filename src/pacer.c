@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include "pacer.h"
+
+#define PACER_SPIN_NS 500000ULL     // Wake ups are usually well within half a millisecond
+#define PACER_MAX_BEHIND 4          // Frames the pacer may be behind before dropping the old schedule
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t deadline_of(const frame_pacer *pacer, uint64_t frame){
+    return pacer->start_ns + (uint64_t)(frame * pacer->period_ns);
+}
+
+void pacer_init(frame_pacer *pacer, double frame_rate){
+    pacer->period_ns = 1e9 / frame_rate;
+    pacer->spin_ns = PACER_SPIN_NS;
+    pacer->start_ns = now_ns();
+    pacer->frame = 0;
+
+    pacer->last_ns = 0;
+    pacer->intervals = 0;
+    pacer->error_sum = 0;
+    pacer->error_sum_squares = 0;
+    pacer->error_max = 0;
+    pacer->late = 0;
+    pacer->resyncs = 0;
+}
+
+void pacer_wait(frame_pacer *pacer){
+    pacer->frame++;
+    uint64_t deadline = deadline_of(pacer, pacer->frame);
+    uint64_t now = now_ns();
+
+    if(now >= deadline){
+        pacer->late++;
+        // Too far behind (debugger, suspended VM...): catching up would run frames back to back, start over
+        if(now - deadline > PACER_MAX_BEHIND * pacer->period_ns){
+            pacer->start_ns = now;
+            pacer->frame = 0;
+            pacer->resyncs++;
+        }
+    }else{
+        if(deadline - now > pacer->spin_ns){
+            uint64_t wake = deadline - pacer->spin_ns;
+            struct timespec ts = { wake / 1000000000ULL, wake % 1000000000ULL };
+            while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        }
+        do{
+            now = now_ns();
+        }while(now < deadline);
+    }
+
+    if(pacer->last_ns != 0){
+        double error = (double)(now - pacer->last_ns) - pacer->period_ns;
+        pacer->intervals++;
+        pacer->error_sum += error;
+        pacer->error_sum_squares += error * error;
+        if(fabs(error) > pacer->error_max) pacer->error_max = fabs(error);
+    }
+    pacer->last_ns = now;
+}
+
+void pacer_print_stats(const frame_pacer *pacer){
+    if(pacer->intervals == 0) return;
+    double mean = pacer->error_sum / pacer->intervals;
+    double stddev = sqrt(pacer->error_sum_squares / pacer->intervals - mean * mean);
+    printf("frame pacing: %.4f Hz target, %llu frames, jitter mean %+.1f us, stddev %.1f us, max %.1f us, %llu late, %llu resyncs\n",
+        1e9 / pacer->period_ns, (unsigned long long)pacer->intervals, mean / 1e3, stddev / 1e3, pacer->error_max / 1e3,
+        (unsigned long long)pacer->late, (unsigned long long)pacer->resyncs);
+}
@@ -0,0 +1,35 @@
+#ifndef _PACER_H_
+#define _PACER_H_
+#include <stdint.h>
+
+// Paces a loop to a fixed frame rate without burning a core.
+//
+// Deadlines are absolute, frame n is due at start + n * period, so sleeping late or early on one frame
+// doesn't accumulate into drift. Most of the wait is a clock_nanosleep() on CLOCK_MONOTONIC, only the
+// last "spin_ns" are busy-waited to absorb the wake up latency of the scheduler.
+
+typedef struct frame_pacer{
+    double period_ns;
+    uint64_t spin_ns;
+    uint64_t start_ns;          // Deadline of frame 0
+    uint64_t frame;             // Frames waited since start_ns
+
+    // Jitter statistics, on the time between two consecutive returns of pacer_wait()
+    uint64_t last_ns;
+    uint64_t intervals;
+    double error_sum;           // Sum of (interval - period)
+    double error_sum_squares;
+    double error_max;           // Largest |interval - period|
+    uint64_t late;              // Frames whose deadline had already passed
+    uint64_t resyncs;           // Times the pacer gave up catching up and restarted from now
+} frame_pacer;
+
+void pacer_init(frame_pacer *pacer, double frame_rate);
+
+// Waits for the deadline of the next frame.
+void pacer_wait(frame_pacer *pacer);
+
+// Prints the frame time jitter statistics.
+void pacer_print_stats(const frame_pacer *pacer);
+
+#endif
@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "perf_counters.h"
+#include "cpu.h"
+
+static const char *region_names[PERF_REGION_COUNT] = { "RAM", "PPU", "IO", "CARTRIDGE" };
+
+// State used by the exit/signal dump
+static perf_counters *dump_perf = NULL;
+static const char *dump_path = NULL;
+static volatile sig_atomic_t dump_requested = 0;
+
+void perf_reset(perf_counters *perf){
+    memset(perf, 0, sizeof(perf_counters));
+}
+
+void perf_count_instruction(perf_counters *perf, uint8_t opcode, uint8_t cycles, uint8_t page_penalty, uint8_t branch_extra){
+    perf->opcode_count[opcode]++;
+    perf->opcode_cycles[opcode] += cycles;
+    perf->page_cross[opcode] += page_penalty;
+    if(branch_extra){
+        perf->branch_taken[opcode]++;
+        if(branch_extra > 1){
+            perf->branch_page_cross[opcode]++;
+        }
+    }
+}
+
+// Per addressing mode totals are not counted on the hot path, they are the sum of the opcodes using the mode.
+// Fills the arrays with one entry per distinct mode, in order of first appearance, and returns the number of modes.
+static int aggregate_addrmodes(const perf_counters *perf, const char *names[16], uint64_t count[16], uint64_t cycles[16], uint64_t page_cross[16]){
+    int n_modes = 0;
+    for(int op = 0; op < 256; op++){
+        const char *mode = cpu_addrmode_name(op);
+        int m = 0;
+        while(m < n_modes && strcmp(names[m], mode) != 0) m++;
+        if(m == n_modes){
+            names[m] = mode;
+            count[m] = cycles[m] = page_cross[m] = 0;
+            n_modes++;
+        }
+        count[m] += perf->opcode_count[op];
+        cycles[m] += perf->opcode_cycles[op];
+        page_cross[m] += perf->page_cross[op];
+    }
+    return n_modes;
+}
+
+void perf_dump_csv(const perf_counters *perf, FILE *fp){
+    fprintf(fp, "kind,id,name,mode,count,cycles,page_cross,branch_taken,branch_page_cross\n");
+    for(int op = 0; op < 256; op++){
+        if(perf->opcode_count[op] == 0) continue;
+        fprintf(fp, "opcode,0x%02X,%s,%s,%llu,%llu,%llu,%llu,%llu\n", op, cpu_opcode_name(op), cpu_addrmode_name(op),
+            (unsigned long long)perf->opcode_count[op], (unsigned long long)perf->opcode_cycles[op],
+            (unsigned long long)perf->page_cross[op], (unsigned long long)perf->branch_taken[op],
+            (unsigned long long)perf->branch_page_cross[op]);
+    }
+
+    const char *names[16];
+    uint64_t count[16], cycles[16], page_cross[16];
+    int n_modes = aggregate_addrmodes(perf, names, count, cycles, page_cross);
+    for(int m = 0; m < n_modes; m++){
+        fprintf(fp, "addrmode,,,%s,%llu,%llu,%llu,,\n", names[m],
+            (unsigned long long)count[m], (unsigned long long)cycles[m], (unsigned long long)page_cross[m]);
+    }
+
+    for(int r = 0; r < PERF_REGION_COUNT; r++){
+        fprintf(fp, "bus_read,,%s,,%llu,,,,\n", region_names[r], (unsigned long long)perf->reads[r]);
+        fprintf(fp, "bus_write,,%s,,%llu,,,,\n", region_names[r], (unsigned long long)perf->writes[r]);
+    }
+}
+
+void perf_dump_json(const perf_counters *perf, FILE *fp){
+    int first = 1;
+    fprintf(fp, "{\n  \"opcodes\": [");
+    for(int op = 0; op < 256; op++){
+        if(perf->opcode_count[op] == 0) continue;
+        fprintf(fp, "%s\n    {\"opcode\": %d, \"name\": \"%s\", \"mode\": \"%s\", \"count\": %llu, \"cycles\": %llu, \"page_cross\": %llu, \"branch_taken\": %llu, \"branch_page_cross\": %llu}",
+            first ? "" : ",", op, cpu_opcode_name(op), cpu_addrmode_name(op),
+            (unsigned long long)perf->opcode_count[op], (unsigned long long)perf->opcode_cycles[op],
+            (unsigned long long)perf->page_cross[op], (unsigned long long)perf->branch_taken[op],
+            (unsigned long long)perf->branch_page_cross[op]);
+        first = 0;
+    }
+    fprintf(fp, "\n  ],\n  \"addrmodes\": [");
+
+    const char *names[16];
+    uint64_t count[16], cycles[16], page_cross[16];
+    int n_modes = aggregate_addrmodes(perf, names, count, cycles, page_cross);
+    for(int m = 0; m < n_modes; m++){
+        fprintf(fp, "%s\n    {\"mode\": \"%s\", \"count\": %llu, \"cycles\": %llu, \"page_cross\": %llu}",
+            m == 0 ? "" : ",", names[m],
+            (unsigned long long)count[m], (unsigned long long)cycles[m], (unsigned long long)page_cross[m]);
+    }
+    fprintf(fp, "\n  ],\n  \"bus\": {");
+
+    for(int r = 0; r < PERF_REGION_COUNT; r++){
+        fprintf(fp, "%s\n    \"%s\": {\"reads\": %llu, \"writes\": %llu}", r == 0 ? "" : ",", region_names[r],
+            (unsigned long long)perf->reads[r], (unsigned long long)perf->writes[r]);
+    }
+    fprintf(fp, "\n  }\n}\n");
+}
+
+static void perf_dump_to_file(void){
+    if(dump_perf == NULL) return;
+
+    FILE *fp = fopen(dump_path, "w");
+    if(fp == NULL){
+        perror(dump_path);
+        return;
+    }
+
+    size_t len = strlen(dump_path);
+    if(len >= 5 && strcmp(dump_path + len - 5, ".json") == 0){
+        perf_dump_json(dump_perf, fp);
+    }else{
+        perf_dump_csv(dump_perf, fp);
+    }
+    fclose(fp);
+}
+
+// Only raises a flag, the actual dump isn't async-signal-safe and happens on perf_poll().
+static void perf_signal_handler(int sig){
+    (void)sig;
+    dump_requested = 1;
+}
+
+void perf_install_dump(perf_counters *perf, const char *path){
+    dump_perf = perf;
+    dump_path = path ? path : "perf_counters.csv";
+    atexit(perf_dump_to_file);
+    signal(SIGUSR1, perf_signal_handler);
+}
+
+void perf_poll(void){
+    if(dump_requested){
+        dump_requested = 0;
+        perf_dump_to_file();
+    }
+}
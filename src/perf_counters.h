@@ -0,0 +1,61 @@
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+#include <stdint.h>
+#include <stdio.h>
+
+// Optional instrumentation of the CPU and the bus.
+// Only compiled in when NES_PERF_COUNTERS is defined (make PERF_COUNTERS=1), otherwise the
+// counting macros expand to nothing and "nes_system" doesn't even carry the counters.
+
+// Regions of the CPU address space, used to classify bus traffic.
+enum PERF_REGION{
+    PERF_RAM,           // $0000-$1FFF
+    PERF_PPU,           // $2000-$3FFF
+    PERF_IO,            // $4000-$401F (APU and I/O)
+    PERF_CARTRIDGE,     // $4020-$FFFF
+    PERF_REGION_COUNT,
+};
+
+typedef struct perf_counters{
+    uint64_t opcode_count[256];         // Times each opcode was executed
+    uint64_t opcode_cycles[256];        // Cycles spent on each opcode, penalties included
+    uint64_t page_cross[256];           // Extra cycles paid because the addressing mode crossed a page
+    uint64_t branch_taken[256];         // Branches taken (only meaningful for relative addressing)
+    uint64_t branch_page_cross[256];    // Taken branches whose target is on another page
+
+    uint64_t reads[PERF_REGION_COUNT];  // cpu_read() calls per region
+    uint64_t writes[PERF_REGION_COUNT]; // cpu_write() calls per region
+} perf_counters;
+
+#ifdef NES_PERF_COUNTERS
+#define PERF_COUNT_READ(nes, region)  ((nes)->perf.reads[(region)]++)
+#define PERF_COUNT_WRITE(nes, region) ((nes)->perf.writes[(region)]++)
+#define PERF_POLL()                   perf_poll()
+#else
+#define PERF_COUNT_READ(nes, region)
+#define PERF_COUNT_WRITE(nes, region)
+#define PERF_POLL()
+#endif
+
+// Sets every counter to zero.
+void perf_reset(perf_counters *perf);
+
+// Accounts one executed instruction. "cycles" is the total duration of the instruction,
+// "page_penalty" the extra cycle from the addressing mode and "branch_extra" the 1 or 2
+// cycles added by a taken branch.
+void perf_count_instruction(perf_counters *perf, uint8_t opcode, uint8_t cycles, uint8_t page_penalty, uint8_t branch_extra);
+
+// Write the counters as CSV (one row per opcode, addressing mode and bus region).
+void perf_dump_csv(const perf_counters *perf, FILE *fp);
+
+// Write the counters as a JSON object.
+void perf_dump_json(const perf_counters *perf, FILE *fp);
+
+// Dumps "perf" to "path" at exit and whenever the process receives SIGUSR1.
+// The format is JSON if "path" ends in ".json", CSV otherwise. A NULL path means "perf_counters.csv".
+void perf_install_dump(perf_counters *perf, const char *path);
+
+// Performs the dump requested by a signal, if any. Cheap enough to be called every iteration of the main loop.
+void perf_poll(void);
+
+#endif
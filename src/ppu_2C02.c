@@ -1,20 +1,237 @@
 #include <stdint.h>
+#include <string.h>
 #include "ppu_2C02.h"
 #include "bus.h"
+#include "mappers.h"
+
+static void init_decode_tables(void);
+static void init_output_tables(void);
+static void render_scanline(nes_system *nes);
+static void evaluate_sprites(nes_system *nes);
 
 
 void ppu_init(ppu_2C02 *ppu){
+    init_decode_tables();
+    init_output_tables();
+    ppu->oam_address = 0x00;
+    ppu->sprites_dirty = 1;
+    ppu->screen = ppu->screen_buffer;
+    ppu->index_screen = NULL;
+    ppu->luma_screen = NULL;
+    ppu->small_screen = NULL;
+    memset(ppu->small_sum, 0, sizeof(ppu->small_sum));
     ppu->address_latch = 0x00;
+    ppu->ppu_address = 0x0000;
+    ppu->tram_address = 0x0000;
+    ppu->fine_x = 0x00;
     ppu->ppu_data_buffer = 0x00;
+    ppu->control.reg = 0x00;
+    ppu->mask.reg = 0x00;
+    ppu->status.reg = 0x00;
     ppu->scanline = 0;
     ppu->cycle = 0;
     ppu->nmi_flag = 0;
+    ppu->frame_complete = 0;
+    ppu->clock_time = 0;
+    ppu->frame_count = 0;
 }
 
 void ppu_clock(nes_system *nes){
 
+    if(nes->ppu.scanline == -1 && nes->ppu.cycle == 1){
+        nes->ppu.status.vertical_blank = 0;
+        nes->ppu.status.sprite_zero_hit = 0;
+        nes->ppu.status.sprite_overflow = 0;
+    }
+
+    // Whole visible scanlines are drawn at once, with the registers as they are at dot 256
+    if(nes->ppu.cycle == 256){
+        if(nes->ppu.scanline >= 0 && nes->ppu.scanline < 240){
+            render_scanline(nes);
+        }else if(nes->ppu.scanline == -1 && (nes->ppu.mask.render_background || nes->ppu.mask.render_sprites)){
+            nes->ppu.ppu_address = nes->ppu.tram_address;      // Scroll reloaded for the new frame
+        }
+    }
+
     if(nes->ppu.scanline == 241 && nes->ppu.cycle == 1){
         nes->ppu.status.vertical_blank = 1;
+        if(nes->ppu.control.enable_nmi){
+            nes->ppu.nmi_flag = 1;
+        }
+    }
+
+    // 341 dots per scanline, scanlines -1 (pre-render) through 260 (310 on PAL)
+    nes->ppu.cycle++;
+    if(nes->ppu.cycle >= 341){
+        nes->ppu.cycle = 0;
+        nes->ppu.scanline++;
+        if(nes->ppu.scanline > nes->timing->last_scanline){
+            nes->ppu.scanline = -1;
+            nes->ppu.frame_complete = 1;
+            nes->ppu.frame_count++;
+        }
+    }
+}
+
+void ppu_catch_up(nes_system *nes){
+    uint8_t divider = nes->timing->ppu_divider;
+    while(nes->ppu.clock_time <= nes->master_clock){
+        // ppu_clock() only acts on dots 0, 1, 256 and 340, the ones in between are skipped in one go
+        int16_t active = nes->ppu.cycle <= 1 ? nes->ppu.cycle : (nes->ppu.cycle <= 256 ? 256 : 340);
+        if(active > nes->ppu.cycle){
+            uint64_t dots = (nes->master_clock - nes->ppu.clock_time) / divider + 1;
+            if(dots > (uint64_t)(active - nes->ppu.cycle)) dots = active - nes->ppu.cycle;
+            nes->ppu.cycle += dots;
+            nes->ppu.clock_time += dots * divider;
+        }else{
+            ppu_clock(nes);
+            nes->ppu.clock_time += divider;
+        }
+    }
+}
+
+// Master clock time at which the dot ("scanline", "cycle") will be executed next.
+uint64_t ppu_time_of(nes_system *nes, int16_t scanline, int16_t cycle){
+    int32_t frame_dots = (nes->timing->last_scanline + 2) * 341;
+    int32_t current = (nes->ppu.scanline + 1) * 341 + nes->ppu.cycle;
+    int32_t target = (scanline + 1) * 341 + cycle;
+    int32_t dots = target - current;
+    if(dots < 0) dots += frame_dots;
+    return nes->ppu.clock_time + (uint64_t)dots * nes->timing->ppu_divider;
+}
+
+// PPU A12 prediction
+//
+// Scanline counters (MMC3) are clocked by the rising edges of PPU A12, which is high while patterns are
+// fetched from $1000-$1FFF. Rather than checking every ppu_read() address, the edges are derived from the
+// rendering settings. While rendering, lines -1 to 239 fetch background patterns on dots 1-256 and 321-336
+// and sprite patterns on dots 257-320, 8 dots per sprite. The mappers filter out the short low pulses of
+// the nametable fetches between two patterns, so an edge only happens when the fetches switch from the
+// $0000 table to the $1000 one, 3 dots into the fetch.
+//
+// Every line starts where the previous one ended, except the pre-render line: A12 is low through
+// vertical blank, so when the background uses $1000 the first fetch of the frame is an edge too, on dot 4.
+// That edge is the only one when background and sprites both use $1000.
+//
+// With 8x8 sprites every visible line has the same single edge (or none), which gives a closed form. With
+// 8x16 sprites the table of each sprite comes from its tile number, so the edges are found line by line
+// from the sprite lists.
+
+#define A12_LINES 241           // Lines -1 to 239 fetch patterns
+#define A12_NONE 0xFFFF
+#define A12_PRERENDER_DOT 4     // Edge of the first background fetch after vertical blank
+
+static inline uint32_t frame_dots(nes_system *nes){
+    return (nes->timing->last_scanline + 2) * 341;
+}
+
+// Dot of the edge on every line with 8x8 sprites, A12_NONE when both tables are the same.
+static uint16_t a12_uniform_dot(const ppu_2C02 *ppu){
+    if(!ppu->control.pattern_background && ppu->control.pattern_sprite) return 260;
+    if(ppu->control.pattern_background && !ppu->control.pattern_sprite) return 324;
+    return A12_NONE;
+}
+
+// Edges of line "line" (0 being the pre-render line) with 8x16 sprites. Stores their dots in "dots" and
+// returns how many there are.
+static int a12_line_rises(nes_system *nes, int line, uint16_t dots[10]){
+    ppu_2C02 *ppu = &(nes->ppu);
+    int background = ppu->control.pattern_background;
+    int level = background;     // The previous line ended on background fetches
+    int n = 0;
+    if(line == 0 && background) dots[n++] = A12_PRERENDER_DOT;
+
+    // A line fetches the sprites of the next one, unused slots fetch tile $FF
+    int count = line < 240 ? ppu->sprite_lines[line].count : 0;
+    for(int slot = 0; slot < 8; slot++){
+        int table = slot < count ? ppu->oam.entry[ppu->sprite_lines[line].index[slot]].id & 0x01 : 1;
+        if(table && !level) dots[n++] = 260 + slot * 8;
+        level = table;
+    }
+    if(background && !level) dots[n++] = 324;
+    return n;
+}
+
+// Edges on the dots of a frame before "dot" (0 to frame_dots()).
+static uint32_t a12_rises_before(nes_system *nes, uint32_t dot){
+    if(!nes->ppu.control.sprite_size){
+        uint32_t first = nes->ppu.control.pattern_background && dot > A12_PRERENDER_DOT;
+        uint16_t edge = a12_uniform_dot(&(nes->ppu));
+        if(edge == A12_NONE || dot <= edge) return first;
+        uint32_t n = (dot - edge - 1) / 341 + 1;
+        return first + (n < A12_LINES ? n : A12_LINES);
+    }
+
+    uint32_t n = 0;
+    uint16_t dots[10];
+    for(int line = 0; line < A12_LINES && (uint32_t)line * 341 < dot; line++){
+        int count = a12_line_rises(nes, line, dots);
+        for(int i = 0; i < count && (uint32_t)(line * 341 + dots[i]) < dot; i++) n++;
+    }
+    return n;
+}
+
+// Dot of the "n"th edge of a frame, n from 1 to a12_rises_before(nes, frame_dots(nes)).
+static uint32_t a12_rise_dot(nes_system *nes, uint32_t n){
+    if(!nes->ppu.control.sprite_size){
+        if(nes->ppu.control.pattern_background){
+            if(n == 1) return A12_PRERENDER_DOT;
+            n--;
+        }
+        return (n - 1) * 341 + a12_uniform_dot(&(nes->ppu));
+    }
+
+    uint16_t dots[10];
+    for(int line = 0; line < A12_LINES; line++){
+        uint32_t count = a12_line_rises(nes, line, dots);
+        if(n <= count) return line * 341 + dots[n - 1];
+        n -= count;
+    }
+    return 0;
+}
+
+// A12 stays put unless something is fetched. Brings the sprite lists up to date for the 8x16 case.
+static int a12_active(nes_system *nes){
+    ppu_2C02 *ppu = &(nes->ppu);
+    if(!(ppu->mask.render_background || ppu->mask.render_sprites)) return 0;
+    if(ppu->control.sprite_size && ppu->sprites_dirty) evaluate_sprites(nes);
+    return 1;
+}
+
+uint64_t ppu_dot_count(nes_system *nes){
+    return nes->ppu.frame_count * frame_dots(nes) + (nes->ppu.scanline + 1) * 341 + nes->ppu.cycle;
+}
+
+uint64_t ppu_dot_time(nes_system *nes, uint64_t dot){
+    return nes->ppu.clock_time + (dot - ppu_dot_count(nes)) * nes->timing->ppu_divider;
+}
+
+uint64_t ppu_a12_rises(nes_system *nes, uint64_t from, uint64_t to){
+    if(to <= from || !a12_active(nes)) return 0;
+    uint32_t dots = frame_dots(nes);
+    uint64_t frames = to / dots - from / dots;
+    return frames * a12_rises_before(nes, dots) + a12_rises_before(nes, to % dots) - a12_rises_before(nes, from % dots);
+}
+
+uint64_t ppu_a12_find(nes_system *nes, uint64_t from, uint32_t n){
+    if(n == 0 || !a12_active(nes)) return UINT64_MAX;
+    uint32_t dots = frame_dots(nes);
+    uint32_t per_frame = a12_rises_before(nes, dots);
+    if(per_frame == 0) return UINT64_MAX;
+
+    // Counted from the start of the frame "from" is in, then wrapped into the frame it falls in
+    uint64_t nth = a12_rises_before(nes, from % dots) + (uint64_t)n;
+    uint64_t frame = from / dots + (nth - 1) / per_frame;
+    return frame * dots + a12_rise_dot(nes, (nth - 1) % per_frame + 1);
+}
+
+void ppu_schedule(nes_system *nes){
+    // Pending ones are left alone: another event may have run the PPU past them, they must still fire
+    if(!scheduler_pending(&(nes->events), EVENT_VBLANK)){
+        scheduler_schedule(&(nes->events), EVENT_VBLANK, ppu_time_of(nes, 241, 1));
+    }
+    if(!scheduler_pending(&(nes->events), EVENT_FRAME_END)){
+        scheduler_schedule(&(nes->events), EVENT_FRAME_END, ppu_time_of(nes, nes->timing->last_scanline, 340));
     }
 }
 
@@ -84,6 +301,26 @@ uint32_t colors[0x40] = {
 0xFF000000,
 0xFF000000};
 
+// Luminance of each NES color, and where each source column falls in the downscaled frame: small
+// pixel "small_column" takes "small_weight" 84ths of it, the next one the rest
+static uint8_t luma_table[0x40];
+static uint8_t small_column[256];
+static uint8_t small_weight[256];
+
+static void init_output_tables(void){
+	for(int i = 0; i < 0x40; i++){
+		uint32_t c = colors[i];
+		luma_table[i] = (77 * ((c >> 16) & 0xFF) + 150 * ((c >> 8) & 0xFF) + 29 * (c & 0xFF) + 128) >> 8;
+	}
+	for(int x = 0; x < 256; x++){
+		uint32_t left = x * PPU_SMALL_WIDTH;
+		uint32_t column = left / 256;
+		uint32_t boundary = (column + 1) * 256;
+		small_column[x] = column;
+		small_weight[x] = left + PPU_SMALL_WIDTH <= boundary ? PPU_SMALL_WIDTH : boundary - left;
+	}
+}
+
 
 
 uint32_t get_color(nes_system *nes,uint8_t pal,uint8_t color_i){
@@ -122,7 +359,6 @@ uint8_t ppu_access_read(nes_system *nes, uint16_t addr){
 		case 0x0001: // Mask
 			break;
 		case 0x0002: // Status
-			nes->ppu.status.vertical_blank = 1; //gambiarra
 			data = (nes->ppu.status.reg & 0xE0) | (nes->ppu.ppu_data_buffer & 0x10); // 3 bits of flags and 5 of noise
             nes->ppu.status.vertical_blank = 0;
             nes->ppu.address_latch = 0;
@@ -130,6 +366,7 @@ uint8_t ppu_access_read(nes_system *nes, uint16_t addr){
 		case 0x0003: // OAM Address
 			break;
 		case 0x0004: // OAM Data
+			data = nes->ppu.oam.bytes[nes->ppu.oam_address];
 			break;
 		case 0x0005: // Scroll
 			break;
@@ -154,26 +391,59 @@ void ppu_access_write(nes_system *nes, uint16_t addr, uint8_t data){
     switch (addr)
 		{
 		case 0x0000: // Control
-			nes->ppu.control.reg = data;
+			{
+				// Enabling NMI during vertical blank raises it right away
+				uint8_t nmi_was_enabled = nes->ppu.control.enable_nmi;
+				uint8_t a12_change = (nes->ppu.control.reg ^ data) & 0x38;			// Pattern tables or sprite size
+				if(a12_change) mapper_sync(nes);
+				if((nes->ppu.control.reg ^ data) & 0x20) nes->ppu.sprites_dirty = 1;	// Sprite size
+				nes->ppu.control.reg = data;
+				if(a12_change) mapper_sync(nes);
+				nes->ppu.tram_address = (nes->ppu.tram_address & ~0x0C00) | ((data & 0x03) << 10);
+				if(!nmi_was_enabled && nes->ppu.control.enable_nmi && nes->ppu.status.vertical_blank){
+					nes->ppu.nmi_flag = 1;
+					scheduler_schedule(&(nes->events), EVENT_NMI, nes->master_clock);
+				}
+			}
 			break;
 		case 0x0001: // Mask
-			nes->ppu.mask.reg = data;
+			{
+				// Turning rendering on or off starts or stops the pattern fetches
+				uint8_t a12_change = !(nes->ppu.mask.reg & 0x18) != !(data & 0x18);
+				if(a12_change) mapper_sync(nes);
+				nes->ppu.mask.reg = data;
+				if(a12_change) mapper_sync(nes);
+			}
 			break;
 		case 0x0002: // Status
 			nes->ppu.status.reg = data;
 			break;
 		case 0x0003: // OAM Address
+			nes->ppu.oam_address = data;
 			break;
 		case 0x0004: // OAM Data
+			if(nes->ppu.control.sprite_size) mapper_sync(nes);	// 8x16 sprites pick their table from OAM
+			nes->ppu.oam.bytes[nes->ppu.oam_address++] = data;
+			nes->ppu.sprites_dirty = 1;
+			if(nes->ppu.control.sprite_size) mapper_sync(nes);
 			break;
 		case 0x0005: // Scroll
+			if(nes->ppu.address_latch == 0x00){		// X: coarse in t, fine in fine_x
+				nes->ppu.tram_address = (nes->ppu.tram_address & ~0x001F) | (data >> 3);
+				nes->ppu.fine_x = data & 0x07;
+				nes->ppu.address_latch = 0x01;
+			}else{									// Y: coarse and fine in t
+				nes->ppu.tram_address = (nes->ppu.tram_address & ~0x73E0) | ((uint16_t)(data & 0x07) << 12) | ((uint16_t)(data & 0xF8) << 2);
+				nes->ppu.address_latch = 0x00;
+			}
 			break;
-		case 0x0006: // PPU Address
+		case 0x0006: // PPU Address, written to t and copied to v on the second write
             if(nes->ppu.address_latch == 0x00){
-                nes->ppu.ppu_address = (nes->ppu.ppu_address & 0x00FF) | (((uint16_t)data) << 8);
+                nes->ppu.tram_address = (nes->ppu.tram_address & 0x00FF) | (((uint16_t)data & 0x3F) << 8);
                 nes->ppu.address_latch = 0x01;
             }else{
-                nes->ppu.ppu_address = (nes->ppu.ppu_address & 0xFF00) | (uint16_t)data;
+                nes->ppu.tram_address = (nes->ppu.tram_address & 0xFF00) | (uint16_t)data;
+                nes->ppu.ppu_address = nes->ppu.tram_address;
                 nes->ppu.address_latch = 0x00;
             }
 			break;
@@ -192,9 +462,9 @@ uint8_t ppu_read(nes_system *nes, uint16_t addr){
 	addr &= 0x3FFF;
 
     if(addr >= 0x0000 && addr <= 0x1FFF){ // Pattern tables
-		data = nes->inserted_cart.chr[nes->inserted_cart.mapper_f(addr, nes->inserted_cart.header.prg_rom_chunks, nes->inserted_cart.header.chr_rom_chunks)];
-    }else if(addr >= 0x2000 && addr <= 0x3EFF){ // Nametables - VRAM
-        // Resolver as bagaças de mirroring, bruxaria com bits
+		data = mapper_chr_read(&(nes->inserted_cart), addr);
+    }else if(addr >= 0x2000 && addr <= 0x3EFF){ // Nametables - VRAM, $3000-$3EFF mirrors $2000-$2EFF
+		data = nes->ppu.nametable_map[(addr >> 10) & 0x03][addr & 0x03FF];
     }else if(addr >= 0x3F00 && addr <= 0x3FFF){ // Palletes
 		addr &= 0x001F;						// deal with loopback to universal background later
 		if (addr == 0x0010) addr = 0x0000;
@@ -211,15 +481,317 @@ uint8_t ppu_read(nes_system *nes, uint16_t addr){
 void ppu_write(nes_system *nes, uint_fast16_t addr, uint8_t data){
     addr &= 0x3FFF;
 
-	 if(addr >= 0x0000 && addr <= 0x1FFF){ // Pattern tables
-		nes->inserted_cart.chr[nes->inserted_cart.mapper_f(addr, nes->inserted_cart.header.prg_rom_chunks, nes->inserted_cart.header.chr_rom_chunks)] = data;
-    }else if(addr >= 0x2000 && addr <= 0x3EFF){ // Nametables - VRAM
-        // Resolver as bagaças de mirroring, bruxaria com bits
+	 if(addr >= 0x0000 && addr <= 0x1FFF){ // Pattern tables, only writable on boards with CHR RAM
+		if(nes->inserted_cart.chr_writable) nes->inserted_cart.chr_page[addr >> 10][addr & 0x03FF] = data;
+    }else if(addr >= 0x2000 && addr <= 0x3EFF){ // Nametables - VRAM, $3000-$3EFF mirrors $2000-$2EFF
+		nes->ppu.nametable_map[(addr >> 10) & 0x03][addr & 0x03FF] = data;
     }else if(addr >= 0x3F00 && addr <= 0x3FFF){ // Palletes
-
+		addr &= 0x001F;
+		if (addr == 0x0010) addr = 0x0000;
+		if (addr == 0x0014) addr = 0x0004;
+		if (addr == 0x0018) addr = 0x0008;
+		if (addr == 0x001C) addr = 0x000C;
+		nes->ppu.palletes[addr] = data;
     }
 }
 
+// ---- Rendering ----
+//
+// Tile rows are decoded 8 pixels at a time into a uint64_t holding one pixel per byte, leftmost pixel
+// in the lowest byte (so a memcpy to a line buffer lays them out left to right on little-endian hosts).
+// A pixel byte is a palette RAM index: bits 0-1 the color inside the palette, bits 2-4 the palette
+// (sprites use palettes 4-7). Color 0 is transparent and always stored as index 0.
+// Priority and transparency are then resolved on 8 pixels at a time with masks.
+
+#define BYTES(x) (0x0101010101010101ULL * (uint64_t)(x))
+
+static uint64_t row_expand[256];        // Bit 7 (leftmost pixel) goes to byte 0
+static uint64_t row_expand_flip[256];   // Horizontally flipped: bit 0 goes to byte 0
+
+static void init_decode_tables(void){
+	for(int b = 0; b < 256; b++){
+		uint64_t normal = 0, flipped = 0;
+		for(int px = 0; px < 8; px++){
+			if(b & (0x80 >> px)) normal |= 1ULL << (px * 8);
+			if(b & (0x01 << px)) flipped |= 1ULL << (px * 8);
+		}
+		row_expand[b] = normal;
+		row_expand_flip[b] = flipped;
+	}
+}
+
+// Decodes the row of a tile given its two bit planes.
+static inline uint64_t decode_row(uint8_t lsb, uint8_t msb, int flip){
+	const uint64_t *expand = flip ? row_expand_flip : row_expand;
+	return expand[lsb] | (expand[msb] << 1);
+}
+
+// 0xFF on every byte holding a non transparent pixel, 0x00 elsewhere.
+static inline uint64_t opaque_mask(uint64_t px){
+	return ((px | (px >> 1)) & BYTES(0x01)) * 0xFF;
+}
+
+static inline uint64_t load8(const uint8_t *p){
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline void store8(uint8_t *p, uint64_t v){
+	memcpy(p, &v, 8);
+}
+
+// Builds the per scanline sprite lists from OAM: the first 8 sprites (in OAM order) covering each line,
+// plus an overflow flag when there are more.
+static void evaluate_sprites(nes_system *nes){
+	ppu_2C02 *ppu = &(nes->ppu);
+	int height = ppu->control.sprite_size ? 16 : 8;
+
+	for(int line = 0; line < 240; line++){
+		ppu->sprite_lines[line].count = 0;
+		ppu->sprite_lines[line].overflow = 0;
+	}
+
+	for(int i = 0; i < 64; i++){
+		int top = ppu->oam.entry[i].y + 1;     // Sprites show up one line below their Y
+		for(int line = top; line < top + height && line < 240; line++){
+			if(ppu->sprite_lines[line].count < 8){
+				ppu->sprite_lines[line].index[ppu->sprite_lines[line].count++] = i;
+			}else{
+				ppu->sprite_lines[line].overflow = 1;
+			}
+		}
+	}
+	ppu->sprites_dirty = 0;
+}
+
+// Draws the background of the line pointed by v into "line" (256 pixels).
+static void render_background(nes_system *nes, uint8_t *line){
+	uint8_t tiles[33 * 8];
+	uint16_t v = nes->ppu.ppu_address;
+	uint16_t base = nes->ppu.control.pattern_background ? 0x1000 : 0x0000;
+	uint16_t fine_y = (v >> 12) & 0x07;
+
+	for(int t = 0; t < 33; t++){
+		uint8_t *nametable = nes->ppu.nametable_map[(v >> 10) & 0x03];
+		uint8_t tile = nametable[v & 0x03FF];
+		uint8_t attribute = nametable[0x03C0 | ((v >> 4) & 0x38) | ((v >> 2) & 0x07)];
+		uint8_t palette = (attribute >> (((v >> 4) & 0x04) | (v & 0x02))) & 0x03;
+
+		uint16_t addr = base + tile * 16 + fine_y;
+		uint64_t px = decode_row(ppu_read(nes, addr), ppu_read(nes, addr + 8), 0);
+		px |= BYTES(palette << 2) & opaque_mask(px);
+		store8(tiles + t * 8, px);
+
+		// Next coarse X, wrapping into the horizontally adjacent nametable
+		if((v & 0x001F) == 31){
+			v &= ~0x001F;
+			v ^= 0x0400;
+		}else{
+			v++;
+		}
+	}
+	memcpy(line, tiles + nes->ppu.fine_x, 256);
+}
+
+// Moves v to the next line, as the scroll increments of a rendered line leave it. They happen with
+// either background or sprites enabled.
+static void advance_line(ppu_2C02 *ppu){
+	// Next fine/coarse Y, wrapping into the vertically adjacent nametable after row 29
+	uint16_t v = ppu->ppu_address;
+	if((v & 0x7000) != 0x7000){
+		v += 0x1000;
+	}else{
+		v &= ~0x7000;
+		uint16_t y = (v & 0x03E0) >> 5;
+		if(y == 29){
+			y = 0;
+			v ^= 0x0800;
+		}else if(y == 31){
+			y = 0;
+		}else{
+			y++;
+		}
+		v = (v & ~0x03E0) | (y << 5);
+	}
+	// Horizontal position reloaded from t for the next line
+	ppu->ppu_address = (v & ~0x041F) | (ppu->tram_address & 0x041F);
+}
+
+// Merges the sprites of "scanline" into "sprites" (palette indexes) and "behind" (0xFF where the sprite
+// pixel goes behind the background). Returns the opaque pixels of sprite 0 in "zero" when it is on the line.
+// Buffers need room for 256 + 8 pixels.
+static int render_sprites(nes_system *nes, int16_t scanline, uint8_t *sprites, uint8_t *behind, uint8_t *zero){
+	ppu_2C02 *ppu = &(nes->ppu);
+	int has_zero = 0;
+
+	if(ppu->sprites_dirty){
+		evaluate_sprites(nes);
+	}
+	if(ppu->sprite_lines[scanline].overflow){
+		ppu->status.sprite_overflow = 1;
+	}
+
+	for(int s = 0; s < ppu->sprite_lines[scanline].count; s++){
+		uint8_t i = ppu->sprite_lines[scanline].index[s];
+		oam_entry *sprite = &(ppu->oam.entry[i]);
+		int row = scanline - (sprite->y + 1);
+
+		uint16_t addr;
+		if(ppu->control.sprite_size){       // 8x16, the table comes from bit 0 of the tile
+			if(sprite->attribute & 0x80) row = 15 - row;
+			addr = ((sprite->id & 0x01) << 12) + ((sprite->id & 0xFE) + (row >> 3)) * 16 + (row & 0x07);
+		}else{
+			if(sprite->attribute & 0x80) row = 7 - row;
+			addr = (ppu->control.pattern_sprite ? 0x1000 : 0x0000) + sprite->id * 16 + row;
+		}
+
+		uint64_t px = decode_row(ppu_read(nes, addr), ppu_read(nes, addr + 8), sprite->attribute & 0x40);
+		uint64_t opaque = opaque_mask(px);
+		px |= BYTES(0x10 | ((sprite->attribute & 0x03) << 2)) & opaque;
+
+		// Lower OAM indexes win, so only pixels still transparent are taken
+		uint64_t current = load8(sprites + sprite->x);
+		uint64_t take = opaque & ~opaque_mask(current);
+		store8(sprites + sprite->x, (current & ~take) | (px & take));
+		uint64_t priority = (sprite->attribute & 0x20) ? BYTES(0xFF) : 0;
+		store8(behind + sprite->x, (load8(behind + sprite->x) & ~take) | (priority & take));
+
+		if(i == 0){
+			store8(zero + sprite->x, opaque);
+			has_zero = 1;
+		}
+	}
+	return has_zero;
+}
+
+// Box filter of the luminance down to PPU_SMALL_WIDTH x PPU_SMALL_HEIGHT, one scanline at a time.
+//
+// Source pixel x spans [x * 84, (x + 1) * 84) and small pixel i spans [i * 256, (i + 1) * 256) in the
+// same units, so a source pixel falls in one or two small pixels with integer weights. Rows work the
+// same way with 240, and each small pixel is its weighted sum divided by its area, 256 * 240.
+static void downscale_scanline(ppu_2C02 *ppu, int16_t scanline, const uint8_t *luma){
+	uint32_t row[PPU_SMALL_WIDTH + 1] = {0};
+	for(int x = 0; x < 256; x++){
+		row[small_column[x]] += luma[x] * small_weight[x];
+		row[small_column[x] + 1] += luma[x] * (PPU_SMALL_WIDTH - small_weight[x]);
+	}
+
+	if(scanline == 0) memset(ppu->small_sum, 0, sizeof(ppu->small_sum));
+	uint32_t top = scanline * PPU_SMALL_HEIGHT;
+	uint32_t bottom = top + PPU_SMALL_HEIGHT;
+	uint32_t out_row = top / 240;
+	uint32_t boundary = (out_row + 1) * 240;
+	uint32_t weight = (bottom < boundary ? bottom : boundary) - top;
+	for(int i = 0; i < PPU_SMALL_WIDTH; i++) ppu->small_sum[i] += row[i] * weight;
+
+	// This scanline finishes the small row, what is left of it starts the next one
+	if(bottom >= boundary){
+		uint8_t *out = ppu->small_screen[out_row];
+		for(int i = 0; i < PPU_SMALL_WIDTH; i++){
+			out[i] = (ppu->small_sum[i] + 256 * 240 / 2) / (256 * 240);
+			ppu->small_sum[i] = row[i] * (bottom - boundary);
+		}
+	}
+}
+
+static void render_scanline(nes_system *nes){
+	ppu_2C02 *ppu = &(nes->ppu);
+	int16_t scanline = ppu->scanline;
+	uint8_t background[256 + 8] = {0};
+	uint8_t sprites[256 + 8] = {0};
+	uint8_t behind[256 + 8] = {0};
+	uint8_t zero[256 + 8] = {0};
+	uint8_t line[256];
+	int has_zero = 0;
+
+	if(ppu->mask.render_background){
+		render_background(nes, background);
+		if(!ppu->mask.render_background_left) memset(background, 0, 8);
+	}
+	if(ppu->mask.render_sprites){
+		has_zero = render_sprites(nes, scanline, sprites, behind, zero);
+		if(!ppu->mask.render_sprites_left) memset(sprites, 0, 8);
+	}
+	if(ppu->mask.render_background || ppu->mask.render_sprites) advance_line(ppu);
+
+	// Sprite 0 hit: an opaque pixel of sprite 0 over an opaque background pixel, never on x = 255
+	if(has_zero && ppu->mask.render_background && !ppu->status.sprite_zero_hit){
+		if(!ppu->mask.render_background_left || !ppu->mask.render_sprites_left) memset(zero, 0, 8);
+		zero[255] = 0;
+		for(int x = 0; x < 256; x += 8){
+			if(load8(zero + x) & opaque_mask(load8(background + x))){
+				ppu->status.sprite_zero_hit = 1;
+				break;
+			}
+		}
+	}
+
+	// Sprites in front, or behind a transparent background, replace the background pixel
+	for(int x = 0; x < 256; x += 8){
+		uint64_t bg = load8(background + x);
+		uint64_t spr = load8(sprites + x);
+		uint64_t use_sprite = opaque_mask(spr) & (~load8(behind + x) | ~opaque_mask(bg));
+		store8(line + x, (spr & use_sprite) | (bg & ~use_sprite));
+	}
+
+	// Palette indexes to NES colors, then to each output
+	uint8_t index[32];
+	uint8_t mask = ppu->mask.grayscale ? 0x30 : 0x3F;
+	for(int i = 0; i < 32; i++){
+		index[i] = ppu->palletes[(i & 0x03) ? i : 0] & mask;
+	}
+	if(ppu->screen){
+		uint32_t palette[32];
+		for(int i = 0; i < 32; i++) palette[i] = colors[index[i]];
+		pixel *out = ppu->screen[scanline];
+		for(int x = 0; x < 256; x++){
+			out[x].ARGB = palette[line[x]];
+		}
+	}
+	if(ppu->index_screen){
+		uint8_t *out = ppu->index_screen[scanline];
+		for(int x = 0; x < 256; x++) out[x] = index[line[x]];
+	}
+	if(ppu->luma_screen || ppu->small_screen){
+		uint8_t luma[256];
+		uint8_t palette[32];
+		for(int i = 0; i < 32; i++) palette[i] = luma_table[index[i]];
+		for(int x = 0; x < 256; x++) luma[x] = palette[line[x]];
+		if(ppu->luma_screen) memcpy(ppu->luma_screen[scanline], luma, 256);
+		if(ppu->small_screen) downscale_scanline(ppu, scanline, luma);
+	}
+}
+
+// Which of the 1 KB VRAM pages each quadrant uses:
+//   Horizontal: $2000 = $2400 = A, $2800 = $2C00 = B
+//   Vertical:   $2000 = $2800 = A, $2400 = $2C00 = B
+//   One screen: every quadrant sees A (or B)
+//   Four screen: A, B, then the 2 KB on the cartridge
+void ppu_update_mirroring(nes_system *nes){
+	uint8_t **map = nes->ppu.nametable_map;
+	uint8_t (*vram)[1024] = nes->ppu.nametable;
+
+	switch(nes->inserted_cart.mirror){
+	case HORIZONTAL:
+		map[0] = vram[0]; map[1] = vram[0]; map[2] = vram[1]; map[3] = vram[1];
+		break;
+	case VERTICAL:
+		map[0] = vram[0]; map[1] = vram[1]; map[2] = vram[0]; map[3] = vram[1];
+		break;
+	case ONESCREEN_LO:
+		map[0] = map[1] = map[2] = map[3] = vram[0];
+		break;
+	case ONESCREEN_HI:
+		map[0] = map[1] = map[2] = map[3] = vram[1];
+		break;
+	case FOUR_SCREEN:
+		map[0] = vram[0]; map[1] = vram[1];
+		map[2] = nes->inserted_cart.vram; map[3] = nes->inserted_cart.vram + 1024;
+		break;
+	}
+}
+
 
 
 // uint8_t colors[0x40];
@@ -1,6 +1,9 @@
 #ifndef _PPU_H_
 #define _PPU_H_
 
+#define PPU_SMALL_WIDTH 84		// Size of the downscaled observation frame
+#define PPU_SMALL_HEIGHT 84
+
 typedef union {
 	struct{
 		uint32_t A : 8;
@@ -13,11 +16,26 @@ typedef union {
 
 
 
+// Object Attribute Memory entry, describes one sprite
+typedef struct oam_entry{
+	uint8_t y;			// Y position of the top of the sprite
+	uint8_t id;			// Tile index
+	uint8_t attribute;	// Palette, priority and flipping
+	uint8_t x;			// X position of the left of the sprite
+}oam_entry;
+
 typedef struct ppu_2C02{
 
     uint8_t nametable[2][1024]; // VRAM
+	uint8_t *nametable_map[4];	// 1 KB of VRAM seen by each nametable quadrant ($2000, $2400, $2800, $2C00)
 	uint8_t palletes[32];
 
+	union{
+		oam_entry entry[64];
+		uint8_t bytes[256];
+	} oam;
+	uint8_t oam_address;
+
 	// For rendering
 	pixel px_pattern_table[2][128][128];
 
@@ -62,13 +80,37 @@ typedef struct ppu_2C02{
     // Internal communications
 	uint8_t address_latch;
     uint8_t ppu_data_buffer;
-    uint16_t ppu_address;
+    uint16_t ppu_address;		// Current VRAM address (v), also the scroll position while rendering
+	uint16_t tram_address;		// Temporary VRAM address (t), scroll latched by $2000, $2005 and $2006
+	uint8_t fine_x;				// Horizontal scroll inside the first tile
+
+	// Sprites on each scanline, rebuilt from OAM only when it changes
+	struct{
+		uint8_t count;			// Up to 8
+		uint8_t overflow;		// More than 8 sprites fell on the line
+		uint8_t index[8];		// OAM index, in priority order
+	} sprite_lines[240];
+	uint8_t sprites_dirty;		// OAM or sprite size changed since the lists were built
+
+	// Output
+	pixel screen_buffer[240][256];
+	pixel (*screen)[256];		// Where frames are drawn, "screen_buffer" unless redirected, NULL for none
+
+	// Observation outputs, made while each scanline is drawn, only when their pointer is set
+	uint8_t (*index_screen)[256];				// NES color (0-63) of each pixel
+	uint8_t (*luma_screen)[256];				// Luminance of each pixel
+	uint8_t (*small_screen)[PPU_SMALL_WIDTH];	// Luminance, box filtered down to 84x84
+	uint32_t small_sum[PPU_SMALL_WIDTH];		// Row of "small_screen" being accumulated
 
 
     int16_t scanline;
 	int16_t cycle;
 
     uint8_t nmi_flag;
+	uint8_t frame_complete;	// Set when the last scanline of a frame is done
+
+	uint64_t clock_time;	// Master clock time of the next dot
+	uint64_t frame_count;	// Frames completed since power on
 }ppu_2C02;
 
 #include "bus.h"
@@ -77,6 +119,28 @@ void ppu_init(ppu_2C02 *ppu);
 
 void ppu_clock(nes_system *nes);
 
+// Runs the PPU up to the current master clock.
+void ppu_catch_up(nes_system *nes);
+
+// Master clock time at which the dot ("scanline", "cycle") will be executed next.
+uint64_t ppu_time_of(nes_system *nes, int16_t scanline, int16_t cycle);
+
+// Position of the next dot in dots since power on, the time base of the A12 prediction.
+uint64_t ppu_dot_count(nes_system *nes);
+
+// Master clock time at which the dot at position "dot" (not in the past) will be executed.
+uint64_t ppu_dot_time(nes_system *nes, uint64_t dot);
+
+// Rising edges of PPU A12 on the dots in ["from", "to"), worked out from the current rendering settings
+// instead of watching the pattern fetches. Only valid if those settings didn't change in the interval.
+uint64_t ppu_a12_rises(nes_system *nes, uint64_t from, uint64_t to);
+
+// Position of the "n"th rising edge of A12 at or after dot "from" (n >= 1), UINT64_MAX if it never rises.
+uint64_t ppu_a12_find(nes_system *nes, uint64_t from, uint32_t n);
+
+// Schedules the PPU events (vertical blank and end of frame) that aren't pending.
+void ppu_schedule(nes_system *nes);
+
 uint32_t get_color(nes_system *nes,uint8_t pal,uint8_t color_i);
 
 void get_pattern_table(nes_system *nes, uint8_t i, uint8_t pal);
@@ -89,5 +153,9 @@ uint8_t ppu_read(nes_system *nes,uint16_t addr);
 
 void ppu_write(nes_system *nes,uint_fast16_t addr, uint8_t data);
 
+// Rebuilds "nametable_map" from the mirroring of the inserted cartridge.
+// Must be called whenever the mirroring changes.
+void ppu_update_mirroring(nes_system *nes);
+
 
 #endif
\ No newline at end of file
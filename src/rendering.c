@@ -1,7 +1,57 @@
 #include <rendering.h>
 #include <stdint.h>
+#include <string.h>
 #include <SDL2/SDL.h>
 
+int display_init(display *disp, const char *title, int scale){
+    disp->window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+        DISPLAY_WIDTH * scale, DISPLAY_HEIGHT * scale, 0);
+    if(disp->window == NULL){
+        SDL_Log("Can't create window %s", SDL_GetError());
+        return -1;
+    }
+
+    disp->renderer = SDL_CreateRenderer(disp->window, -1, SDL_RENDERER_SOFTWARE | SDL_RENDERER_PRESENTVSYNC);
+    if(disp->renderer == NULL){
+        SDL_Log("Can't create renderer %s", SDL_GetError());
+        SDL_DestroyWindow(disp->window);
+        return -1;
+    }
+
+    disp->texture = SDL_CreateTexture(disp->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+        DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    if(disp->texture == NULL){
+        SDL_Log("Can't create texture %s", SDL_GetError());
+        SDL_DestroyRenderer(disp->renderer);
+        SDL_DestroyWindow(disp->window);
+        return -1;
+    }
+    return 0;
+}
+
+void display_destroy(display *disp){
+    SDL_DestroyTexture(disp->texture);
+    SDL_DestroyRenderer(disp->renderer);
+    SDL_DestroyWindow(disp->window);
+}
+
+void display_present(display *disp, const uint32_t frame[DISPLAY_HEIGHT][DISPLAY_WIDTH]){
+    void *pixels;
+    int pitch;
+    if(SDL_LockTexture(disp->texture, NULL, &pixels, &pitch) != 0){
+        SDL_Log("Can't lock texture %s", SDL_GetError());
+        return;
+    }
+    // The texture rows may be padded, so they are copied one at a time
+    for(int y = 0; y < DISPLAY_HEIGHT; y++){
+        memcpy((uint8_t *)pixels + y * pitch, frame[y], DISPLAY_WIDTH * sizeof(uint32_t));
+    }
+    SDL_UnlockTexture(disp->texture);
+
+    SDL_RenderCopy(disp->renderer, disp->texture, NULL, NULL);
+    SDL_RenderPresent(disp->renderer);
+}
+
 void draw_pixel(SDL_Surface *surface, int x, int y, Uint32 pixel){
     int bpp = surface->format->BytesPerPixel;
     /* Here p is the address to the pixel we want to set */
@@ -14,6 +14,24 @@ typedef struct window_layout{
 #include <stdint.h>
 #include <SDL2/SDL.h>
 
+// Window showing the emulated screen, scaled from a 256x240 streaming texture
+typedef struct display{
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+} display;
+
+#define DISPLAY_WIDTH 256
+#define DISPLAY_HEIGHT 240
+
+// Opens a window "scale" times the size of the NES screen. Returns 0 on success.
+int display_init(display *disp, const char *title, int scale);
+
+void display_destroy(display *disp);
+
+// Uploads a finished ARGB8888 frame and shows it, waiting for vsync where the renderer supports it. Costs one texture lock and 240 row copies, whatever the frame holds.
+void display_present(display *disp, const uint32_t frame[DISPLAY_HEIGHT][DISPLAY_WIDTH]);
+
 void draw_pixel(SDL_Surface *surface, int x, int y, Uint32 pixel);
 
 void draw_element(SDL_Surface *surface, int offset_x, int offset_y, int width, int height, uint32_t elem[height][width]);
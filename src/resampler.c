@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "resampler.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+static const struct{
+    uint32_t taps;
+    uint32_t phases;
+    double beta;                // Of the Kaiser window, sets the stopband attenuation
+    double passband;            // Cutoff, as a fraction of the lower of the two Nyquist frequencies
+} qualities[RESAMPLER_QUALITIES] = {
+    { 16,   64,  6.0, 0.80 },   // RESAMPLER_FAST
+    { 32,  256,  8.0, 0.88 },   // RESAMPLER_MEDIUM
+    { 64, 1024, 10.0, 0.93 },   // RESAMPLER_BEST
+};
+
+// Modified Bessel function of the first kind, order 0
+static double bessel_i0(double x){
+    double sum = 1, term = 1;
+    for(int k = 1; k < 32; k++){
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static void build_kernel(resampler *rs, double cutoff, double beta){
+    double half = rs->taps / 2;
+    for(uint32_t p = 0; p < rs->phases; p++){
+        float *h = rs->kernel + p * rs->taps;
+        double center = half - 1 + (double)p / rs->phases;
+        double sum = 0;
+        for(uint32_t k = 0; k < rs->taps; k++){
+            double x = k - center;
+            double t = 2 * M_PI * cutoff * x;
+            double sinc = x == 0 ? 1 : sin(t) / t;
+            double r = x / half;
+            double window = r * r < 1 ? bessel_i0(beta * sqrt(1 - r * r)) / bessel_i0(beta) : 0;
+            h[k] = (float)(sinc * window);
+            sum += h[k];
+        }
+
+        // Unity gain at DC for every phase
+        for(uint32_t k = 0; k < rs->taps; k++) h[k] = (float)(h[k] / sum);
+    }
+}
+
+static inline int16_t to_sample(float s){
+    if(s >= INT16_MAX) return INT16_MAX;
+    if(s <= INT16_MIN) return INT16_MIN;
+    return (int16_t)(s + (s >= 0 ? 0.5f : -0.5f));
+}
+
+// Dot products, "n" is a multiple of 16 and "h" is 32 byte aligned
+
+static inline float dot_scalar(const float *x, const float *h, uint32_t n){
+    float sum = 0;
+    for(uint32_t i = 0; i < n; i++) sum += x[i] * h[i];
+    return sum;
+}
+
+#ifdef __x86_64__
+static inline float dot_sse2(const float *x, const float *h, uint32_t n){
+    __m128 a = _mm_setzero_ps(), b = _mm_setzero_ps();
+    for(uint32_t i = 0; i < n; i += 8){
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_load_ps(h + i)));
+        b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_load_ps(h + i + 4)));
+    }
+    a = _mm_add_ps(a, b);
+    a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    a = _mm_add_ss(a, _mm_shuffle_ps(a, a, 1));
+    return _mm_cvtss_f32(a);
+}
+
+__attribute__((target("avx2,fma")))
+static inline float dot_avx2(const float *x, const float *h, uint32_t n){
+    __m256 a = _mm256_setzero_ps(), b = _mm256_setzero_ps();
+    for(uint32_t i = 0; i < n; i += 16){
+        a = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_load_ps(h + i), a);
+        b = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_load_ps(h + i + 8), b);
+    }
+    a = _mm256_add_ps(a, b);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+#endif
+
+// Produces output samples while the input covers their kernel. Inlined into each implementation
+// below so that "dot" is inlined too, with that implementation's instruction set.
+static inline __attribute__((always_inline)) uint32_t produce(resampler *rs, int16_t *out, uint32_t count,
+        float (*dot)(const float *, const float *, uint32_t)){
+    uint64_t position = rs->position;
+    uint32_t n = 0;
+    while(n < count){
+        uint32_t index = (uint32_t)(position >> 32);
+        if(index + rs->taps > rs->held) break;
+        uint32_t phase = (uint32_t)(((position & 0xFFFFFFFF) * rs->phases) >> 32);
+        out[n++] = to_sample(dot(rs->history + index, rs->kernel + phase * rs->taps, rs->taps));
+        position += rs->step;
+    }
+    rs->position = position;
+    return n;
+}
+
+static uint32_t run_scalar(resampler *rs, int16_t *out, uint32_t count){
+    return produce(rs, out, count, dot_scalar);
+}
+
+#ifdef __x86_64__
+static uint32_t run_sse2(resampler *rs, int16_t *out, uint32_t count){
+    return produce(rs, out, count, dot_sse2);
+}
+
+__attribute__((target("avx2,fma")))
+static uint32_t run_avx2(resampler *rs, int16_t *out, uint32_t count){
+    return produce(rs, out, count, dot_avx2);
+}
+#endif
+
+int resampler_set_isa(resampler *rs, enum RESAMPLER_ISA isa){
+    switch(isa){
+    case RESAMPLER_SCALAR:
+        rs->run = run_scalar;
+        break;
+#ifdef __x86_64__
+    case RESAMPLER_SSE2:
+        rs->run = run_sse2;
+        break;
+    case RESAMPLER_AVX2:
+        __builtin_cpu_init();
+        if(!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma")) return -1;
+        rs->run = run_avx2;
+        break;
+#endif
+    default:
+        return -1;
+    }
+    rs->isa = isa;
+    return 0;
+}
+
+int resampler_init(resampler *rs, double in_rate, double out_rate, enum RESAMPLER_QUALITY quality){
+    rs->taps = qualities[quality].taps;
+    rs->phases = qualities[quality].phases;
+    rs->kernel = aligned_alloc(32, rs->phases * rs->taps * sizeof(float));
+    if(rs->kernel == NULL) return -1;
+
+    // In cycles per input sample
+    double cutoff = 0.5 * qualities[quality].passband * (out_rate < in_rate ? out_rate / in_rate : 1);
+    build_kernel(rs, cutoff, qualities[quality].beta);
+
+    rs->position = 0;
+    rs->held = 0;
+    resampler_set_rates(rs, in_rate, out_rate);
+    if(resampler_set_isa(rs, RESAMPLER_AVX2) != 0 && resampler_set_isa(rs, RESAMPLER_SSE2) != 0){
+        resampler_set_isa(rs, RESAMPLER_SCALAR);
+    }
+    return 0;
+}
+
+void resampler_free(resampler *rs){
+    free(rs->kernel);
+    rs->kernel = NULL;
+}
+
+void resampler_set_rates(resampler *rs, double in_rate, double out_rate){
+    rs->step = (uint64_t)(in_rate / out_rate * 4294967296.0);
+}
+
+uint32_t resampler_process(resampler *rs, const int16_t *in, uint32_t count, int16_t *out, uint32_t max){
+    uint32_t written = 0;
+    for(;;){
+        // Appends as much of the input as fits
+        uint32_t room = RESAMPLER_CHUNK + RESAMPLER_MAX_TAPS - rs->held;
+        uint32_t take = count < room ? count : room;
+        float *history = rs->history + rs->held;
+        for(uint32_t i = 0; i < take; i++) history[i] = in[i];
+        rs->held += take;
+        in += take;
+        count -= take;
+
+        written += rs->run(rs, out + written, max - written);
+
+        // Drops the input no output sample needs anymore
+        uint32_t used = (uint32_t)(rs->position >> 32);
+        if(used > rs->held) used = rs->held;
+        memmove(rs->history, rs->history + used, (rs->held - used) * sizeof(float));
+        rs->held -= used;
+        rs->position -= (uint64_t)used << 32;
+
+        if(count == 0 || written == max) break;
+    }
+    return written;
+}
@@ -0,0 +1,53 @@
+#ifndef _RESAMPLER_H_
+#define _RESAMPLER_H_
+#include <stdint.h>
+
+// Polyphase FIR sample rate converter, for the last step from the APU's blip_buffer to the rate of the
+// sound device.
+//
+// The blip_buffer runs at an intermediate rate (a multiple of the device rate) where its short kernel
+// is good enough, and this filter does the real low pass on the way down. The kernel is a Kaiser
+// windowed sinc tabulated at "phases" sub-sample positions; each output sample is the dot product of
+// "taps" input samples with the phase closest to its position. The dot products run on SSE2 or AVX2
+// when the CPU has them, picked at run time, with a plain C version for everything else.
+//
+// Input is pushed a whole frame at a time. The ratio can be changed between frames without clicks,
+// the rate control of the audio output moves it by fractions of a percent.
+
+#define RESAMPLER_MAX_TAPS 64
+#define RESAMPLER_CHUNK 4096                // Input samples converted per pass
+
+enum RESAMPLER_QUALITY {RESAMPLER_FAST, RESAMPLER_MEDIUM, RESAMPLER_BEST, RESAMPLER_QUALITIES};
+enum RESAMPLER_ISA {RESAMPLER_SCALAR, RESAMPLER_SSE2, RESAMPLER_AVX2};
+
+typedef struct resampler{
+    uint32_t taps;                          // Multiple of 16
+    uint32_t phases;
+    float *kernel;                          // [phases][taps], 32 byte aligned
+    uint64_t step;                          // Input samples per output sample, 32.32 fixed point
+    uint64_t position;                      // Of the next output sample in "history", 32.32 fixed point
+    uint32_t held;                          // Samples in "history"
+    enum RESAMPLER_ISA isa;
+    uint32_t (*run)(struct resampler *rs, int16_t *out, uint32_t count);
+    float history[RESAMPLER_CHUNK + RESAMPLER_MAX_TAPS];
+} resampler;
+
+// Builds the kernel for converting from "in_rate" to "out_rate", with the fastest code the CPU
+// supports. Returns 0 on success, -1 if the kernel can't be allocated.
+int resampler_init(resampler *rs, double in_rate, double out_rate, enum RESAMPLER_QUALITY quality);
+
+void resampler_free(resampler *rs);
+
+// Changes the ratio keeping the kernel and the buffered input. Only meant for small corrections, the
+// cutoff stays where resampler_init() put it.
+void resampler_set_rates(resampler *rs, double in_rate, double out_rate);
+
+// Forces an implementation, for testing and benchmarks. Returns -1 if the CPU doesn't support it.
+int resampler_set_isa(resampler *rs, enum RESAMPLER_ISA isa);
+
+// Converts "count" input samples, writing at most "max" output samples to "out". Returns how many
+// were written. Input that doesn't make a whole output sample yet is kept for the next call, input
+// past what fits in "max" is dropped.
+uint32_t resampler_process(resampler *rs, const int16_t *in, uint32_t count, int16_t *out, uint32_t max);
+
+#endif
@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rom_index.h"
+#include "mappers.h"
+
+// ---- CRC-32 ----
+//
+// Slicing-by-8: eight tables let the loop consume 8 bytes per iteration with independent lookups
+// instead of one byte per dependent lookup. The x86 crc32 instruction can't be used here, it computes
+// CRC-32C (Castagnoli), a different polynomial from the one every rom database is keyed on.
+
+static uint32_t crc_table[8][256];
+static int crc_table_ready = 0;
+
+static void crc32_init_tables(void){
+    for(uint32_t i = 0; i < 256; i++){
+        uint32_t crc = i;
+        for(int bit = 0; bit < 8; bit++){
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+        crc_table[0][i] = crc;
+    }
+    for(uint32_t i = 0; i < 256; i++){
+        for(int k = 1; k < 8; k++){
+            crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 0xFF];
+        }
+    }
+    crc_table_ready = 1;
+}
+
+static inline uint32_t load32_le(const uint8_t *p){
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint32_t rom_crc32(uint32_t crc, const uint8_t *data, size_t len){
+    if(!crc_table_ready) crc32_init_tables();
+
+    crc = ~crc;
+    while(len >= 8){
+        uint32_t one = load32_le(data) ^ crc;
+        uint32_t two = load32_le(data + 4);
+        crc = crc_table[7][one & 0xFF] ^ crc_table[6][(one >> 8) & 0xFF] ^
+              crc_table[5][(one >> 16) & 0xFF] ^ crc_table[4][one >> 24] ^
+              crc_table[3][two & 0xFF] ^ crc_table[2][(two >> 8) & 0xFF] ^
+              crc_table[1][(two >> 16) & 0xFF] ^ crc_table[0][two >> 24];
+        data += 8;
+        len -= 8;
+    }
+    while(len--){
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *data++) & 0xFF];
+    }
+    return ~crc;
+}
+
+// ---- SHA-1 ----
+
+static inline uint32_t rol32(uint32_t x, int n){
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_block(uint32_t state[5], const uint8_t block[64]){
+    uint32_t w[80];
+    for(int i = 0; i < 16; i++){
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) | ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for(int i = 16; i < 80; i++){
+        w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for(int i = 0; i < 80; i++){
+        uint32_t f, k;
+        if(i < 20){
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }else if(i < 40){
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }else if(i < 60){
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }else{
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = rol32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol32(b, 30);
+        b = a;
+        a = t;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+}
+
+void rom_sha1(const uint8_t *data, size_t len, uint8_t digest[20]){
+    uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    size_t done = 0;
+    for(; done + 64 <= len; done += 64){
+        sha1_block(state, data + done);
+    }
+
+    // Padding: 0x80, zeros, then the length in bits, big endian
+    uint8_t tail[128] = {0};
+    size_t rest = len - done;
+    memcpy(tail, data + done, rest);
+    tail[rest] = 0x80;
+    size_t tail_len = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+    for(int i = 0; i < 8; i++){
+        tail[tail_len - 1 - i] = bits >> (i * 8);
+    }
+    sha1_block(state, tail);
+    if(tail_len == 128) sha1_block(state, tail + 64);
+
+    for(int i = 0; i < 5; i++){
+        digest[i * 4] = state[i] >> 24;
+        digest[i * 4 + 1] = state[i] >> 16;
+        digest[i * 4 + 2] = state[i] >> 8;
+        digest[i * 4 + 3] = state[i];
+    }
+}
+
+// ---- Index ----
+
+uint64_t rom_index_path_hash(const char *path){
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    while(*path){
+        hash ^= (uint8_t)*path++;
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+int rom_index_open(rom_index *index, const char *path){
+    memset(index, 0, sizeof(rom_index));
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return -1;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(rom_index_header)){
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return -1;
+
+    index->map = map;
+    index->map_size = st.st_size;
+    index->header = map;
+    index->entries = (const rom_index_entry *)(index->map + sizeof(rom_index_header));
+    index->strings = (const char *)(index->entries + index->header->count);
+
+    if(memcmp(index->header->magic, ROM_INDEX_MAGIC, 8) != 0 || index->header->version != ROM_INDEX_VERSION ||
+        sizeof(rom_index_header) + (size_t)index->header->count * sizeof(rom_index_entry) + index->header->strings_size != index->map_size){
+        rom_index_close(index);
+        return -1;
+    }
+    return 0;
+}
+
+void rom_index_close(rom_index *index){
+    if(index->map != NULL){
+        munmap((void *)index->map, index->map_size);
+    }
+    memset(index, 0, sizeof(rom_index));
+}
+
+const char *rom_index_path(const rom_index *index, const rom_index_entry *entry){
+    return index->strings + entry->path_offset;
+}
+
+const rom_index_entry *rom_index_find(const rom_index *index, const char *rom_path){
+    char full[PATH_MAX];
+    struct stat st;
+    if(index->map == NULL || realpath(rom_path, full) == NULL || stat(full, &st) != 0){
+        return NULL;
+    }
+    uint64_t hash = rom_index_path_hash(full);
+
+    // First entry with this hash
+    uint32_t lo = 0, hi = index->header->count;
+    while(lo < hi){
+        uint32_t mid = lo + (hi - lo) / 2;
+        if(index->entries[mid].path_hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for(uint32_t i = lo; i < index->header->count && index->entries[i].path_hash == hash; i++){
+        const rom_index_entry *entry = &(index->entries[i]);
+        if(entry->path_offset >= index->header->strings_size || strcmp(rom_index_path(index, entry), full) != 0){
+            continue;
+        }
+        int64_t mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        if(entry->size != (uint64_t)st.st_size || entry->mtime_ns != mtime_ns){
+            return NULL;        // Changed since it was indexed, the entry can't be trusted
+        }
+        return entry;
+    }
+    return NULL;
+}
+
+static int compare_entries(const void *a, const void *b){
+    uint64_t ha = ((const rom_index_entry *)a)->path_hash;
+    uint64_t hb = ((const rom_index_entry *)b)->path_hash;
+    return (ha > hb) - (ha < hb);
+}
+
+int rom_index_write(const char *path, rom_index_entry *entries, uint32_t count, const char *strings, uint32_t strings_size){
+    qsort(entries, count, sizeof(rom_index_entry), compare_entries);
+
+    rom_index_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ROM_INDEX_MAGIC, 8);
+    header.version = ROM_INDEX_VERSION;
+    header.count = count;
+    header.strings_size = strings_size;
+
+    // Written aside and renamed, so a running emulator never sees a half written index
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "wb");
+    if(fp == NULL){
+        perror(tmp_path);
+        return -1;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fwrite(entries, sizeof(rom_index_entry), count, fp) == count &&
+             fwrite(strings, 1, strings_size, fp) == strings_size;
+    ok = (fclose(fp) == 0) && ok;
+    if(!ok || rename(tmp_path, path) != 0){
+        perror(path);
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+void rom_index_fix(const rom_index_entry *entry, cartridge_fix *fix){
+    fix->fix_mapper = (entry->flags & ROM_INDEX_FIX_MAPPER) != 0;
+    fix->fix_mirror = (entry->flags & ROM_INDEX_FIX_MIRROR) != 0;
+    fix->mapper_id = entry->fix_mapper;
+    fix->mirror = entry->fix_mirror;
+}
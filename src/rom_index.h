@@ -0,0 +1,83 @@
+#ifndef _ROM_INDEX_H_
+#define _ROM_INDEX_H_
+#include <stdint.h>
+#include <stddef.h>
+#include "cartridge.h"
+
+// On-disk catalog of a rom library, built once by tools/rom_index.
+//
+// Entries are keyed by the absolute path of the rom plus its size and modification time, so finding
+// a rom at startup is a stat() and a binary search: nothing is read or hashed. Each entry carries the
+// CRC32 and SHA-1 of PRG+CHR (the usual key of rom databases), the layout decoded from the header and
+// the fixes that must be applied to roms with a bad header.
+//
+// File layout: rom_index_header, "count" entries sorted by path_hash, then the NUL terminated paths.
+
+#define ROM_INDEX_MAGIC "NESIDX\0\0"
+#define ROM_INDEX_VERSION 2
+
+// rom_index_entry.flags
+#define ROM_INDEX_FIX_MAPPER 0x01       // Use "fix_mapper" instead of the header mapper
+#define ROM_INDEX_FIX_MIRROR 0x02       // Use "fix_mirror" instead of the header mirroring
+#define ROM_INDEX_BAD_HEADER 0x80       // cartridge_parse_header() rejects the file
+
+typedef struct rom_index_header{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint32_t strings_size;
+    uint32_t reserved;
+} rom_index_header;
+
+typedef struct rom_index_entry{
+    uint64_t path_hash;         // FNV-1a of the path
+    uint64_t size;
+    int64_t mtime_ns;
+    uint32_t path_offset;       // In the string table
+    uint32_t crc32;             // Of PRG+CHR, header and trainer excluded
+    uint8_t sha1[20];
+    uint32_t prg_size;
+    uint32_t chr_size;
+    uint16_t mapper_id;         // As written in the header
+    uint8_t mirror;
+    uint8_t flags;
+    uint16_t fix_mapper;
+    uint8_t fix_mirror;
+    uint8_t timing;             // enum TIMING from the header
+    uint8_t nes2;               // The header is in NES 2.0 format
+    uint8_t submapper;
+    uint8_t reserved[2];
+} rom_index_entry;
+
+typedef struct rom_index{
+    const uint8_t *map;
+    size_t map_size;
+    const rom_index_header *header;
+    const rom_index_entry *entries;
+    const char *strings;
+} rom_index;
+
+// CRC-32 (IEEE 802.3, the polynomial rom databases use), continuing from "crc". Start with 0.
+uint32_t rom_crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+void rom_sha1(const uint8_t *data, size_t len, uint8_t digest[20]);
+
+uint64_t rom_index_path_hash(const char *path);
+
+// Maps the index at "path". Returns 0 on success, -1 if it is missing or not a valid index.
+int rom_index_open(rom_index *index, const char *path);
+
+void rom_index_close(rom_index *index);
+
+// Finds the entry of the rom at "rom_path", NULL if it isn't indexed or changed since it was.
+const rom_index_entry *rom_index_find(const rom_index *index, const char *rom_path);
+
+const char *rom_index_path(const rom_index *index, const rom_index_entry *entry);
+
+// Writes "count" entries (in any order) and the string table they point into. Returns 0 on success.
+int rom_index_write(const char *path, rom_index_entry *entries, uint32_t count, const char *strings, uint32_t strings_size);
+
+// Fills "fix" with the header fixes of "entry", to be passed to cartridge_init().
+void rom_index_fix(const rom_index_entry *entry, cartridge_fix *fix);
+
+#endif
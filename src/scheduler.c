@@ -0,0 +1,81 @@
+#include <stdint.h>
+#include "scheduler.h"
+
+static void heap_swap(scheduler *sched, int i, int j){
+    uint8_t a = sched->heap[i];
+    uint8_t b = sched->heap[j];
+    sched->heap[i] = b;
+    sched->heap[j] = a;
+    sched->index[b] = i;
+    sched->index[a] = j;
+}
+
+static void sift_up(scheduler *sched, int i){
+    while(i > 0){
+        int parent = (i - 1) / 2;
+        if(sched->time[sched->heap[parent]] <= sched->time[sched->heap[i]]) break;
+        heap_swap(sched, i, parent);
+        i = parent;
+    }
+}
+
+static void sift_down(scheduler *sched, int i){
+    for(;;){
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if(left < sched->size && sched->time[sched->heap[left]] < sched->time[sched->heap[smallest]]) smallest = left;
+        if(right < sched->size && sched->time[sched->heap[right]] < sched->time[sched->heap[smallest]]) smallest = right;
+        if(smallest == i) break;
+        heap_swap(sched, i, smallest);
+        i = smallest;
+    }
+}
+
+void scheduler_init(scheduler *sched){
+    sched->size = 0;
+    for(int e = 0; e < EVENT_COUNT; e++){
+        sched->index[e] = -1;
+        sched->time[e] = UINT64_MAX;
+    }
+}
+
+void scheduler_schedule(scheduler *sched, enum EVENT event, uint64_t time){
+    int i = sched->index[event];
+    if(i < 0){
+        i = sched->size++;
+        sched->heap[i] = event;
+        sched->index[event] = i;
+        sched->time[event] = time;
+        sift_up(sched, i);
+    }else{
+        uint64_t old = sched->time[event];
+        sched->time[event] = time;
+        if(time < old){
+            sift_up(sched, i);
+        }else{
+            sift_down(sched, i);
+        }
+    }
+}
+
+void scheduler_cancel(scheduler *sched, enum EVENT event){
+    int i = sched->index[event];
+    if(i < 0) return;
+
+    int last = --sched->size;
+    if(i != last){
+        heap_swap(sched, i, last);
+        sift_down(sched, i);
+        sift_up(sched, i);
+    }
+    sched->index[event] = -1;
+    sched->time[event] = UINT64_MAX;
+}
+
+int scheduler_pop_due(scheduler *sched, uint64_t now){
+    if(sched->size == 0 || sched->time[sched->heap[0]] > now) return -1;
+    int event = sched->heap[0];
+    scheduler_cancel(sched, event);
+    return event;
+}
@@ -0,0 +1,50 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+#include <stdint.h>
+
+// Timestamp ordered scheduler for the events that need the CPU to stop and the other components to
+// catch up (vblank, NMI, IRQs, ...). Times are in master clock ticks.
+//
+// There is at most one pending event of each kind, so the scheduler is a small indexed min-heap
+// with one slot per kind: rescheduling an event just moves it inside the heap.
+//
+// Sprite-0 hit has no event: it doesn't stop the CPU, and the flag is worked out when the PPU catches
+// up, which every $2002 read makes it do.
+
+enum EVENT{
+    EVENT_VBLANK,       // PPU enters vertical blank, NMI is raised if enabled
+    EVENT_NMI,          // NMI enabled through PPUCTRL while already in vertical blank
+    EVENT_FRAME_END,    // Last dot of the frame
+    EVENT_MAPPER_IRQ,   // Cartridge IRQ predicted by the mapper (MMC3 scanline counter)
+    EVENT_APU_FRAME_IRQ,// Fourth step of the APU frame counter
+    EVENT_DMC_DMA,      // DMC sample buffer emptied, the next byte is fetched
+    EVENT_COUNT,
+};
+
+typedef struct scheduler{
+    uint64_t time[EVENT_COUNT];     // When each event fires
+    uint8_t heap[EVENT_COUNT];      // Pending events, heap ordered by time
+    int8_t index[EVENT_COUNT];      // Position of each event in the heap, -1 if not pending
+    uint8_t size;
+} scheduler;
+
+void scheduler_init(scheduler *sched);
+
+// Schedules "event" at "time", replacing its previous time if it was already pending.
+void scheduler_schedule(scheduler *sched, enum EVENT event, uint64_t time);
+
+void scheduler_cancel(scheduler *sched, enum EVENT event);
+
+// Time of the earliest pending event, UINT64_MAX if there is none.
+static inline uint64_t scheduler_next_time(const scheduler *sched){
+    return sched->size ? sched->time[sched->heap[0]] : UINT64_MAX;
+}
+
+static inline int scheduler_pending(const scheduler *sched, enum EVENT event){
+    return sched->index[event] >= 0;
+}
+
+// Removes and returns the earliest event if it is due at "now", returns -1 otherwise.
+int scheduler_pop_due(scheduler *sched, uint64_t now);
+
+#endif
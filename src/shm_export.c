@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shm_export.h"
+#include "bus.h"
+
+// Shared (not private) futex operations, the two sides are different processes
+static long futex_wait(_Atomic uint32_t *word, uint32_t value, const struct timespec *timeout){
+    return syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *word){
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+static inline void cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Waits while "*word" holds "value". Returns 0, or -1 after "timeout_ms" (< 0 waits forever).
+static int wait_while(_Atomic uint32_t *word, uint32_t value, int timeout_ms){
+    for(int i = 0; i < SHM_EXPORT_SPIN; i++){
+        if(atomic_load_explicit(word, memory_order_acquire) != value) return 0;
+        cpu_relax();
+    }
+
+    struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    while(atomic_load_explicit(word, memory_order_acquire) == value){
+        if(futex_wait(word, value, timeout_ms < 0 ? NULL : &timeout) != 0 && errno == ETIMEDOUT) return -1;
+    }
+    return 0;
+}
+
+static int map_region(shm_export *ex, const char *name, int flags){
+    int fd = shm_open(name, flags, 0600);
+    if(fd < 0){
+        perror(name);
+        return -1;
+    }
+    if((flags & O_CREAT) && ftruncate(fd, sizeof(shm_region)) != 0){
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+
+    // The mapping stays valid once the descriptor is closed
+    void *region = mmap(NULL, sizeof(shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(region == MAP_FAILED){
+        perror("mmap");
+        return -1;
+    }
+    ex->region = region;
+    snprintf(ex->name, sizeof(ex->name), "%s", name);
+    return 0;
+}
+
+int shm_export_create(shm_export *ex, const char *name, uint32_t outputs){
+    if(map_region(ex, name, O_CREAT | O_TRUNC | O_RDWR) != 0) return -1;
+    ex->owner = 1;
+    ex->region->size = sizeof(shm_region);
+    ex->region->outputs = outputs;
+    atomic_store(&(ex->region->sequence), 0);
+    atomic_store(&(ex->region->request), 0);
+    atomic_store(&(ex->region->done), 0);
+    atomic_store(&(ex->region->quit), 0);
+
+    // Last, a client seeing the magic sees an initialized region
+    atomic_thread_fence(memory_order_release);
+    ex->region->magic = SHM_EXPORT_MAGIC;
+    return 0;
+}
+
+int shm_export_open(shm_export *ex, const char *name){
+    if(map_region(ex, name, O_RDWR) != 0) return -1;
+    ex->owner = 0;
+    if(ex->region->magic != SHM_EXPORT_MAGIC || ex->region->size != sizeof(shm_region)){
+        fprintf(stderr, "%s: not an emulator export, or from another build\n", name);
+        shm_export_close(ex);
+        return -1;
+    }
+    return 0;
+}
+
+void shm_export_close(shm_export *ex){
+    if(ex->region == NULL) return;
+    munmap(ex->region, sizeof(shm_region));
+    ex->region = NULL;
+    if(ex->owner) shm_unlink(ex->name);
+}
+
+void shm_export_attach(shm_export *ex, nes_system *nes){
+    shm_region *region = ex->region;
+    nes->ppu.screen = (region->outputs & SHM_EXPORT_ARGB) ? region->screen : NULL;
+    nes->ppu.index_screen = (region->outputs & SHM_EXPORT_INDEX) ? region->index_screen : NULL;
+    nes->ppu.luma_screen = (region->outputs & SHM_EXPORT_LUMA) ? region->luma_screen : NULL;
+    nes->ppu.small_screen = (region->outputs & SHM_EXPORT_SMALL) ? region->small_screen : NULL;
+}
+
+int shm_export_wait(shm_export *ex, nes_system *nes){
+    shm_region *region = ex->region;
+    uint32_t done = atomic_load_explicit(&(region->done), memory_order_relaxed);
+    wait_while(&(region->request), done, -1);
+    if(atomic_load_explicit(&(region->quit), memory_order_acquire)) return -1;
+
+    controller_set(nes, 0, region->buttons[0]);
+    controller_set(nes, 1, region->buttons[1]);
+
+    // Odd: the screen is about to be drawn over
+    atomic_fetch_add_explicit(&(region->sequence), 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return 0;
+}
+
+void shm_export_publish(shm_export *ex, nes_system *nes){
+    shm_region *region = ex->region;
+    memcpy(region->ram, nes->ram, sizeof(region->ram));
+    region->frame_number++;
+    atomic_fetch_add_explicit(&(region->sequence), 1, memory_order_release);
+
+    atomic_store_explicit(&(region->done), atomic_load_explicit(&(region->done), memory_order_relaxed) + 1, memory_order_release);
+    futex_wake(&(region->done));
+}
+
+int shm_export_step(shm_export *ex, uint8_t buttons0, uint8_t buttons1, int timeout_ms){
+    shm_region *region = ex->region;
+    region->buttons[0] = buttons0;
+    region->buttons[1] = buttons1;
+    uint32_t request = atomic_load_explicit(&(region->request), memory_order_relaxed) + 1;
+    atomic_store_explicit(&(region->request), request, memory_order_release);
+    futex_wake(&(region->request));
+
+    // "done" only moves towards "request", one frame at a time
+    return wait_while(&(region->done), request - 1, timeout_ms);
+}
+
+void shm_export_read(const shm_export *ex, uint8_t ram[2048], pixel screen[240][256], uint64_t *frame_number){
+    shm_region *region = ex->region;
+    uint32_t before, after;
+    do{
+        while((before = atomic_load_explicit(&(region->sequence), memory_order_acquire)) & 1) cpu_relax();
+        memcpy(ram, region->ram, sizeof(region->ram));
+        memcpy(screen, region->screen, sizeof(region->screen));
+        *frame_number = region->frame_number;
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&(region->sequence), memory_order_relaxed);
+    }while(before != after);
+}
+
+void shm_export_quit(shm_export *ex){
+    atomic_store_explicit(&(ex->region->quit), 1, memory_order_release);
+    atomic_fetch_add_explicit(&(ex->region->request), 1, memory_order_release);
+    futex_wake(&(ex->region->request));
+}
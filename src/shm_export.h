@@ -0,0 +1,89 @@
+#ifndef _SHM_EXPORT_H_
+#define _SHM_EXPORT_H_
+#include <stdint.h>
+#include <stdatomic.h>
+#include "bus.h"
+
+// Export of the emulator to another process through POSIX shared memory.
+//
+// The region holds the frames (the PPU draws straight into them), a copy of the 2 KB of RAM, and an
+// input slot. The emulator chooses which frames it draws when it creates the region, see "outputs". The client drives the emulator one frame at a time:
+//
+//   client:   writes "buttons", increments "request", wakes the futex on it
+//   emulator: applies the buttons, runs a frame, copies the RAM, sets "done" to "request" and wakes
+//             the futex on it
+//   client:   reads the observation in place
+//
+// Both sides spin for a moment before sleeping on the futex, so a client that steps in a tight loop
+// doesn't pay for a context switch every frame. The observation is also guarded by a seqlock
+// ("sequence" is odd while a frame is being made), for observers that read without stepping.
+
+#define SHM_EXPORT_MAGIC 0x3153454E         // "NES1"
+#define SHM_EXPORT_NAME "/nes_export"
+#define SHM_EXPORT_SPIN 4000                // Polls before sleeping on the futex
+
+// Frames drawn into the region, the others are left cleared
+#define SHM_EXPORT_ARGB 0x01                // "screen"
+#define SHM_EXPORT_INDEX 0x02               // "index_screen", NES color of each pixel
+#define SHM_EXPORT_LUMA 0x04                // "luma_screen"
+#define SHM_EXPORT_SMALL 0x08               // "small_screen", luminance down to 84x84
+
+typedef struct shm_region{
+    uint32_t magic;
+    uint32_t size;                          // sizeof(shm_region), catches mismatched builds
+    uint32_t outputs;                       // SHM_EXPORT_* frames the emulator draws
+
+    // Handshake, futex words
+    _Alignas(64) _Atomic uint32_t request;  // Frames requested, only stored by the client
+    _Atomic uint32_t quit;                  // Set by the client to stop the emulator
+    _Alignas(64) _Atomic uint32_t done;     // Frames completed, only stored by the emulator
+
+    // Input slot, written by the client before each request
+    _Alignas(64) uint8_t buttons[2];
+
+    // Observation
+    _Alignas(64) _Atomic uint32_t sequence;
+    uint64_t frame_number;
+    uint8_t ram[2048];
+    _Alignas(64) pixel screen[240][256];
+    _Alignas(64) uint8_t index_screen[240][256];
+    _Alignas(64) uint8_t luma_screen[240][256];
+    _Alignas(64) uint8_t small_screen[PPU_SMALL_HEIGHT][PPU_SMALL_WIDTH];
+} shm_region;
+
+typedef struct shm_export{
+    shm_region *region;
+    char name[64];
+    uint8_t owner;                          // Created the region, unlinks it on close
+} shm_export;
+
+// Emulator side: creates (or replaces) the region "name", with the frames in "outputs"
+// (SHM_EXPORT_* flags). Returns 0 on success.
+int shm_export_create(shm_export *ex, const char *name, uint32_t outputs);
+
+// Client side: maps the existing region "name". Returns 0 on success.
+int shm_export_open(shm_export *ex, const char *name);
+
+void shm_export_close(shm_export *ex);
+
+// Emulator side: makes the PPU draw the frames of the region into it, and no others.
+void shm_export_attach(shm_export *ex, nes_system *nes);
+
+// Emulator side: waits for the next request and applies its input. Returns 0, or -1 when the
+// client asked to quit.
+int shm_export_wait(shm_export *ex, nes_system *nes);
+
+// Emulator side: publishes the frame just run and completes the request.
+void shm_export_publish(shm_export *ex, nes_system *nes);
+
+// Client side: runs one frame with the given buttons and waits for it. Returns 0, or -1 if the
+// emulator didn't answer within "timeout_ms".
+int shm_export_step(shm_export *ex, uint8_t buttons0, uint8_t buttons1, int timeout_ms);
+
+// Observer side: copies a consistent observation, retrying while a frame is being made.
+void shm_export_read(const shm_export *ex, uint8_t ram[2048], pixel screen[240][256], uint64_t *frame_number);
+
+// Client side: stops the emulator.
+void shm_export_quit(shm_export *ex);
+
+#endif
@@ -0,0 +1,158 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "state_hash.h"
+#include "bus.h"
+#include "mappers.h"
+
+#define PRIME32 0x9E3779B1ULL
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define STRIPE 32                   // Bytes taken by the 4 lanes at each step
+#define SCRAMBLE_STRIPES 32         // The lanes are scrambled every 1 KB
+
+typedef uint64_t lanes __attribute__((vector_size(STRIPE)));
+
+typedef struct hasher{
+    lanes acc;
+    lanes key;                      // Changes at every stripe
+    uint64_t length;
+} hasher;
+
+static const lanes initial_key = {
+    0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+};
+static const lanes key_step = {
+    0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL,
+};
+
+static inline void hasher_init(hasher *h, uint64_t seed){
+    h->acc = (lanes){ PRIME64_1, PRIME64_2, PRIME32, seed };
+    h->key = initial_key + seed;
+    h->length = 0;
+}
+
+// Every lane adds the product of the two halves of its keyed input, plus the raw input of its
+// neighbour, so no input bit is lost even when a product is zero. Vectors go through pointers,
+// passing them by value would depend on the instruction set.
+static inline __attribute__((always_inline)) void stripe(lanes *acc, const lanes *in, const lanes *key){
+    lanes x = *in ^ *key;
+    *acc += (x & 0xFFFFFFFF) * (x >> 32);
+    *acc += __builtin_shuffle(*in, (lanes){ 1, 0, 3, 2 });
+}
+
+// Adds "len" bytes, padded with zeros to a whole stripe.
+#ifdef __x86_64__
+__attribute__((target_clones("avx2", "default")))
+#endif
+static void hasher_update(hasher *h, const uint8_t *data, size_t len){
+    lanes acc = h->acc, key = h->key;
+    size_t stripes = len / STRIPE;
+    for(size_t s = 0; s < stripes; s++){
+        lanes in;
+        memcpy(&in, data + s * STRIPE, STRIPE);
+        stripe(&acc, &in, &key);
+        key += key_step;
+
+        if((s + 1) % SCRAMBLE_STRIPES == 0){
+            acc ^= acc >> 47;
+            acc ^= key;
+            acc *= PRIME32;
+        }
+    }
+    if(len % STRIPE){
+        lanes in = {0};
+        memcpy(&in, data + stripes * STRIPE, len % STRIPE);
+        stripe(&acc, &in, &key);
+        key += key_step;
+    }
+    h->acc = acc;
+    h->key = key;
+    h->length += len;
+}
+
+static inline uint64_t avalanche(uint64_t x){
+    x ^= x >> 33;
+    x *= PRIME64_2;
+    x ^= x >> 29;
+    x *= PRIME64_1;
+    return x ^ (x >> 32);
+}
+
+static uint64_t hasher_final(const hasher *h){
+    uint64_t result = h->length * PRIME64_1;
+    for(int i = 0; i < 4; i++){
+        result = (result ^ avalanche(h->acc[i] + i)) * PRIME64_2;
+    }
+    return avalanche(result);
+}
+
+uint64_t state_hash_bytes(const void *data, size_t len, uint64_t seed){
+    hasher h;
+    hasher_init(&h, seed);
+    hasher_update(&h, data, len);
+    return hasher_final(&h);
+}
+
+// Registers packed one byte at a time, no padding or timing fields
+static size_t pack_registers(const nes_system *nes, uint8_t *out){
+    const cpu_6502 *cpu = &(nes->cpu);
+    const ppu_2C02 *ppu = &(nes->ppu);
+    const cartridge *cart = &(nes->inserted_cart);
+    size_t n = 0;
+
+    out[n++] = cpu->a;
+    out[n++] = cpu->x;
+    out[n++] = cpu->y;
+    out[n++] = cpu->stkp;
+    out[n++] = cpu->pc & 0xFF;
+    out[n++] = cpu->pc >> 8;
+    out[n++] = cpu->status;
+    out[n++] = nes->irq_lines;
+
+    out[n++] = ppu->control.reg;
+    out[n++] = ppu->mask.reg;
+    out[n++] = ppu->status.reg;
+    out[n++] = ppu->oam_address;
+    out[n++] = ppu->address_latch;
+    out[n++] = ppu->ppu_data_buffer;
+    out[n++] = ppu->ppu_address & 0xFF;
+    out[n++] = ppu->ppu_address >> 8;
+    out[n++] = ppu->tram_address & 0xFF;
+    out[n++] = ppu->tram_address >> 8;
+    out[n++] = ppu->fine_x;
+
+    out[n++] = cart->mirror;
+    switch(cart->mapper_id){
+    case 1:
+        memcpy(out + n, &(cart->regs.mmc1), offsetof(mmc1_state, prg_bank) + 1);
+        n += offsetof(mmc1_state, prg_bank) + 1;
+        break;
+    case 4:
+        memcpy(out + n, &(cart->regs.mmc3), offsetof(mmc3_state, irq_enabled) + 1);
+        n += offsetof(mmc3_state, irq_enabled) + 1;
+        break;
+    default:
+        out[n++] = cart->regs.bank;
+        break;
+    }
+    return n;
+}
+
+uint64_t state_hash(nes_system *nes){
+    ppu_catch_up(nes);
+    mapper_sync(nes);
+
+    uint8_t registers[64];
+    size_t n = pack_registers(nes, registers);
+
+    hasher h;
+    hasher_init(&h, 0);
+    hasher_update(&h, nes->ram, sizeof(nes->ram));
+    hasher_update(&h, (const uint8_t *)nes->ppu.nametable, sizeof(nes->ppu.nametable));
+    hasher_update(&h, nes->ppu.oam.bytes, sizeof(nes->ppu.oam.bytes));
+    hasher_update(&h, nes->ppu.palletes, sizeof(nes->ppu.palletes));
+    if(nes->inserted_cart.arena) hasher_update(&h, nes->inserted_cart.arena, nes->inserted_cart.arena_size);
+    hasher_update(&h, registers, n);
+    return hasher_final(&h);
+}
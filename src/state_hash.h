@@ -0,0 +1,26 @@
+#ifndef _STATE_HASH_H_
+#define _STATE_HASH_H_
+#include <stdint.h>
+#include "bus.h"
+
+// 64 bit hash of the state that decides what an instance does next, to recognize states already
+// visited without keeping snapshots: CPU RAM, VRAM, OAM, palettes, the CPU and PPU registers, the
+// mapper registers and every writable byte of the cartridge (PRG RAM, CHR RAM, four-screen VRAM).
+//
+// Times and counters (cycles since power on, frame number, ...) are left out, so the same state
+// reached along two paths hashes the same. The APU is left out on purpose as well, although it isn't
+// only heard: $4015 reads and the frame counter and DMC IRQs reach the CPU, so two states that differ
+// only in the APU hash the same and can still go different ways later (an IRQ already asserted is part
+// of the hash).
+//
+// The hash runs 4 independent 64 bit lanes over 32 bytes at a time, each lane mixing 32x32 bit
+// products of the input with a key that changes at every step (so moving data around changes the
+// hash). On x86-64 it is compiled for AVX2 as well as the baseline, picked at load time.
+
+// Brings the lazily updated parts (PPU, mapper IRQ counter) up to date and hashes the state.
+uint64_t state_hash(nes_system *nes);
+
+// The hash itself, over any bytes.
+uint64_t state_hash_bytes(const void *data, size_t len, uint64_t seed);
+
+#endif
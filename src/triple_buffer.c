@@ -0,0 +1,32 @@
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "triple_buffer.h"
+
+void triple_buffer_init(triple_buffer *tb){
+    memset(tb->frames, 0, sizeof(tb->frames));
+    tb->back = 0;
+    atomic_store(&(tb->middle), 1);
+    tb->front = 2;
+    atomic_store(&(tb->dropped), 0);
+}
+
+frame *triple_buffer_publish(triple_buffer *tb){
+    // Release: the frame contents must be visible before the consumer can see the index
+    uint8_t old = atomic_exchange_explicit(&(tb->middle), tb->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel);
+    if(old & TRIPLE_BUFFER_FRESH){
+        atomic_fetch_add_explicit(&(tb->dropped), 1, memory_order_relaxed);
+    }
+    tb->back = old & ~TRIPLE_BUFFER_FRESH;
+    return &(tb->frames[tb->back]);
+}
+
+frame *triple_buffer_acquire(triple_buffer *tb){
+    if(!(atomic_load_explicit(&(tb->middle), memory_order_relaxed) & TRIPLE_BUFFER_FRESH)){
+        return NULL;
+    }
+    // Only the consumer clears FRESH, so the middle buffer can't go stale between the load and the exchange
+    uint8_t old = atomic_exchange_explicit(&(tb->middle), tb->front, memory_order_acq_rel);
+    tb->front = old & ~TRIPLE_BUFFER_FRESH;
+    return &(tb->frames[tb->front]);
+}
@@ -0,0 +1,46 @@
+#ifndef _TRIPLE_BUFFER_H_
+#define _TRIPLE_BUFFER_H_
+#include <stdint.h>
+#include <stdatomic.h>
+#include "bus.h"
+
+// Three framebuffers shared between the emulation thread (single producer) and the presentation
+// thread (single consumer), without locks.
+//
+// The producer always owns the "back" buffer and the consumer the "front" one. The third, "middle",
+// holds the latest completed frame and is exchanged atomically with either side. The FRESH bit in
+// "middle" tells the consumer there is a frame it hasn't taken yet; frames the consumer didn't get to
+// are simply overwritten, so the producer never waits.
+
+#define TRIPLE_BUFFER_FRESH 0x4
+
+typedef struct frame{
+    pixel screen[240][256];
+    uint64_t frame_number;
+    uint64_t completed_ns;          // CLOCK_MONOTONIC when the emulation finished it
+    uint64_t input_ns;              // Host time of the oldest input the game read during it, 0 if none
+} frame;
+
+typedef struct triple_buffer{
+    frame frames[3];
+    _Atomic uint8_t middle;         // Index of the middle buffer, plus TRIPLE_BUFFER_FRESH
+    uint8_t back;                   // Only touched by the producer
+    uint8_t front;                  // Only touched by the consumer
+    _Atomic uint64_t dropped;       // Frames published but never taken
+} triple_buffer;
+
+void triple_buffer_init(triple_buffer *tb);
+
+// Buffer the producer is currently drawing into.
+static inline frame *triple_buffer_back(triple_buffer *tb){
+    return &(tb->frames[tb->back]);
+}
+
+// Publishes the back buffer as the latest frame and returns the new back buffer.
+frame *triple_buffer_publish(triple_buffer *tb);
+
+// Takes the latest frame if there is one the consumer hasn't seen, NULL otherwise. The frame stays
+// valid until the next successful call.
+frame *triple_buffer_acquire(triple_buffer *tb);
+
+#endif
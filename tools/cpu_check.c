@@ -0,0 +1,105 @@
+// Checks of the interrupt behaviour games depend on, each one run on a small synthetic rom.
+//
+// usage: cpu_check
+//
+// Prints one line per check and exits with 1 if any of them failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bus.h"
+#include "cartridge.h"
+#include "bench_rom.h"
+
+#define CHECK_FRAMES 10
+
+// The APU frame IRQ fires about once a frame. The handler counts in $10 and acknowledges it, so the
+// count only goes past 1 if RTI enabled IRQs again.
+static const uint8_t irq_after_rti[] = {
+    0xA9, 0x00,             // C000: LDA #$00
+    0x8D, 0x17, 0x40,       // C002: STA $4017      4-step sequence, frame IRQ enabled
+    0x58,                   // C005: CLI
+    0x4C, 0x06, 0xC0,       // C006: JMP $C006
+    0xE6, 0x10,             // C009: INC $10        IRQ handler
+    0xAD, 0x15, 0x40,       // C00B: LDA $4015      acknowledges the frame IRQ
+    0x40,                   // C00E: RTI
+};
+
+// The NMI handler stores the status pushed on the stack in $11 and its own status in $12.
+static const uint8_t nmi_status[] = {
+    0x58,                   // C000: CLI
+    0xA9, 0x80,             // C001: LDA #$80
+    0x8D, 0x00, 0x20,       // C003: STA $2000      NMI at vblank
+    0x4C, 0x01, 0xC0,       // C006: JMP $C001
+    0xBA,                   // C009: TSX            NMI handler
+    0xBD, 0x01, 0x01,       // C00A: LDA $0101,X
+    0x85, 0x11,             // C00D: STA $11
+    0x08,                   // C00F: PHP
+    0x68,                   // C010: PLA
+    0x85, 0x12,             // C011: STA $12
+    0x40,                   // C013: RTI
+};
+
+// Same as above for BRK, pushed status in $13 and the handler's in $14. The frame IRQ is turned off
+// so that only BRK gets to the handler.
+static const uint8_t brk_status[] = {
+    0xA9, 0x40,             // C000: LDA #$40
+    0x8D, 0x17, 0x40,       // C002: STA $4017      frame IRQ disabled
+    0x58,                   // C005: CLI
+    0x00, 0xEA,             // C006: BRK            and its padding byte
+    0x4C, 0x08, 0xC0,       // C008: JMP $C008
+    0xBA,                   // C00B: TSX            IRQ/BRK handler
+    0xBD, 0x01, 0x01,       // C00C: LDA $0101,X
+    0x85, 0x13,             // C00F: STA $13
+    0x08,                   // C011: PHP
+    0x68,                   // C012: PLA
+    0x85, 0x14,             // C013: STA $14
+    0x40,                   // C015: RTI
+};
+
+// Runs the rom for CHECK_FRAMES frames from cleared RAM and leaves its state in "nes".
+// Returns 0 on success.
+static int run_rom(const bench_rom *rom, nes_system *nes){
+    char path[32];
+    if(bench_rom_write(rom, path) != 0) return -1;
+    memset(nes, 0, sizeof(nes_system));
+    int loaded = cartridge_load(nes, path);
+    unlink(path);
+    if(loaded != 0) return -1;
+    system_init(nes);
+    for(int f = 0; f < CHECK_FRAMES; f++) system_run_frame(nes);
+    return 0;
+}
+
+static int report(const char *name, int ok, const char *detail){
+    printf("%-16s %s%s%s\n", name, ok ? "ok" : "FAILED", ok ? "" : ": ", ok ? "" : detail);
+    return ok ? 0 : 1;
+}
+
+int main(void){
+    int failed = 0;
+    nes_system *nes = calloc(1, sizeof(nes_system));
+
+    bench_rom irq_rom = { 0, 1, 1, irq_after_rti, sizeof(irq_after_rti), 0, 0xC009 };
+    if(run_rom(&irq_rom, nes) != 0) return 1;
+    failed += report("irq after rti", nes->ram[0x10] >= CHECK_FRAMES / 2, "RTI left IRQs disabled");
+    cartridge_free(&(nes->inserted_cart));
+
+    bench_rom nmi_rom = { 0, 1, 1, nmi_status, sizeof(nmi_status), 0xC009, 0 };
+    if(run_rom(&nmi_rom, nes) != 0) return 1;
+    failed += report("nmi status", (nes->ram[0x11] & (I | B | U)) == U, "pushed status should have I and B clear, U set");
+    failed += report("nmi masks irq", (nes->ram[0x12] & I) != 0, "I should be set in the handler");
+    cartridge_free(&(nes->inserted_cart));
+
+    bench_rom brk_rom = { 0, 1, 1, brk_status, sizeof(brk_status), 0, 0xC00B };
+    if(run_rom(&brk_rom, nes) != 0) return 1;
+    failed += report("brk status", (nes->ram[0x13] & (I | B)) == B, "pushed status should have I clear, B set");
+    failed += report("brk masks irq", (nes->ram[0x14] & I) != 0, "I should be set in the handler");
+    cartridge_free(&(nes->inserted_cart));
+
+    free(nes);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+// Drives explore_run() (see src/explore.h): runs a rom for a while, then branches it along random
+// input sequences and reports how fast the branches ran and how many distinct states they reached.
+//
+// usage: explore [-b branches] [-f frames] [-w warmup] [-j parallel] [-s] rom.nes
+//
+// The first branch is also played in this process afterwards, its hash has to match the one its child
+// reported. -s keeps the last frame of every branch, to measure what that costs.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bus.h"
+#include "cartridge.h"
+#include "explore.h"
+#include "state_hash.h"
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_hashes(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[]){
+    int count = 64, parallel = 0, with_screens = 0;
+    uint32_t frames = 60, warmup = 120;
+    const char *usage = "usage: %s [-b branches] [-f frames] [-w warmup] [-j parallel] [-s] rom.nes\n";
+
+    int opt;
+    while((opt = getopt(argc, argv, "b:f:w:j:s")) != -1){
+        switch(opt){
+        case 'b':
+            count = atoi(optarg);
+            break;
+        case 'f':
+            frames = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            warmup = strtoul(optarg, NULL, 10);
+            break;
+        case 'j':
+            parallel = atoi(optarg);
+            break;
+        case 's':
+            with_screens = 1;
+            break;
+        default:
+            fprintf(stderr, usage, argv[0]);
+            return 1;
+        }
+    }
+    if(optind >= argc || count <= 0){
+        fprintf(stderr, usage, argv[0]);
+        return 1;
+    }
+
+    static nes_system nes;
+    if(cartridge_load(&nes, argv[optind]) != 0) return 1;
+    system_init(&nes);
+    for(uint32_t f = 0; f < warmup; f++) system_run_frame(&nes);
+
+    // Buttons change every few frames, the way a player (or an agent repeating actions) presses them
+    uint8_t *buttons = malloc((size_t)count * frames);
+    explore_branch *branches = malloc(count * sizeof(explore_branch));
+    uint32_t seed = 0x2545F491;
+    for(int i = 0; i < count; i++){
+        uint8_t pressed = 0;
+        for(uint32_t f = 0; f < frames; f++){
+            seed = seed * 1664525 + 1013904223;
+            if(f % 4 == 0) pressed = seed >> 24;
+            buttons[(size_t)i * frames + f] = pressed;
+        }
+        branches[i].buttons = buttons + (size_t)i * frames;
+        branches[i].frames = frames;
+    }
+
+    explore_batch batch;
+    double t0 = now_seconds();
+    if(explore_run(&batch, &nes, branches, count, with_screens, parallel) != 0) return 1;
+    double seconds = now_seconds() - t0;
+
+    int failed = 0;
+    uint64_t *hashes = malloc(count * sizeof(uint64_t));
+    for(int i = 0; i < count; i++){
+        if(batch.results[i].status != 0) failed++;
+        hashes[i] = batch.results[i].hash;
+    }
+    qsort(hashes, count, sizeof(uint64_t), compare_hashes);
+    int distinct = 0;
+    for(int i = 0; i < count; i++){
+        if(i == 0 || hashes[i] != hashes[i - 1]) distinct++;
+    }
+
+    printf("%-24s %d x %u frames after %u\n", "branches", count, frames, warmup);
+    printf("%-24s %.3f s, %.1f branches/s, %.0f frames/s\n", "run", seconds, count / seconds, (double)count * frames / seconds);
+    printf("%-24s %d\n", "distinct states", distinct);
+    if(failed) printf("%-24s %d\n", "failed branches", failed);
+
+    // The instance was left where the branches started, so branch 0 can be replayed here
+    for(uint32_t f = 0; f < frames; f++){
+        controller_set(&nes, 0, branches[0].buttons[f]);
+        system_run_frame(&nes);
+    }
+    int match = batch.results[0].status == 0 && batch.results[0].hash == state_hash(&nes);
+    printf("%-24s %s\n", "replay of branch 0", match ? "matches" : "DIFFERS");
+
+    explore_free(&batch);
+    free(hashes);
+    free(branches);
+    free(buttons);
+    cartridge_free(&(nes.inserted_cart));
+    return (failed || !match) ? 1 : 0;
+}
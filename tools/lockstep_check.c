@@ -0,0 +1,291 @@
+// Checks that the lockstep runner (see src/lockstep.h) leaves every instance exactly where running it
+// alone through system_run_frame() does.
+//
+// usage: lockstep_check [-f frames] [-r roms] [rom.nes ...]
+//
+// Every rom runs as LOCKSTEP_LANES instances twice, once lane by lane and once in lockstep, each lane
+// starting from its own RAM contents and pressing its own buttons so the lanes split and join again.
+// After every frame the state hash and master clock of each lane must match; at the end the CPU
+// cycle and instruction counts and the screen must too. Without roms on the command line, random
+// programs are made up for mappers 0, 2, 4 and 1 out of the instructions the vectors run, with
+// branches, loops and calls whose paths depend on the buttons.
+//
+// Prints one line per rom and exits with 1 if any of them diverged.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bus.h"
+#include "cartridge.h"
+#include "lockstep.h"
+#include "state_hash.h"
+#include "bench_rom.h"
+
+#define CODE_SIZE 0x3F00            // All of $C000-$FEFF, up to the RTI bench_rom puts at $FF00
+#define BODY_ITEMS 600
+#define SUBROUTINES 4
+#define SUBROUTINE_ITEMS 6
+
+enum MODE{ IMP, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY };
+
+// The instructions the lockstep runner can run on its vectors (branches and jumps are made up apart).
+// CLI is left out: the IRQ handler doesn't acknowledge anything.
+static const struct{
+    uint8_t opcode;
+    uint8_t mode;
+    uint8_t writes;             // Stores and read-modify-writes, kept away from the rom
+} instructions[] = {
+    {0xA9, IMM}, {0xA2, IMM}, {0xA0, IMM}, {0x69, IMM}, {0xE9, IMM}, {0x29, IMM}, {0x09, IMM}, {0x49, IMM},
+    {0xC9, IMM}, {0xE0, IMM}, {0xC0, IMM},
+    {0xA5, ZP}, {0xA6, ZP}, {0xA4, ZP}, {0x65, ZP}, {0xE5, ZP}, {0x25, ZP}, {0x05, ZP}, {0x45, ZP},
+    {0xC5, ZP}, {0xE4, ZP}, {0xC4, ZP}, {0x24, ZP},
+    {0x85, ZP, 1}, {0x86, ZP, 1}, {0x84, ZP, 1}, {0xE6, ZP, 1}, {0xC6, ZP, 1}, {0x06, ZP, 1}, {0x46, ZP, 1},
+    {0x26, ZP, 1}, {0x66, ZP, 1},
+    {0xB5, ZPX}, {0xB4, ZPX}, {0x75, ZPX}, {0xF5, ZPX}, {0x35, ZPX}, {0x15, ZPX}, {0x55, ZPX}, {0xD5, ZPX},
+    {0x95, ZPX, 1}, {0x94, ZPX, 1}, {0xF6, ZPX, 1}, {0xD6, ZPX, 1}, {0x16, ZPX, 1}, {0x56, ZPX, 1},
+    {0x36, ZPX, 1}, {0x76, ZPX, 1},
+    {0xB6, ZPY}, {0x96, ZPY, 1},
+    {0xAD, ABS}, {0xAE, ABS}, {0xAC, ABS}, {0x6D, ABS}, {0xED, ABS}, {0x2D, ABS}, {0x0D, ABS}, {0x4D, ABS},
+    {0xCD, ABS}, {0xEC, ABS}, {0xCC, ABS}, {0x2C, ABS},
+    {0x8D, ABS, 1}, {0x8E, ABS, 1}, {0x8C, ABS, 1}, {0xEE, ABS, 1}, {0xCE, ABS, 1}, {0x0E, ABS, 1},
+    {0x4E, ABS, 1}, {0x2E, ABS, 1}, {0x6E, ABS, 1},
+    {0xBD, ABX}, {0xBC, ABX}, {0x7D, ABX}, {0xFD, ABX}, {0x3D, ABX}, {0x1D, ABX}, {0x5D, ABX}, {0xDD, ABX},
+    {0x9D, ABX, 1}, {0xFE, ABX, 1}, {0xDE, ABX, 1}, {0x1E, ABX, 1}, {0x5E, ABX, 1}, {0x3E, ABX, 1},
+    {0x7E, ABX, 1},
+    {0xB9, ABY}, {0xBE, ABY}, {0x79, ABY}, {0xF9, ABY}, {0x39, ABY}, {0x19, ABY}, {0x59, ABY}, {0xD9, ABY},
+    {0x99, ABY, 1},
+    {0x0A, IMP}, {0x4A, IMP}, {0x2A, IMP}, {0x6A, IMP}, {0xE8, IMP}, {0xC8, IMP}, {0xCA, IMP}, {0x88, IMP},
+    {0xAA, IMP}, {0xA8, IMP}, {0x8A, IMP}, {0x98, IMP}, {0xBA, IMP}, {0x18, IMP}, {0x38, IMP},
+    {0x78, IMP}, {0xB8, IMP}, {0xD8, IMP}, {0xF8, IMP}, {0xEA, IMP},
+};
+#define N_INSTRUCTIONS (int)(sizeof(instructions) / sizeof(instructions[0]))
+
+static const uint8_t branches[] = { 0x10, 0x30, 0x50, 0x70, 0x90, 0xB0, 0xD0, 0xF0 };
+
+static uint64_t rng;
+
+static uint32_t next_random(void){
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (uint32_t)rng;
+}
+
+typedef struct program{
+    uint8_t code[CODE_SIZE];
+    int size;
+    int mapper;
+} program;
+
+static void emit(program *p, int count, ...){
+    va_list args;
+    va_start(args, count);
+    for(int i = 0; i < count; i++) p->code[p->size++] = (uint8_t)va_arg(args, int);
+    va_end(args);
+}
+
+// One of "instructions" with random operands: zero page $03-$1F ($00-$02 hold the buttons and the
+// loop counter), RAM above the stack, and for reads sometimes the rom.
+static void emit_instruction(program *p){
+    int i = next_random() % N_INSTRUCTIONS;
+    uint32_t r = next_random();
+    uint16_t addr = 0x0200 + (r >> 8) % 0x0500;
+    if(!instructions[i].writes && (r & 0x03) == 0) addr = 0x8000 + (r >> 8) % 0x7F00;
+    emit(p, 1, instructions[i].opcode);
+    switch(instructions[i].mode){
+    case IMM: emit(p, 1, r & 0xFF); break;
+    case ZP: case ZPX: case ZPY: emit(p, 1, 0x03 + r % 0x1D); break;
+    case ABS: case ABX: case ABY: emit(p, 2, addr & 0xFF, addr >> 8); break;
+    }
+}
+
+// A random instruction, or a short construct around some: forward branch, loop counted by the buttons,
+// push/pull pair, subroutine call or bank switch.
+static void emit_item(program *p, const uint16_t *subroutines, int depth){
+    uint32_t kind = next_random() % 100;
+    if(depth > 0 || kind < 65){
+        emit_instruction(p);
+    }else if(kind < 80){
+        emit(p, 2, branches[next_random() % 8], 0);
+        int start = p->size;
+        for(int n = 1 + next_random() % 3; n > 0; n--) emit_instruction(p);
+        p->code[start - 1] = p->size - start;
+    }else if(kind < 87){
+        emit(p, 6, 0xA5, 0x00, 0x29, 0x03, 0x69, 0x01);        // LDA $00, AND #$03, ADC #$01
+        emit(p, 2, 0x85, 0x02);                                  // STA $02
+        int start = p->size;
+        for(int n = 1 + next_random() % 3; n > 0; n--) emit_item(p, subroutines, depth + 1);
+        emit(p, 4, 0xC6, 0x02, 0xD0, (uint8_t)(start - (p->size + 4)));    // DEC $02, BNE start
+    }else if(kind < 92){
+        emit(p, 1, 0x48);                                        // PHA
+        emit_instruction(p);
+        emit(p, 1, 0x68);                                        // PLA
+    }else if(kind < 97 && subroutines){
+        uint16_t target = subroutines[next_random() % SUBROUTINES];
+        emit(p, 3, 0x20, target & 0xFF, target >> 8);            // JSR
+    }else if(p->mapper == 2){
+        emit(p, 5, 0xA9, next_random() & 0xFF, 0x8D, 0x00, 0x80);      // LDA #bank, STA $8000
+    }else if(p->mapper == 4){
+        // Bank select in PRG mode 0, so $C000-$FFFF stays fixed
+        emit(p, 5, 0xA9, next_random() & 0x07, 0x8D, 0x00, 0x80);      // LDA #register, STA $8000
+        emit(p, 5, 0xA9, next_random() & 0xFF, 0x8D, 0x01, 0x80);      // LDA #bank, STA $8001
+    }else{
+        emit_instruction(p);
+    }
+}
+
+// Random program on "mapper" that reads the buttons into $00-$01, then runs BODY_ITEMS random items
+// and starts over. NMIs are enabled and rendering is on, so interrupts and I/O land between them.
+// Returns 0 on success.
+static int write_random_rom(int mapper, uint64_t seed, char *path){
+    static program p;
+    memset(&p, 0, sizeof(p));
+    p.mapper = mapper;
+    rng = seed;
+
+    emit(&p, 3, 0xA2, 0xFF, 0x9A);                               // LDX #$FF, TXS
+    emit(&p, 5, 0xA9, 0x80, 0x8D, 0x00, 0x20);                   // LDA #$80, STA $2000
+    emit(&p, 5, 0xA9, 0x1E, 0x8D, 0x01, 0x20);                   // LDA #$1E, STA $2001
+    uint16_t loop = 0xC000 + p.size;
+    emit(&p, 5, 0xA9, 0x01, 0x8D, 0x16, 0x40);                   // LDA #$01, STA $4016
+    emit(&p, 5, 0xA9, 0x00, 0x8D, 0x16, 0x40);                   // LDA #$00, STA $4016
+    for(int i = 0; i < 2; i++){
+        emit(&p, 5, 0xAD, 0x16, 0x40, 0x29, 0x01);               // LDA $4016, AND #$01
+        emit(&p, 2, 0x85, i);                                    // STA $00 + i
+    }
+
+    // Subroutines first, so the body can call them
+    uint16_t subroutines[SUBROUTINES];
+    emit(&p, 3, 0x4C, 0, 0);                                     // JMP over them
+    int jump = p.size - 2;
+    for(int s = 0; s < SUBROUTINES; s++){
+        subroutines[s] = 0xC000 + p.size;
+        for(int i = 0; i < SUBROUTINE_ITEMS; i++) emit_item(&p, NULL, 0);
+        emit(&p, 1, 0x60);                                       // RTS
+    }
+    p.code[jump] = (0xC000 + p.size) & 0xFF;
+    p.code[jump + 1] = (0xC000 + p.size) >> 8;
+
+    for(int i = 0; i < BODY_ITEMS; i++) emit_item(&p, subroutines, 0);
+    emit(&p, 3, 0x4C, loop & 0xFF, loop >> 8);                   // JMP loop
+
+    bench_rom rom = { mapper, mapper == 0 ? 2 : 8, 1, p.code, p.size, 0, 0 };
+    return bench_rom_write(&rom, path);
+}
+
+// Buttons held by "lane" during "frame": the first lanes never press anything, so some lanes stay
+// together, the others change every frame.
+static uint8_t lane_buttons(int lane, int frame){
+    uint32_t h = (uint32_t)lane * 0x9E3779B1u ^ (uint32_t)frame * 0x85EBCA6Bu;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    return lane < 4 ? 0 : h >> 24;
+}
+
+static nes_system *make_lane(const char *path, int lane){
+    nes_system *nes = calloc(1, sizeof(nes_system));
+    if(cartridge_load(nes, (char *)path) != 0) return NULL;
+    system_init(nes);
+    for(int i = 0; i < 2048; i++) nes->ram[i] = (i * 7 + (lane % 5) * (i & 3)) & 0xFF;
+    nes->ppu.screen = malloc(sizeof(pixel[240][256]));
+    return nes;
+}
+
+static void free_lane(nes_system *nes){
+    cartridge_free(&(nes->inserted_cart));
+    free(nes->ppu.screen);
+    free(nes);
+}
+
+// Runs "path" both ways for "frames" frames and reports it as "name". Returns 0 if every lane matched,
+// 1 if not, -1 if the rom can't be loaded.
+static int check_rom(const char *path, const char *name, int frames){
+    nes_system *alone[LOCKSTEP_LANES], *together[LOCKSTEP_LANES];
+    for(int i = 0; i < LOCKSTEP_LANES; i++){
+        alone[i] = make_lane(path, i);
+        together[i] = make_lane(path, i);
+        if(alone[i] == NULL || together[i] == NULL) return -1;
+    }
+    lockstep_group group;
+    lockstep_init(&group, together, LOCKSTEP_LANES);
+
+    int diverged = -1, frame = 0;
+    for(; frame < frames && diverged < 0; frame++){
+        for(int i = 0; i < LOCKSTEP_LANES; i++){
+            controller_set(alone[i], 0, lane_buttons(i, frame));
+            controller_set(together[i], 0, lane_buttons(i, frame));
+            system_run_frame(alone[i]);
+        }
+        lockstep_run_frame(&group);
+        for(int i = 0; i < LOCKSTEP_LANES && diverged < 0; i++){
+            if(state_hash(alone[i]) != state_hash(together[i]) || alone[i]->master_clock != together[i]->master_clock){
+                diverged = i;
+            }
+        }
+    }
+    for(int i = 0; i < LOCKSTEP_LANES && diverged < 0; i++){
+        if(alone[i]->cpu.clock_count != together[i]->cpu.clock_count ||
+           alone[i]->cpu.instruction_count != together[i]->cpu.instruction_count ||
+           memcmp(alone[i]->ppu.screen, together[i]->ppu.screen, sizeof(pixel[240][256])) != 0){
+            diverged = i;
+        }
+    }
+
+    uint64_t total = group.vector_instructions + group.scalar_steps;
+    if(diverged < 0){
+        printf("%-24s ok, %.1f%% of %llu instructions on the vectors\n", name,
+               100.0 * group.vector_instructions / total, (unsigned long long)total);
+    }else{
+        printf("%-24s FAILED: lane %d diverged by frame %d (pc $%04X alone, $%04X in lockstep)\n", name,
+               diverged, frame, alone[diverged]->cpu.pc, together[diverged]->cpu.pc);
+    }
+    for(int i = 0; i < LOCKSTEP_LANES; i++){
+        free_lane(alone[i]);
+        free_lane(together[i]);
+    }
+    return diverged >= 0;
+}
+
+int main(int argc, char *argv[]){
+    int frames = 60, roms = 8;
+
+    int opt;
+    while((opt = getopt(argc, argv, "f:r:")) != -1){
+        switch(opt){
+        case 'f':
+            frames = atoi(optarg);
+            break;
+        case 'r':
+            roms = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-f frames] [-r roms] [rom.nes ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    if(optind < argc){
+        for(int i = optind; i < argc; i++){
+            int result = check_rom(argv[i], argv[i], frames);
+            if(result < 0) return 1;
+            failed += result;
+        }
+    }else{
+        static const int mappers[] = { 0, 2, 4, 1 };
+        for(int r = 0; r < roms; r++){
+            char path[32], name[32];
+            if(write_random_rom(mappers[r % 4], 1234567 + r * 7919, path) != 0) return 1;
+            snprintf(name, sizeof(name), "random %d, mapper %d", r, mappers[r % 4]);
+            int result = check_rom(path, name, frames);
+            unlink(path);
+            if(result < 0) return 1;
+            failed += result;
+        }
+    }
+    return failed ? 1 : 0;
+}
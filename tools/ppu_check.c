@@ -0,0 +1,231 @@
+// Checks of the PPU status and of the predictions the mappers rely on, run on small synthetic roms.
+//
+// usage: ppu_check
+//
+// Prints one line per check and exits with 1 if any of them failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bus.h"
+#include "cartridge.h"
+#include "ppu_2C02.h"
+#include "bench_rom.h"
+
+static const uint8_t idle[] = {
+    0x4C, 0x00, 0xC0,       // C000: JMP $C000
+};
+
+// Counts in $10 the vertical blanks seen by polling $2002, the way games wait for them
+static const uint8_t vblank_wait[] = {
+    0x2C, 0x02, 0x20,       // C000: BIT $2002
+    0x10, 0xFB,             // C003: BPL $C000
+    0xE6, 0x10,             // C005: INC $10
+    0x4C, 0x00, 0xC0,       // C007: JMP $C000
+};
+
+#define VBLANK_FRAMES 10
+
+static int report(const char *name, int ok, const char *detail){
+    printf("%-24s %s%s%s\n", name, ok ? "ok" : "FAILED", ok ? "" : ": ", ok ? "" : detail);
+    return ok ? 0 : 1;
+}
+
+// The edges ppu_a12_find() gives must be the ones ppu_a12_rises() counts, in order.
+static int a12_consistent(nes_system *nes, uint64_t start, uint64_t frame_dots){
+    uint64_t previous = start;
+    for(uint32_t n = 1;; n++){
+        uint64_t dot = ppu_a12_find(nes, start, n);
+        if(dot == UINT64_MAX) return n == 1;
+        if(dot >= start + frame_dots) return 1;
+        if(dot < previous || ppu_a12_rises(nes, start, dot) != n - 1 || ppu_a12_rises(nes, start, dot + 1) != n) return 0;
+        previous = dot + 1;
+    }
+}
+
+// Rising edges of A12 over a frame for every pattern table setup. With 8x8 sprites there is one per
+// line on the dot the fetches switch to $1000, plus the first background fetch after vertical blank
+// when the background uses $1000.
+static int check_a12(nes_system *nes){
+    static const struct{
+        const char *name;
+        uint8_t control;
+        uint32_t rises;         // Per frame, 0xFFFFFFFF when only checked for consistency
+    } setups[] = {
+        { "a12 bg 0 sprites 0",     0x00, 0 },
+        { "a12 bg 0 sprites 1",     0x08, 241 },
+        { "a12 bg 1 sprites 0",     0x10, 242 },
+        { "a12 bg 1 sprites 1",     0x18, 1 },
+        { "a12 8x16 bg 0",          0x20, 0xFFFFFFFF },
+        { "a12 8x16 bg 1",          0x30, 0xFFFFFFFF },
+    };
+    int failed = 0;
+    uint64_t frame_dots = (uint64_t)(nes->timing->last_scanline + 2) * 341;
+
+    // Sprites spread over the screen, every other one from the $1000 table in 8x16 mode
+    for(int i = 0; i < 64; i++){
+        nes->ppu.oam.entry[i].y = i * 4;
+        nes->ppu.oam.entry[i].id = i;
+    }
+    nes->ppu.mask.reg = 0x18;
+    for(size_t s = 0; s < sizeof(setups) / sizeof(setups[0]); s++){
+        nes->ppu.control.reg = setups[s].control;
+        nes->ppu.sprites_dirty = 1;
+        uint64_t start = ppu_dot_count(nes);
+        uint64_t rises = ppu_a12_rises(nes, start, start + frame_dots);
+        int ok = a12_consistent(nes, start, frame_dots) && rises == ppu_a12_rises(nes, start + frame_dots, start + 2 * frame_dots);
+        if(setups[s].rises != 0xFFFFFFFF) ok = ok && rises == setups[s].rises;
+        if(setups[s].control & 0x20) ok = ok && rises > 0;
+        failed += report(setups[s].name, ok, "edges per frame or their positions are wrong");
+    }
+    nes->ppu.mask.reg = 0;
+    return failed;
+}
+
+// The scroll increments of v happen when background or sprites are enabled, 240 lines from the top
+// left nametable leave it at the top of the one below.
+static int check_scroll(nes_system *nes){
+    static const struct{
+        const char *name;
+        uint8_t mask;
+        uint16_t v;
+    } setups[] = {
+        { "scroll rendering off",   0x00, 0x0000 },
+        { "scroll background",      0x08, 0x0800 },
+        { "scroll sprites",         0x10, 0x0800 },
+    };
+    int failed = 0;
+    for(size_t s = 0; s < sizeof(setups) / sizeof(setups[0]); s++){
+        nes->ppu.mask.reg = setups[s].mask;
+        nes->ppu.tram_address = 0x0000;
+        nes->ppu.ppu_address = 0x0000;
+        system_run_frame(nes);
+        failed += report(setups[s].name, nes->ppu.ppu_address == setups[s].v, "v wasn't advanced line by line");
+    }
+    nes->ppu.mask.reg = 0;
+    return failed;
+}
+
+static uint8_t luma_of(uint32_t argb){
+    return (77 * ((argb >> 16) & 0xFF) + 150 * ((argb >> 8) & 0xFF) + 29 * (argb & 0xFF) + 128) >> 8;
+}
+
+// Length of [a0, a1) inside [b0, b1)
+static double overlap(double a0, double a1, double b0, double b1){
+    double low = a0 > b0 ? a0 : b0, high = a1 < b1 ? a1 : b1;
+    return high > low ? high - low : 0;
+}
+
+// The index, luminance and 84x84 frames against the ARGB frame drawn with them, on a screen of
+// varied tiles and palettes. Each index has to give a single color, each luminance has to be that
+// of its color, and each small pixel the average of the luminance over its area, give or take the
+// rounding.
+static int check_outputs(nes_system *nes){
+    static pixel screen[240][256];
+    static uint8_t index_screen[240][256];
+    static uint8_t luma_screen[240][256];
+    static uint8_t small_screen[PPU_SMALL_HEIGHT][PPU_SMALL_WIDTH];
+    int failed = 0;
+
+    for(int q = 0; q < 4; q++){
+        for(int i = 0; i < 1024; i++) nes->ppu.nametable_map[q][i] = i * 7 + q;
+    }
+    for(int i = 0; i < 32; i++) nes->ppu.palletes[i] = (i * 5 + 1) & 0x3F;
+    for(int i = 0; i < 64; i++){
+        nes->ppu.oam.entry[i].y = i * 3;
+        nes->ppu.oam.entry[i].x = i * 4;
+        nes->ppu.oam.entry[i].id = i;
+    }
+    nes->ppu.sprites_dirty = 1;
+    nes->ppu.mask.reg = 0x1E;
+    nes->ppu.screen = screen;
+    nes->ppu.index_screen = index_screen;
+    nes->ppu.luma_screen = luma_screen;
+    nes->ppu.small_screen = small_screen;
+    system_run_frame(nes);
+    system_run_frame(nes);
+
+    uint32_t color_of[0x40] = {0};
+    uint8_t seen[0x40] = {0};
+    int colors = 0, index_ok = 1, luma_ok = 1, small_ok = 1;
+    for(int y = 0; y < 240; y++){
+        for(int x = 0; x < 256; x++){
+            uint8_t i = index_screen[y][x];
+            uint32_t argb = screen[y][x].ARGB;
+            if(i >= 0x40){
+                index_ok = 0;
+                continue;
+            }
+            if(!seen[i]){
+                seen[i] = 1;
+                color_of[i] = argb;
+                colors++;
+            }
+            if(color_of[i] != argb) index_ok = 0;
+            if(luma_screen[y][x] != luma_of(argb)) luma_ok = 0;
+        }
+    }
+    failed += report("index frame", index_ok && colors > 8, "indexes don't match the ARGB frame");
+    failed += report("luma frame", luma_ok, "luminance doesn't match the ARGB frame");
+
+    double width = 256.0 / PPU_SMALL_WIDTH, height = 240.0 / PPU_SMALL_HEIGHT;
+    for(int r = 0; r < PPU_SMALL_HEIGHT; r++){
+        for(int c = 0; c < PPU_SMALL_WIDTH; c++){
+            double sum = 0;
+            for(int y = (int)(r * height); y < 240 && y < (r + 1) * height; y++){
+                double h = overlap(y, y + 1, r * height, (r + 1) * height);
+                for(int x = (int)(c * width); x < 256 && x < (c + 1) * width; x++){
+                    sum += luma_of(screen[y][x].ARGB) * h * overlap(x, x + 1, c * width, (c + 1) * width);
+                }
+            }
+            double expected = sum / (width * height);
+            double diff = small_screen[r][c] - expected;
+            if(diff > 1 || diff < -1) small_ok = 0;
+        }
+    }
+    failed += report("84x84 frame", small_ok, "not the area average of the luminance");
+
+    nes->ppu.screen = nes->ppu.screen_buffer;
+    nes->ppu.index_screen = NULL;
+    nes->ppu.luma_screen = NULL;
+    nes->ppu.small_screen = NULL;
+    nes->ppu.mask.reg = 0;
+    return failed;
+}
+
+// Loads "rom" in "nes" from cleared RAM and runs it for "frames" frames. Returns 0 on success.
+static int run_rom(const bench_rom *rom, nes_system *nes, int frames){
+    char path[32];
+    if(bench_rom_write(rom, path) != 0) return -1;
+    memset(nes, 0, sizeof(nes_system));
+    int loaded = cartridge_load(nes, path);
+    unlink(path);
+    if(loaded != 0) return -1;
+    system_init(nes);
+    for(int f = 0; f < frames; f++) system_run_frame(nes);
+    return 0;
+}
+
+int main(void){
+    int failed = 0;
+    nes_system *nes = calloc(1, sizeof(nes_system));
+
+    bench_rom vblank_rom = { 0, 1, 1, vblank_wait, sizeof(vblank_wait), 0, 0 };
+    if(run_rom(&vblank_rom, nes, VBLANK_FRAMES) != 0) return 1;
+    int waits = nes->ram[0x10];
+    failed += report("vblank wait", waits >= VBLANK_FRAMES - 1 && waits <= VBLANK_FRAMES, "$2002 bit 7 isn't set once per frame");
+    cartridge_free(&(nes->inserted_cart));
+
+    bench_rom idle_rom = { 0, 1, 1, idle, sizeof(idle), 0, 0 };
+    if(run_rom(&idle_rom, nes, 1) != 0) return 1;
+    failed += check_a12(nes);
+    failed += check_scroll(nes);
+    failed += check_outputs(nes);
+    cartridge_free(&(nes->inserted_cart));
+
+    free(nes);
+    return failed ? 1 : 0;
+}
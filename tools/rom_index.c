@@ -0,0 +1,246 @@
+// Builds the rom library index read by the emulator at startup (see src/rom_index.h).
+//
+// usage: rom_index [-o index] [-f fixes.txt] dir...
+//
+// Every .nes file under the given directories is hashed and its header decoded. Files already in
+// the previous index with the same size and modification time are not read again, so refreshing the
+// index of a large library only costs the stat() calls.
+//
+// The fixes file holds one line per rom with a known bad header, keyed by the CRC32 of PRG+CHR:
+//
+//     # crc32   fixes
+//     1a2b3c4d  mapper=2 mirror=v
+//
+// "mirror" is one of h, v or 4 (four screen).
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cartridge.h"
+#include "rom_index.h"
+
+typedef struct rom_fix{
+    uint32_t crc32;
+    uint8_t flags;
+    uint16_t mapper;
+    uint8_t mirror;
+} rom_fix;
+
+// Index being built. nftw() has no user pointer, so it lives here.
+static rom_index_entry *entries;
+static uint32_t count, capacity;
+static char *strings;
+static uint32_t strings_size, strings_capacity;
+
+static rom_index previous;
+static rom_fix *fixes;
+static int n_fixes;
+static uint32_t hashed, reused, failed;
+
+static uint32_t add_string(const char *s){
+    uint32_t len = strlen(s) + 1;
+    if(strings_size + len > strings_capacity){
+        strings_capacity = (strings_capacity + len) * 2;
+        strings = realloc(strings, strings_capacity);
+    }
+    memcpy(strings + strings_size, s, len);
+    strings_size += len;
+    return strings_size - len;
+}
+
+// Fills the hashes and header fields of "entry" from the file contents. Returns 0 on success.
+static int hash_rom(const char *path, const struct stat *st, rom_index_entry *entry){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        perror(path);
+        return -1;
+    }
+    const uint8_t *data = NULL;
+    if(st->st_size > 0){
+        void *map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        data = map == MAP_FAILED ? NULL : map;
+    }
+    close(fd);
+    if(data == NULL || (size_t)st->st_size < sizeof(header_t)){
+        fprintf(stderr, "%s: can't read\n", path);
+        if(data) munmap((void *)data, st->st_size);
+        return -1;
+    }
+    madvise((void *)data, st->st_size, MADV_SEQUENTIAL);
+
+    // The contents are hashed without the header, so a fixed header doesn't change the key.
+    // A rom whose header can't be decoded is hashed whole (minus the 16 bytes).
+    rom_layout layout;
+    const char *error = cartridge_parse_header((const header_t *)data, st->st_size, &layout);
+    const uint8_t *contents;
+    size_t len;
+    if(error == NULL){
+        contents = data + layout.prg_offset;
+        len = layout.prg_size + layout.chr_size;
+        entry->prg_size = layout.prg_size;
+        entry->chr_size = layout.chr_size;
+        entry->mapper_id = layout.mapper_id;
+        entry->mirror = layout.mirror;
+        entry->timing = layout.timing;
+        entry->nes2 = layout.nes2;
+        entry->submapper = layout.submapper;
+    }else{
+        fprintf(stderr, "%s: %s\n", path, error);
+        contents = data + sizeof(header_t);
+        len = st->st_size - sizeof(header_t);
+        entry->flags |= ROM_INDEX_BAD_HEADER;
+    }
+    entry->crc32 = rom_crc32(0, contents, len);
+    rom_sha1(contents, len, entry->sha1);
+
+    munmap((void *)data, st->st_size);
+    return 0;
+}
+
+static int visit(const char *path, const struct stat *st, int type, struct FTW *ftw){
+    size_t len = strlen(path);
+    if(type != FTW_F || len < 4 || strcasecmp(path + len - 4, ".nes") != 0){
+        return 0;
+    }
+
+    char full[PATH_MAX];
+    if(realpath(path, full) == NULL){
+        perror(path);
+        failed++;
+        return 0;
+    }
+
+    rom_index_entry entry;
+    const rom_index_entry *old = rom_index_find(&previous, full);
+    if(old != NULL){
+        entry = *old;
+        reused++;
+    }else{
+        memset(&entry, 0, sizeof(entry));
+        entry.size = st->st_size;
+        entry.mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+        if(hash_rom(full, st, &entry) != 0){
+            failed++;
+            return 0;
+        }
+        hashed++;
+    }
+
+    // Fixes are always taken from the current fixes file
+    entry.flags &= ~(ROM_INDEX_FIX_MAPPER | ROM_INDEX_FIX_MIRROR);
+    for(int i = 0; i < n_fixes; i++){
+        if(fixes[i].crc32 == entry.crc32){
+            entry.flags |= fixes[i].flags;
+            entry.fix_mapper = fixes[i].mapper;
+            entry.fix_mirror = fixes[i].mirror;
+        }
+    }
+
+    entry.path_hash = rom_index_path_hash(full);
+    entry.path_offset = add_string(full);
+    if(count == capacity){
+        capacity = capacity ? capacity * 2 : 256;
+        entries = realloc(entries, capacity * sizeof(rom_index_entry));
+    }
+    entries[count++] = entry;
+    return 0;
+}
+
+static int load_fixes(const char *path){
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL){
+        perror(path);
+        return -1;
+    }
+    char line[256];
+    int line_number = 0;
+    while(fgets(line, sizeof(line), fp)){
+        line_number++;
+        char *p = line + strspn(line, " \t");
+        if(*p == '#' || *p == '\n' || *p == '\0') continue;
+
+        rom_fix fix = {0};
+        char *end;
+        fix.crc32 = strtoul(p, &end, 16);
+        if(end == p){
+            fprintf(stderr, "%s:%d: expected a crc32\n", path, line_number);
+            continue;
+        }
+        for(char *tok = strtok(end, " \t\n"); tok; tok = strtok(NULL, " \t\n")){
+            if(strncmp(tok, "mapper=", 7) == 0){
+                fix.flags |= ROM_INDEX_FIX_MAPPER;
+                fix.mapper = atoi(tok + 7);
+            }else if(strncmp(tok, "mirror=", 7) == 0){
+                fix.flags |= ROM_INDEX_FIX_MIRROR;
+                switch(tok[7]){
+                case 'h': case 'H': fix.mirror = HORIZONTAL; break;
+                case 'v': case 'V': fix.mirror = VERTICAL; break;
+                case '4': fix.mirror = FOUR_SCREEN; break;
+                default:
+                    fprintf(stderr, "%s:%d: unknown mirroring \"%s\"\n", path, line_number, tok + 7);
+                    fix.flags &= ~ROM_INDEX_FIX_MIRROR;
+                }
+            }else{
+                fprintf(stderr, "%s:%d: unknown fix \"%s\"\n", path, line_number, tok);
+            }
+        }
+        fixes = realloc(fixes, (n_fixes + 1) * sizeof(rom_fix));
+        fixes[n_fixes++] = fix;
+    }
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char *argv[]){
+    const char *index_path = "roms.idx";
+    const char *fixes_path = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "o:f:")) != -1){
+        switch(opt){
+        case 'o':
+            index_path = optarg;
+            break;
+        case 'f':
+            fixes_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-o index] [-f fixes.txt] dir...\n", argv[0]);
+            return 1;
+        }
+    }
+    if(optind >= argc){
+        fprintf(stderr, "usage: %s [-o index] [-f fixes.txt] dir...\n", argv[0]);
+        return 1;
+    }
+    if(fixes_path && load_fixes(fixes_path) != 0) return 1;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    rom_index_open(&previous, index_path);     // Missing is fine, everything gets hashed
+    for(int i = optind; i < argc; i++){
+        if(nftw(argv[i], visit, 32, FTW_PHYS) != 0){
+            perror(argv[i]);
+        }
+    }
+    rom_index_close(&previous);
+
+    if(rom_index_write(index_path, entries, count, strings, strings_size) != 0) return 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("%s: %u roms (%u hashed, %u unchanged, %u failed) in %.3f s\n", index_path, count, hashed, reused, failed,
+        (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9);
+    return failed != 0;
+}
@@ -0,0 +1,81 @@
+// Stand-in for a bot: steps an emulator exported by shm_host and checks what comes back.
+//
+// usage: shm_client [-n name] [-f frames] [-q]
+//
+// Every frame is requested with a different input, the observation is then read in place. Reports
+// the frames per second and the round trip time of a step, -q also stops the host at the end.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shm_export.h"
+
+#define STEP_TIMEOUT_MS 1000
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]){
+    const char *name = SHM_EXPORT_NAME;
+    uint64_t frames = 600;
+    int quit = 0;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:f:q")) != -1){
+        switch(opt){
+        case 'n':
+            name = optarg;
+            break;
+        case 'f':
+            frames = strtoull(optarg, NULL, 10);
+            break;
+        case 'q':
+            quit = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n name] [-f frames] [-q]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    shm_export ex;
+    if(shm_export_open(&ex, name) != 0) return 1;
+    shm_region *region = ex.region;
+
+    uint64_t first = region->frame_number;
+    uint64_t worst_ns = 0, errors = 0;
+    uint32_t checksum = 0;
+    uint64_t start = now_ns();
+    for(uint64_t i = 0; i < frames; i++){
+        uint64_t t0 = now_ns();
+        if(shm_export_step(&ex, (uint8_t)i, 0, STEP_TIMEOUT_MS) != 0){
+            fprintf(stderr, "no answer from the emulator after frame %llu\n", (unsigned long long)i);
+            shm_export_close(&ex);
+            return 1;
+        }
+        uint64_t t = now_ns() - t0;
+        if(t > worst_ns) worst_ns = t;
+
+        // The emulator is idle until the next step, the observation can be used in place
+        if(region->frame_number != first + i + 1 || (atomic_load(&(region->sequence)) & 1)) errors++;
+        for(int a = 0; a < 2048; a++) checksum = checksum * 31 + region->ram[a];
+        checksum ^= region->screen[120][128].ARGB ^ region->index_screen[120][128];
+        checksum ^= region->luma_screen[120][128] ^ region->small_screen[42][42];
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    printf("%llu frames in %.3f s: %.1f frames/s, %.1f us per step (worst %.1f us)\n",
+        (unsigned long long)frames, seconds, frames / seconds, seconds * 1e6 / frames, worst_ns / 1e3);
+    printf("observation checksum %08x, %llu errors\n", checksum, (unsigned long long)errors);
+
+    if(quit) shm_export_quit(&ex);
+    shm_export_close(&ex);
+    return errors ? 1 : 0;
+}
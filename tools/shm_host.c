@@ -0,0 +1,80 @@
+// Runs the emulator headless, one frame per request of a client attached through shared memory
+// (see src/shm_export.h).
+//
+// usage: shm_host [-n name] [-o outputs] rom.nes
+//
+// "outputs" picks the frames drawn into the region, any of a (ARGB, the default), i (palette index),
+// l (luminance) and s (luminance at 84x84).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bus.h"
+#include "cartridge.h"
+#include "shm_export.h"
+
+// Returns the SHM_EXPORT_* flags of the letters in "letters", 0 if one isn't known.
+static uint32_t parse_outputs(const char *letters){
+    static const char names[] = "ails";
+    uint32_t outputs = 0;
+    for(; *letters; letters++){
+        const char *found = strchr(names, *letters);
+        if(found == NULL) return 0;
+        outputs |= 1 << (found - names);
+    }
+    return outputs;
+}
+
+int main(int argc, char *argv[]){
+    const char *name = SHM_EXPORT_NAME;
+    uint32_t outputs = SHM_EXPORT_ARGB;
+    const char *usage = "usage: %s [-n name] [-o outputs] rom.nes\n";
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:o:")) != -1){
+        switch(opt){
+        case 'n':
+            name = optarg;
+            break;
+        case 'o':
+            outputs = parse_outputs(optarg);
+            if(outputs == 0){
+                fprintf(stderr, "outputs are letters among a, i, l and s\n");
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, usage, argv[0]);
+            return 1;
+        }
+    }
+    if(optind >= argc){
+        fprintf(stderr, usage, argv[0]);
+        return 1;
+    }
+
+    static nes_system nes;
+    if(cartridge_load(&nes, argv[optind]) != 0) return 1;
+    system_init(&nes);
+
+    shm_export ex;
+    if(shm_export_create(&ex, name, outputs) != 0) return 1;
+    shm_export_attach(&ex, &nes);
+    printf("exporting %s on %s\n", argv[optind], name);
+    fflush(stdout);
+
+    uint64_t frames = 0;
+    while(shm_export_wait(&ex, &nes) == 0){
+        system_run_frame(&nes);
+        shm_export_publish(&ex, &nes);
+        frames++;
+    }
+
+    printf("%llu frames\n", (unsigned long long)frames);
+    shm_export_close(&ex);
+    cartridge_free(&(nes.inserted_cart));
+    return 0;
+}